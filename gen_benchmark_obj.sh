@@ -0,0 +1,39 @@
+#!/bin/bash
+
+# Writes a UV sphere made of SEGMENTS x SEGMENTS quads (2 * SEGMENTS^2 triangles, each corner with
+# its own position, texture coordinate and normal) to OUTPUT_FILE, for timing the OBJ parser with
+# --obj-benchmark. The default of 710 segments gives about a million triangles in a 74 MB file.
+
+OUTPUT_FILE=$1
+SEGMENTS=${2:-710}
+
+awk -v n="$SEGMENTS" 'BEGIN {
+    pi = 3.14159265358979
+
+    for (i = 0; i <= n; i++) {
+        theta = pi * i / n
+
+        for (j = 0; j <= n; j++) {
+            phi = 2 * pi * j / n
+            x = sin(theta) * cos(phi)
+            y = cos(theta)
+            z = sin(theta) * sin(phi)
+
+            printf "v %.6f %.6f %.6f\n", x, y, z
+            printf "vt %.6f %.6f\n", j / n, 1 - i / n
+            printf "vn %.6f %.6f %.6f\n", x, y, z
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            a = i * (n + 1) + j + 1
+            b = a + 1
+            c = a + n + 1
+            d = c + 1
+
+            printf "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c
+            printf "f %d/%d/%d %d/%d/%d %d/%d/%d\n", b, b, b, d, d, d, c, c, c
+        }
+    }
+}' > "$OUTPUT_FILE"
@@ -0,0 +1,70 @@
+#ifndef HW3_ASSETLOADER_HPP
+#define HW3_ASSETLOADER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hw3 {
+    /*
+     * Runs slow asset loading work (file IO, parsing, decoding) on a pool of background threads.
+     * Jobs are started in the order they were queued, but several may run at once and they may
+     * finish in any order. OpenGL may only be used on the main thread, so jobs hand their results
+     * back as completions, which the main thread runs in the order they were posted whenever it
+     * calls run_completions. A job may post any number of completions, and a completion may queue
+     * further jobs.
+     *
+     * An exception thrown by a job is rethrown on the main thread by run_completions. Jobs must not
+     * hold the last reference to anything that owns OpenGL objects, since they're destroyed on a
+     * background thread.
+     */
+    class AssetLoader {
+        std::vector<std::thread> m_threads;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_job_available;
+        std::deque<std::function<void ()>> m_jobs;
+        std::deque<std::function<void ()>> m_completions;
+
+        // The number of jobs that haven't finished yet plus the number of completions that haven't
+        // been run yet
+        size_t m_pending = 0;
+        bool m_stopping = false;
+
+        void run();
+    public:
+        // Starts the given number of threads, or one per core if num_threads is 0
+        explicit AssetLoader(size_t num_threads = 0);
+        AssetLoader(const AssetLoader& other) = delete;
+        ~AssetLoader();
+
+        AssetLoader& operator =(const AssetLoader& other) = delete;
+
+        void queue(std::function<void ()> job);
+        void complete(std::function<void ()> completion);
+
+        /*
+         * Runs completions on the calling thread until there are none left or the time budget is
+         * used up. At least one completion is always run if there is one, so that a completion that
+         * takes longer than the budget can't stall loading. Returns the number of completions run.
+         */
+        size_t run_completions(std::chrono::steady_clock::duration budget);
+
+        // Whether all queued jobs and all of their completions have finished
+        bool idle() const;
+
+        /*
+         * The number of threads that work on the calling thread (e.g. parsing a model) should be
+         * spread over: one per core, or just the calling thread itself on a loader's thread, since
+         * the loader's other threads are already keeping every core busy.
+         */
+        static unsigned int worker_threads();
+    };
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef HW3_CACHEFILE_HPP
+#define HW3_CACHEFILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+namespace hw3 {
+    /*
+     * What the model and texture caches record about the file they were built from. A cache is
+     * only used if all of this still matches, so it's rebuilt whenever the source file is
+     * modified, and a cache that was copied along with a different file of the same name isn't
+     * mistaken for its own.
+     */
+    struct CacheSource {
+        uint64_t size;
+        int64_t mtime_sec;
+        int64_t mtime_nsec;
+
+        std::string canonical_path;
+    };
+
+    /*
+     * Examines the source file at the given path. Returns false if it can't be examined, in which
+     * case caching is skipped altogether.
+     */
+    bool cache_source_info(const boost::filesystem::path& path, CacheSource& source);
+
+    // Cache files store the source's canonical path padded to this length, to keep what follows
+    // it 8-byte aligned
+    size_t cache_padded_path_length(size_t length);
+
+    /*
+     * Writes a cache file by calling write with a stream to a temporary file and then moving that
+     * into place, so that a concurrent or interrupted run never sees a partially written cache.
+     * If anything goes wrong, a warning naming the kind of cache (e.g. "model") is printed and
+     * no cache is written.
+     */
+    void write_cache_file(
+        const boost::filesystem::path& path,
+        const char* kind,
+        const std::function<void (std::ostream&)>& write
+    );
+}
+
+#endif
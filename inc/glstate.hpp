@@ -0,0 +1,60 @@
+#ifndef HW3_GLSTATE_HPP
+#define HW3_GLSTATE_HPP
+
+#include <cstddef>
+
+#define GLFW_INCLUDE_GLCOREARB
+#define GL_GLEXT_PROTOTYPES
+#include <GLFW/glfw3.h>
+
+namespace hw3 {
+    struct GlStateStats {
+        // Binds that reached the driver, and binds that were skipped because nothing changed
+        size_t issued = 0;
+        size_t skipped = 0;
+
+        GlStateStats operator -(const GlStateStats& other) const {
+            GlStateStats result;
+
+            result.issued = this->issued - other.issued;
+            result.skipped = this->skipped - other.skipped;
+
+            return result;
+        }
+    };
+
+    /*
+     * Remembers which program, vertex array, element buffers and per-unit textures and samplers are
+     * bound, so that binding the same ones again (as happens for consecutive objects drawn with the
+     * same program, model and texture arrays) doesn't cost any GL calls. This only works as long
+     * as everything that draws binds these through here.
+     *
+     * Texture unit 0 is only ever used for uploads (see ShaderProgram), which bind textures to it
+     * directly, so it isn't tracked and bind_texture asserts it isn't used.
+     */
+    namespace gl_state {
+        void use_program(GLuint program);
+        void bind_vertex_array(GLuint vertex_array);
+
+        // Element buffers are part of the vertex array's state, so this binds to the current one
+        void bind_element_buffer(GLuint buffer);
+
+        void bind_texture(GLuint unit, GLenum target, GLuint texture);
+        void bind_sampler(GLuint unit, GLuint sampler);
+
+        /*
+         * Deleting an object unbinds it from wherever it's currently bound, and its name may then
+         * be reused for a new one, so everything that deletes one of these has to forget it.
+         */
+        void forget_program(GLuint program);
+        void forget_vertex_array(GLuint vertex_array);
+        void forget_buffer(GLuint buffer);
+        void forget_texture(GLuint texture);
+        void forget_sampler(GLuint sampler);
+
+        // The number of binds issued and skipped since the program started
+        GlStateStats stats();
+    }
+}
+
+#endif
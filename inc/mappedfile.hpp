@@ -0,0 +1,51 @@
+#ifndef HW3_MAPPEDFILE_HPP
+#define HW3_MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace hw3 {
+    /*
+     * Read-only view of an entire file. Regular files are memory-mapped so that parsers can walk
+     * the page cache directly; anything that can't be mapped (pipes, character devices, etc.) is
+     * read into memory in one go instead.
+     */
+    class MappedFile {
+        const char* m_data;
+        std::size_t m_size;
+        bool m_mapped;
+
+        std::vector<char> m_buffer;
+
+        void unmap();
+    public:
+        MappedFile() : m_data(nullptr), m_size(0), m_mapped(false) {}
+        MappedFile(const MappedFile& other) = delete;
+        MappedFile(MappedFile&& other);
+        MappedFile(const boost::filesystem::path& path);
+        ~MappedFile();
+
+        MappedFile& operator =(const MappedFile& other) = delete;
+        MappedFile& operator =(MappedFile&& other);
+
+        const char* data() const { return this->m_data; }
+        std::size_t size() const { return this->m_size; }
+
+        const char* begin() const { return this->m_data; }
+        const char* end() const { return this->m_data + this->m_size; }
+
+        bool is_mapped() const { return this->m_mapped; }
+
+        /*
+         * Faults the whole mapping (or the given range of it) into memory, so that later reads
+         * (e.g. by the GL driver on the main thread) don't stall on disk. Does nothing if the file
+         * was read into memory.
+         */
+        void prefetch() const { this->prefetch(0, this->m_size); }
+        void prefetch(std::size_t offset, std::size_t size) const;
+    };
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef HW3_MESHOPTIMIZE_HPP
+#define HW3_MESHOPTIMIZE_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include "objmodel.hpp"
+
+namespace hw3 {
+    /*
+     * Simulates a FIFO post-transform vertex cache of the given size over the triangle list and
+     * returns the average number of cache misses per triangle (ACMR). 3.0 is the worst possible
+     * value and 0.5 is the theoretical optimum for large regular meshes.
+     */
+    float calculate_acmr(const unsigned int* indices, size_t num_indices, size_t num_vertices, size_t cache_size = 16);
+
+    /*
+     * Removes triangles that can't produce any fragments: ones that reference the same vertex more
+     * than once and ones whose corners are distinct vertices but have collinear positions. The
+     * triangle list is compacted in place and the new number of indices is returned.
+     */
+    size_t remove_degenerate_triangles(unsigned int* indices, size_t num_indices, const Model3DVertex* vertices);
+
+    /*
+     * Reorders triangles to maximize post-transform vertex cache hits, using Tom Forsyth's linear-
+     * speed vertex cache optimization algorithm.
+     */
+    void optimize_vertex_cache(unsigned int* indices, size_t num_indices, size_t num_vertices);
+
+    /*
+     * Reorders clusters of triangles so that outward-facing clusters tend to be drawn first, which
+     * lets early depth testing reject more of the triangles behind them. The triangle list should
+     * already be optimized for the vertex cache: clusters are split at points where that order has
+     * a cold cache anyway, and also at points where splitting increases the ACMR of the cluster by
+     * no more than the given factor.
+     */
+    void optimize_overdraw(
+        unsigned int* indices,
+        size_t num_indices,
+        const Model3DVertex* vertices,
+        size_t num_vertices,
+        float threshold = 1.05f
+    );
+
+    /*
+     * Reorders the vertex array so that vertices appear in the order in which the index list first
+     * references them, and rewrites the index list to match. Vertices that are no longer referenced
+     * are dropped.
+     */
+    void optimize_vertex_fetch(std::vector<Model3DVertex>& vertices, std::vector<unsigned int>& indices);
+
+    /*
+     * Simplifies a triangle list by repeatedly collapsing the edges with the lowest quadric error
+     * until at most target_index_count indices remain or no collapse stays within target_error.
+     * Vertices on open borders and texture/normal seams only move along the border or seam, and
+     * collapses that would flip a triangle are rejected. Errors are relative to the largest extent
+     * of the mesh, so 0.01 is 1% of its size.
+     *
+     * The simplified triangle list is written to destination, which must have room for num_indices
+     * indices, and the number of indices written is returned. If result_error isn't null, it
+     * receives the largest error of any collapse that was performed.
+     */
+    size_t simplify(
+        unsigned int* destination,
+        const unsigned int* indices,
+        size_t num_indices,
+        const Model3DVertex* vertices,
+        size_t num_vertices,
+        size_t target_index_count,
+        float target_error,
+        float* result_error = nullptr
+    );
+
+    /*
+     * Splits a triangle list into meshlets of at most max_vertices distinct vertices and
+     * max_triangles triangles and appends them to meshlets. Each meshlet is a run of consecutive
+     * triangles, so the triangle order is kept; a list that's optimized for the vertex cache already
+     * keeps each run spatially compact. first_index is the position of the list in the model's index
+     * buffer, which the meshlets' ranges refer to.
+     *
+     * Faces aren't culled when drawing, so back faces are only guaranteed to be hidden if the surface
+     * is closed. Normal cones are therefore disabled for triangle lists that have open edges, and
+     * for meshlets whose winding disagrees with their vertex normals for only some of the faces.
+     */
+    void build_meshlets(
+        std::vector<Meshlet>& meshlets,
+        const unsigned int* indices,
+        size_t first_index,
+        size_t num_indices,
+        const Model3DVertex* vertices,
+        size_t num_vertices,
+        size_t max_vertices = 64,
+        size_t max_triangles = 124
+    );
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef HW3_MIPMAP_HPP
+#define HW3_MIPMAP_HPP
+
+#include <vector>
+
+#include "texture.hpp"
+
+namespace hw3 {
+    enum class MipmapFilter {
+        // Averages the texels each texel of the smaller level covers. Cheap, but slightly blurry.
+        BOX,
+
+        // A Kaiser-windowed sinc filter, which keeps smaller levels noticeably sharper
+        KAISER
+    };
+
+    /*
+     * Builds every mipmap level below the base level of an uncompressed image, returning levels 1
+     * and up, each tightly packed in the image's format. Filtering happens in linear space: the
+     * colour channels of SRGBA images are converted from sRGB first and back again afterwards, and
+     * each level is filtered from the unquantized level above it. Rows are spread over several
+     * threads for large images.
+     */
+    std::vector<std::vector<char>> build_mipmaps(
+        const char* pixels,
+        int width,
+        int height,
+        TextureDataFormat format,
+        MipmapFilter filter
+    );
+}
+
+#endif
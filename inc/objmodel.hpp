@@ -1,12 +1,15 @@
 #ifndef HW3_OBJMODEL_HPP
 #define HW3_OBJMODEL_HPP
 
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <vector>
 
 #include <boost/filesystem.hpp>
 #include <glm/glm.hpp>
 
+#include "mappedfile.hpp"
 #include "shader.hpp"
 #include "texture.hpp"
 #include "vertex.hpp"
@@ -40,57 +43,325 @@ namespace hw3 {
 
     struct Material {
         glm::vec3 ambient;
-        std::shared_ptr<Sampler2D> ambient_occlusion_map;
+        std::shared_ptr<Sampler2DArray> ambient_occlusion_map;
 
         glm::vec3 diffuse;
-        std::shared_ptr<Sampler2D> diffuse_map;
+        std::shared_ptr<Sampler2DArray> diffuse_map;
 
         glm::vec3 specular;
-        std::shared_ptr<Sampler2D> specular_map;
+        std::shared_ptr<Sampler2DArray> specular_map;
 
         float shininess;
+    };
+
+    struct Model3DVertex {
+        glm::vec3 pos;
+        glm::vec2 tex;
+        glm::vec3 norm;
+    };
+
+    /*
+     * The GPU-side vertex layout used by Model3DVertexFormat::PACKED, at half the size of
+     * Model3DVertex. Positions are 16-bit unsigned normalized values relative to the model's
+     * bounding box, which the vertex shader maps back using the model's position offset and scale.
+     * Texture coordinates are half floats and normals are packed into a signed normalized
+     * 2_10_10_10 integer.
+     */
+    struct Model3DPackedVertex {
+        uint16_t pos[3];
+        uint16_t padding;
+        uint16_t tex[2];
+        uint32_t norm;
+    };
+
+    static_assert(sizeof(Model3DPackedVertex) == 16, "Model3DPackedVertex must be tightly packed");
+
+    /*
+     * A short run of consecutive triangles in a model's index list, which is culled as a unit. The
+     * bounding sphere and normal cone are in the model's object space: every triangle faces away
+     * from a camera at p if dot(center - p, cone_axis) >= cone_cutoff * distance(center, p) + radius.
+     * A cone_cutoff of 1 means that the meshlet can never be culled by its normals.
+     */
+    struct Meshlet {
+        glm::vec3 center;
+        float radius;
+
+        glm::vec3 cone_axis;
+        float cone_cutoff;
+
+        uint32_t first_index;
+        uint32_t num_indices;
+    };
+
+    static_assert(sizeof(Meshlet) == 40, "Meshlet must be tightly packed");
+
+    enum class MeshOptimizeLevel {
+        NONE,
+        VERTEX_CACHE,
+        OVERDRAW
+    };
+
+    enum class Model3DVertexFormat {
+        FLOAT,
+        PACKED
+    };
+
+    struct Model3DLoadOptions {
+        MeshOptimizeLevel optimize = MeshOptimizeLevel::VERTEX_CACHE;
+        Model3DVertexFormat vertex_format = Model3DVertexFormat::PACKED;
 
-        Material without_maps() const;
-        Material without_ao() const;
+        // The maximum number of levels of detail to generate, including the full-detail mesh. 1
+        // disables simplification altogether.
+        size_t max_lods = 4;
     };
 
-    template <>
-    struct ShaderProgram::uniform_setter<Material> {
-        void operator ()(ShaderProgram& program, std::string name, const Material& value);
+    struct MeshOptimizeStats {
+        size_t degenerate_triangles;
+        float acmr_before;
+        float acmr_after;
     };
 
+    /*
+     * The cost of deduplicating an OBJ file's face corners with one kind of lookup structure.
+     * heap_bytes is how much the heap grew while doing so, or 0 where that can't be measured.
+     */
+    struct VertexDedupStats {
+        double time_ms;
+        size_t heap_bytes;
+    };
+
+    struct VertexDedupBenchmark {
+        size_t lookups;
+        size_t unique_vertices;
+
+        // The open-addressing table the OBJ loader uses, and the std::map it replaced
+        VertexDedupStats hash_table;
+        VertexDedupStats ordered_map;
+    };
+
+    /*
+     * Parses an OBJ file and times deduplicating its face corners on their own, without building
+     * the vertex array.
+     */
+    VertexDedupBenchmark benchmark_vertex_dedup(const boost::filesystem::path& path);
+
+    /*
+     * CPU-side geometry for a model: a deduplicated vertex array and the index lists of all of its
+     * sub-objects, stored back to back. The arrays are either owned by this object or point
+     * directly into a mapped model cache file, which is then kept open for as long as they are.
+     *
+     * Models may have several levels of detail (LODs), which share the vertex array. The index
+     * lists are stored LOD by LOD, with every LOD containing all of the sub-objects. Each LOD has
+     * an error, which is the largest distance in object space by which its surface may deviate from
+     * the full-detail mesh, and once loaded an average cache miss ratio (ACMR): the number of
+     * vertices per triangle that miss a 16-entry post-transform vertex cache when it's drawn.
+     */
+    class Model3DData {
+        MappedFile m_file;
+        std::vector<Model3DVertex> m_vertex_storage;
+        std::vector<unsigned int> m_index_storage;
+
+        const Model3DVertex* m_vertices = nullptr;
+        size_t m_num_vertices = 0;
+
+        const unsigned int* m_indices = nullptr;
+        size_t m_num_indices = 0;
+
+        std::vector<size_t> m_sub_object_sizes;
+        size_t m_num_sub_objects = 0;
+        std::vector<float> m_lod_errors;
+        std::vector<float> m_lod_acmrs;
+
+        std::vector<Meshlet> m_meshlet_storage;
+        const Meshlet* m_meshlets = nullptr;
+        size_t m_num_meshlets = 0;
+
+        AABB m_bounding_box;
+
+        void build_lods(size_t max_lods);
+        void measure_acmr();
+    public:
+        Model3DData() {}
+        Model3DData(const Model3DData& other) = delete;
+        Model3DData(Model3DData&& other) = default;
+        Model3DData(
+            std::vector<Model3DVertex>&& vertices,
+            std::vector<unsigned int>&& indices,
+            std::vector<size_t>&& sub_object_sizes
+        );
+
+        Model3DData& operator =(const Model3DData& other) = delete;
+        Model3DData& operator =(Model3DData&& other) = default;
+
+        const Model3DVertex* vertices() const { return this->m_vertices; }
+        size_t num_vertices() const { return this->m_num_vertices; }
+
+        const unsigned int* indices() const { return this->m_indices; }
+        size_t num_indices() const { return this->m_num_indices; }
+
+        size_t num_sub_objects() const { return this->m_num_sub_objects; }
+        size_t num_lods() const { return this->m_lod_errors.size(); }
+        float lod_error(size_t lod) const { return this->m_lod_errors[lod]; }
+
+        // 0 for data that didn't come from load()
+        float lod_acmr(size_t lod) const {
+            return lod < this->m_lod_acmrs.size() ? this->m_lod_acmrs[lod] : 0.0f;
+        }
+
+        // The sizes of all index lists, in the order they are stored
+        const std::vector<size_t>& sub_object_sizes() const { return this->m_sub_object_sizes; }
+        size_t sub_object_size(size_t lod, size_t i) const {
+            return this->m_sub_object_sizes[lod * this->m_num_sub_objects + i];
+        }
+
+        // The meshlets of every index list, in the order the lists are stored
+        const Meshlet* meshlets() const { return this->m_meshlets; }
+        size_t num_meshlets() const { return this->m_num_meshlets; }
+
+        const AABB& bounding_box() const { return this->m_bounding_box; }
+
+        static Model3DData load_obj(const boost::filesystem::path& path);
+
+        /*
+         * Loads a model from its cache if possible, or otherwise parses and optimizes the OBJ file
+         * and writes the cache for next time. This doesn't use OpenGL, so it may run on any thread.
+         * If on_bounds is given, it's called with the model's bounding box as soon as that's known,
+         * which for an uncached model is before the (slow) optimization step.
+         */
+        static Model3DData load(
+            const boost::filesystem::path& path,
+            const Model3DLoadOptions& options,
+            const std::function<void (const AABB&)>& on_bounds = nullptr
+        );
+
+        /*
+         * Runs the post-load mesh processing pipeline: removes degenerate triangles, generates
+         * simplified LODs, reorders each index list for the post-transform vertex cache (and
+         * optionally for overdraw), reorders the vertex array for fetch locality and finally splits
+         * every index list into meshlets. This may only be called once, on data that owns its
+         * arrays, i.e. data that didn't come from the model cache.
+         */
+        MeshOptimizeStats optimize(const Model3DLoadOptions& options);
+
+        /*
+         * The model cache is a binary sidecar file stored next to each OBJ file, keyed by the OBJ
+         * file's path, size and modification time and by the load options used to build it.
+         * load_cache returns false if there is no valid cache for the given OBJ file, in which case
+         * the caller should parse it and then call write_cache.
+         */
+        static bool load_cache(
+            const boost::filesystem::path& path,
+            const Model3DLoadOptions& options,
+            Model3DData& data
+        );
+        void write_cache(const boost::filesystem::path& path, const Model3DLoadOptions& options) const;
+    };
+
+    /*
+     * A range of a model's shared index buffer. The indices are stored relative to the lowest vertex
+     * the sub-object uses (base_vertex), which lets most models use 16-bit indices. The range is
+     * covered by the meshlets [first_meshlet, first_meshlet + num_meshlets) of the model.
+     */
     struct ModelSubObject3D {
-        GlBuffer index_buffer;
+        size_t first_index;
         size_t num_indices;
+        int base_vertex;
+
+        size_t first_meshlet;
+        size_t num_meshlets;
+    };
+
+    struct Model3DLod {
+        IndexedDrawList draws;
+        size_t num_triangles;
+        float error;
+        float acmr;
+    };
+
+    struct Model3DDrawStats {
+        size_t meshlets = 0;
+        size_t culled_meshlets = 0;
+        size_t triangles = 0;
     };
 
-    class Model3DLoader;
     class Model3D {
         GlVertexArray m_vertices;
+        IndexType m_index_type = IndexType::UNSIGNED_INT;
+
+        // The sub-objects of every LOD, stored LOD by LOD
         std::vector<ModelSubObject3D> m_sub_objects;
+        size_t m_num_sub_objects = 0;
+
+        std::vector<Model3DLod> m_lods;
+        std::vector<Meshlet> m_meshlets;
         AABB m_bounding_box;
+
+        // Scratch space for draw_culled, kept around to avoid reallocating it every frame
+        mutable IndexedDrawList m_culled_draws;
+
+        glm::vec3 m_position_offset = glm::vec3(0);
+        glm::vec3 m_position_scale = glm::vec3(1);
     public:
         Model3D();
 
-        Model3D& load_geometry(boost::filesystem::path path);
+        Model3D& load_geometry(
+            boost::filesystem::path path,
+            const Model3DLoadOptions& options = Model3DLoadOptions()
+        );
+        Model3D& load_data(
+            const Model3DData& data,
+            Model3DVertexFormat format = Model3DVertexFormat::PACKED
+        );
+
+        // A model is empty until its geometry has been loaded
+        bool ready() const { return !this->m_lods.empty(); }
 
         size_t num_vertices() const { return this->m_vertices.size(); }
+        size_t vertex_data_size() const { return this->m_vertices.buffer(0).size(); }
+        size_t index_data_size() const { return this->m_vertices.buffer(1).size(); }
+        IndexType index_type() const { return this->m_index_type; }
+
+        /*
+         * The vertex shader computes object-space positions as offset + position * scale, which
+         * undoes the quantization of packed vertex positions. For unpacked vertices these are the
+         * identity.
+         */
+        const glm::vec3& position_offset() const { return this->m_position_offset; }
+        const glm::vec3& position_scale() const { return this->m_position_scale; }
 
-        size_t num_sub_objects() const { return this->m_sub_objects.size(); }
-        ModelSubObject3D& sub_object(size_t i) {
-            assert(i < this->m_sub_objects.size());
-            return this->m_sub_objects[i];
+        size_t num_sub_objects() const { return this->m_num_sub_objects; }
+        const ModelSubObject3D& sub_object(size_t i, size_t lod = 0) const {
+            assert(i < this->m_num_sub_objects && lod < this->m_lods.size());
+            return this->m_sub_objects[lod * this->m_num_sub_objects + i];
         }
-        const ModelSubObject3D& sub_object(size_t i) const {
-            assert(i < this->m_sub_objects.size());
-            return this->m_sub_objects[i];
+
+        /*
+         * LOD 0 is the full-detail mesh. Every following LOD has fewer triangles and a larger
+         * error, which is the distance in object space by which it may deviate from LOD 0.
+         */
+        size_t num_lods() const { return this->m_lods.size(); }
+        const Model3DLod& lod(size_t lod) const {
+            assert(lod < this->m_lods.size());
+            return this->m_lods[lod];
         }
 
+        const std::vector<Meshlet>& meshlets() const { return this->m_meshlets; }
+
+        // The bounding box can be set ahead of loading the geometry, to show where the model will be
         const AABB& bounding_box() const { return this->m_bounding_box; }
+        Model3D& bounding_box(const AABB& bounding_box) {
+            this->m_bounding_box = bounding_box;
+            return *this;
+        }
 
-        void draw() const;
+        void draw(size_t lod = 0) const;
 
-        friend class Model3DLoader;
+        /*
+         * Draws the given LOD, skipping the meshlets that are outside of the view frustum or that
+         * face away from the camera. transform maps object space to clip space and camera_pos is the
+         * camera's position in object space. The projection is assumed to have no far plane.
+         */
+        Model3DDrawStats draw_culled(size_t lod, const glm::mat4& transform, const glm::vec3& camera_pos) const;
     };
 }
 
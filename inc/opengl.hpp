@@ -9,25 +9,76 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
+/*
+ * Whether handle_errors checks for GL errors after each call. glGetError can force the driver to
+ * wait for the GPU to catch up, so by default only builds with assertions enabled check; release
+ * builds (with NDEBUG) leave it to check_frame_errors. Either can be overridden by defining these
+ * as 0 or 1 when building.
+ */
+#ifndef HW3_GL_CHECKS
+#ifdef NDEBUG
+#define HW3_GL_CHECKS 0
+#else
+#define HW3_GL_CHECKS 1
+#endif
+#endif
+
+#ifndef HW3_GL_FRAME_CHECKS
+#define HW3_GL_FRAME_CHECKS 1
+#endif
+
+// The file and line that handle_errors was called from
+#if defined(__GNUC__) || defined(__clang__)
+#define HW3_CALLER_FILE __builtin_FILE()
+#define HW3_CALLER_LINE __builtin_LINE()
+#else
+#define HW3_CALLER_FILE "unknown"
+#define HW3_CALLER_LINE 0
+#endif
+
 namespace hw3 {
+    /*
+     * When GL checks are enabled, asks for a debug context and, if the driver supports KHR_debug,
+     * has it report errors synchronously as they're raised, so that the message describing an
+     * error is thrown by the next handle_errors along with where that was called from. Other
+     * warnings from the driver (e.g. about performance) are printed as they come in. Must be
+     * called before and after creating the window's context, respectively.
+     */
+    void request_debug_context();
+    void enable_debug_output();
+
+    // Drops the debug message of an error that has been dealt with
+    void discard_debug_message();
+
+    // Throws an error raised before the given call site, or during the last frame if file is null
+    [[noreturn]] void throw_gl_error(GLenum error, const char* file, int line);
+
     inline void clear_errors() {
+#if HW3_GL_CHECKS
         while (glGetError() != GL_NO_ERROR) {}
+
+        discard_debug_message();
+#endif
     }
 
-    inline void handle_errors() {
+    inline void handle_errors(const char* file = HW3_CALLER_FILE, int line = HW3_CALLER_LINE) {
+#if HW3_GL_CHECKS
         GLenum error = glGetError();
 
         if (error != GL_NO_ERROR) {
-            clear_errors();
-            throw std::runtime_error(([&]() {
-                std::ostringstream ss;
-
-                ss << "Unhandled OpenGL error 0x" << std::hex << error;
-
-                return ss.str();
-            })());
+            throw_gl_error(error, file, line);
         }
+#else
+        (void)file;
+        (void)line;
+#endif
     }
+
+    /*
+     * Throws if anything went wrong during the frame that handle_errors didn't catch. This is the
+     * only glGetError release builds make per frame, and does nothing if HW3_GL_FRAME_CHECKS is 0.
+     */
+    void check_frame_errors();
 }
 
 #endif
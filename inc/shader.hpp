@@ -1,10 +1,13 @@
 #ifndef HW3_SHADER_HPP
 #define HW3_SHADER_HPP
 
+#include <cstddef>
+#include <cstdint>
 #include <initializer_list>
 #include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #define GLFW_INCLUDE_GLCOREARB
@@ -41,22 +44,85 @@ namespace hw3 {
         GLuint id() const { return this->m_id; }
     };
 
+    /*
+     * Identifies a uniform by a 64-bit FNV-1a hash of its name, so that setting a uniform doesn't
+     * need to build its name as a string or ask the driver where it is. Names of struct members and
+     * array elements are hashed by extending the hash of the struct or array's name, which doesn't
+     * allocate. Handles declared constexpr (see shaders::uniforms) are hashed at compile time.
+     */
+    class UniformName {
+        static constexpr uint64_t fnv_offset_basis = 0xcbf29ce484222325;
+        static constexpr uint64_t fnv_prime = 0x100000001b3;
+
+        uint64_t m_hash;
+
+        constexpr explicit UniformName(uint64_t hash) : m_hash(hash) {}
+
+        static constexpr uint64_t extend(uint64_t hash, const char* str, size_t length) {
+            for (size_t i = 0; i < length; i++) {
+                hash = (hash ^ static_cast<uint8_t>(str[i])) * fnv_prime;
+            }
+
+            return hash;
+        }
+    public:
+        template <size_t N>
+        constexpr UniformName(const char (&name)[N]) : m_hash(extend(fnv_offset_basis, name, N - 1)) {}
+        UniformName(const std::string& name) : m_hash(extend(fnv_offset_basis, name.data(), name.size())) {}
+
+        // The name of a member of this struct, e.g. material.member(".diffuse")
+        template <size_t N>
+        constexpr UniformName member(const char (&suffix)[N]) const {
+            return UniformName(extend(this->m_hash, suffix, N - 1));
+        }
+
+        // The name of an element of this array
+        constexpr UniformName operator [](size_t index) const {
+            char digits[20] = {};
+            size_t num_digits = 0;
+
+            do {
+                digits[num_digits++] = static_cast<char>('0' + index % 10);
+                index /= 10;
+            } while (index != 0);
+
+            uint64_t hash = extend(this->m_hash, "[", 1);
+
+            while (num_digits > 0) {
+                hash = extend(hash, &digits[--num_digits], 1);
+            }
+
+            return UniformName(extend(hash, "]", 1));
+        }
+
+        constexpr uint64_t hash() const { return this->m_hash; }
+    };
+
     class Sampler2D;
+    class Sampler2DArray;
     class ShaderProgram {
+        // Only one of the samplers is set, depending on the type of the uniform
         struct TextureBinding {
             GLuint unit;
             const Sampler2D* sampler;
+            const Sampler2DArray* array_sampler;
         };
 
         GLuint m_id;
         std::vector<std::shared_ptr<Shader>> m_shaders;
 
+        // The location of every active uniform, by the hash of each name it can be set by
+        std::unordered_map<uint64_t, GLint> m_uniform_locations;
+
         GLuint m_next_texture;
         std::map<GLint, TextureBinding> m_texture_bindings;
 
         int m_patch_size;
 
         void link();
+        void load_uniform_locations();
+        void add_uniform_location(const std::string& name, GLint location);
+        void set_texture_uniform(UniformName name, const Sampler2D* sampler, const Sampler2DArray* array_sampler);
     public:
         ShaderProgram() : m_id(0), m_patch_size(0) {}
         ShaderProgram(const ShaderProgram& other) = delete;
@@ -69,28 +135,40 @@ namespace hw3 {
         ShaderProgram& operator =(const ShaderProgram& other) = delete;
         ShaderProgram& operator =(ShaderProgram&& other);
 
-        void set_uniform(std::string name, float value);
-        void set_uniform(std::string name, int value);
-        void set_uniform(std::string name, glm::vec2 value);
-        void set_uniform(std::string name, glm::vec3 value);
-        void set_uniform(std::string name, glm::vec4 value);
-        void set_uniform(std::string name, const glm::mat3& value);
-        void set_uniform(std::string name, const glm::mat4& value);
-        void set_uniform(std::string name, Sampler2D* value) { this->set_uniform(name, static_cast<const Sampler2D*>(value)); }
-        void set_uniform(std::string name, const Sampler2D* value);
+        // The location of a uniform, or -1 if the program has no active uniform by that name
+        GLint uniform_location(UniformName name) const {
+            auto it = this->m_uniform_locations.find(name.hash());
+
+            return it != this->m_uniform_locations.end() ? it->second : -1;
+        }
+
+        void set_uniform(UniformName name, float value);
+        void set_uniform(UniformName name, int value);
+        void set_uniform(UniformName name, glm::vec2 value);
+        void set_uniform(UniformName name, glm::vec3 value);
+        void set_uniform(UniformName name, glm::vec4 value);
+        void set_uniform(UniformName name, const glm::mat3& value);
+        void set_uniform(UniformName name, const glm::mat4& value);
+        void set_uniform(UniformName name, Sampler2D* value) { this->set_uniform(name, static_cast<const Sampler2D*>(value)); }
+        void set_uniform(UniformName name, const Sampler2D* value);
+        void set_uniform(UniformName name, Sampler2DArray* value) { this->set_uniform(name, static_cast<const Sampler2DArray*>(value)); }
+        void set_uniform(UniformName name, const Sampler2DArray* value);
 
         template <typename T>
         struct uniform_setter {
-            void operator()(ShaderProgram& program, std::string name, const T& value) const {
+            void operator()(ShaderProgram& program, UniformName name, const T& value) const {
                 static_assert(sizeof(T) == 0, "Unsupported type for uniform_setter");
             }
         };
 
         template <typename T>
-        void set_uniform(std::string name, const T& value) {
+        void set_uniform(UniformName name, const T& value) {
             uniform_setter<T>()(*this, name, value);
         }
 
+        // Points a uniform block at a binding point, if the program has an active block by that name
+        void bind_uniform_block(const char* name, GLuint binding);
+
         int patch_size() const { return this->m_patch_size; }
         void patch_size(int size) { this->m_patch_size = size; }
 
@@ -22,6 +22,98 @@ namespace hw3 {
 
         }
 
+        /*
+         * Handles for the uniforms of the programs below, hashed at compile time. Uniforms of
+         * struct types are set member by member (see ShaderProgram::uniform_setter).
+         */
+        namespace uniforms {
+            constexpr UniformName vertex_transform = "vertex_transform";
+            constexpr UniformName point_half_size = "point_half_size";
+
+            constexpr UniformName fixed_color = "fixed_color";
+            constexpr UniformName color = "color";
+            constexpr UniformName tex = "tex";
+            constexpr UniformName layer = "layer";
+
+            constexpr UniformName ambient_occlusion_map = "ambient_occlusion_map";
+            constexpr UniformName diffuse_map = "diffuse_map";
+            constexpr UniformName specular_map = "specular_map";
+        }
+
+        // The binding points of the uniform blocks below, which are the same in every program
+        namespace blocks {
+            constexpr GLuint frame = 0;
+            constexpr GLuint object = 1;
+            constexpr GLuint materials = 2;
+        }
+
+        constexpr int max_point_lights = 16;
+
+        // 256 materials fill the smallest uniform block the GL has to support
+        constexpr int max_materials = 256;
+
+        /*
+         * The std140 layouts of the uniform blocks, as written into a UniformRing. A vec3 takes up
+         * 16 bytes unless a scalar follows it, each column of a mat3 is padded out to a vec4 and
+         * structs are padded out to a multiple of 16 bytes.
+         */
+        struct PointLightBlock {
+            glm::vec3 pos;
+            float pad0;
+
+            glm::vec3 ambient;
+            float pad1;
+            glm::vec3 diffuse;
+            float pad2;
+            glm::vec3 specular;
+
+            float a0;
+            float a1;
+            float a2;
+            float pad3[2];
+        };
+
+        struct FrameBlock {
+            glm::vec3 camera_position;
+            int use_maps;
+            glm::vec3 scene_ambient;
+            int use_ambient_occlusion;
+
+            int num_point_lights;
+            int pad0[3];
+            PointLightBlock point_lights[max_point_lights];
+        };
+
+        struct ObjectBlock {
+            glm::mat4 vertex_transform;
+            glm::mat4 vertex_world_transform;
+            glm::vec4 normal_transform[3];
+
+            glm::vec3 position_offset;
+            int material_index;
+            glm::vec3 position_scale;
+            float pad0;
+        };
+
+        struct MaterialBlock {
+            glm::vec3 ambient;
+            int ambient_occlusion_layer;
+
+            glm::vec3 diffuse;
+            int diffuse_layer;
+
+            glm::vec3 specular;
+            int specular_layer;
+
+            float shininess;
+            float pad0[3];
+        };
+
+        static_assert(sizeof(PointLightBlock) == 80, "PointLightBlock doesn't match std140");
+        static_assert(sizeof(FrameBlock) == 48 + 80 * max_point_lights, "FrameBlock doesn't match std140");
+        static_assert(sizeof(ObjectBlock) == 208, "ObjectBlock doesn't match std140");
+        static_assert(sizeof(MaterialBlock) == 64, "MaterialBlock doesn't match std140");
+
         extern ShaderProgram fixed_program;
         extern ShaderProgram font_program;
         extern ShaderProgram normal_program;
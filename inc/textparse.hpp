@@ -0,0 +1,85 @@
+#ifndef HW3_TEXTPARSE_HPP
+#define HW3_TEXTPARSE_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace hw3 {
+    /*
+     * A view into a text buffer. Tokens never own their data, so they are only valid for as long as
+     * the buffer they were split from.
+     */
+    struct TextToken {
+        const char* begin;
+        const char* end;
+
+        size_t size() const { return static_cast<size_t>(this->end - this->begin); }
+        bool empty() const { return this->begin == this->end; }
+
+        bool operator ==(const char* str) const;
+        bool operator !=(const char* str) const { return !(*this == str); }
+
+        std::string str() const { return std::string(this->begin, this->end); }
+    };
+
+    /*
+     * Walks a text buffer one line at a time. The returned lines do not include the line
+     * terminator.
+     */
+    class LineReader {
+        const char* m_pos;
+        const char* m_end;
+    public:
+        LineReader() : m_pos(nullptr), m_end(nullptr) {}
+        LineReader(const char* begin, const char* end) : m_pos(begin), m_end(end) {}
+
+        bool next(TextToken& line) {
+            if (this->m_pos == this->m_end) {
+                return false;
+            }
+
+            const char* eol = static_cast<const char*>(
+                std::memchr(this->m_pos, '\n', this->m_end - this->m_pos)
+            );
+
+            line.begin = this->m_pos;
+
+            if (eol == nullptr) {
+                line.end = this->m_end;
+                this->m_pos = this->m_end;
+            } else {
+                line.end = eol;
+                this->m_pos = eol + 1;
+            }
+
+            return true;
+        }
+    };
+
+    inline bool is_text_space(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    /*
+     * Splits the given range on whitespace, storing up to max_tokens tokens in the provided array.
+     * The return value is the total number of tokens in the range, which may be larger than
+     * max_tokens; this allows callers to check argument counts without allocating.
+     */
+    size_t split_tokens(const char* begin, const char* end, TextToken* tokens, size_t max_tokens);
+    void split_tokens(const char* begin, const char* end, std::vector<std::string>& tokens);
+
+    /*
+     * Locale-independent number parsing. These functions require the entire token to be consumed
+     * and throw std::invalid_argument or std::out_of_range on failure, matching the behaviour of
+     * std::stof and std::stoi.
+     */
+    float parse_float(const char* begin, const char* end);
+    int parse_int(const char* begin, const char* end);
+
+    inline float parse_float(const TextToken& token) { return parse_float(token.begin, token.end); }
+    inline int parse_int(const TextToken& token) { return parse_int(token.begin, token.end); }
+}
+
+#endif
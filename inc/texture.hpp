@@ -1,16 +1,26 @@
 #ifndef HW3_TEXTURE_HPP
 #define HW3_TEXTURE_HPP
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <functional>
+#include <map>
 #include <memory>
 #include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
 
 #define GLFW_INCLUDE_GLCOREARB
 #define GL_GLEXT_PROTOTYPES
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
+#include "mappedfile.hpp"
+
 namespace hw3 {
     enum class TextureSampleMode : GLint {
         NEAREST = GL_NEAREST,
@@ -32,16 +42,299 @@ namespace hw3 {
     enum class TextureDataFormat {
         GRAYSCALE,
         RGBA,
-        SRGBA
+        SRGBA,
+
+        // Block-compressed formats, which store each 4x4 block of texels in 8 or 16 bytes
+        BC1,
+        BC1_SRGB,
+        BC3,
+        BC3_SRGB,
+        BC4,
+        BC7,
+        BC7_SRGB
+    };
+
+    enum class MipmapFilter;
+
+    enum class TextureCompression {
+        NONE,
+
+        // Colour maps use BC1, or BC3 if they have an alpha channel. 8:1 (4:1 with alpha).
+        BC1,
+
+        // Colour maps use BC7, which is slower to encode but has much better quality. 4:1.
+        BC7
+    };
+
+    inline bool texture_format_compressed(TextureDataFormat format) {
+        switch (format) {
+        case TextureDataFormat::GRAYSCALE:
+        case TextureDataFormat::RGBA:
+        case TextureDataFormat::SRGBA:
+            return false;
+        default:
+            return true;
+        }
+    }
+
+    inline size_t texture_pixel_size(TextureDataFormat format) {
+        switch (format) {
+        case TextureDataFormat::GRAYSCALE:
+            return 1;
+        case TextureDataFormat::RGBA:
+        case TextureDataFormat::SRGBA:
+        default:
+            return 4;
+        }
+    }
+
+    // The number of bytes used by each 4x4 block of a compressed format
+    inline size_t texture_block_size(TextureDataFormat format) {
+        switch (format) {
+        case TextureDataFormat::BC1:
+        case TextureDataFormat::BC1_SRGB:
+        case TextureDataFormat::BC4:
+            return 8;
+        default:
+            return 16;
+        }
+    }
+
+    // The number of bytes taken up by a single mipmap level of the given size
+    inline size_t texture_data_size(TextureDataFormat format, int width, int height) {
+        if (texture_format_compressed(format)) {
+            return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * texture_block_size(format);
+        } else {
+            return static_cast<size_t>(width) * height * texture_pixel_size(format);
+        }
+    }
+
+    // The format that a compressed format decodes to, e.g. SRGBA for BC7_SRGB
+    inline TextureDataFormat texture_decoded_format(TextureDataFormat format) {
+        switch (format) {
+        case TextureDataFormat::BC1:
+        case TextureDataFormat::BC3:
+        case TextureDataFormat::BC7:
+            return TextureDataFormat::RGBA;
+        case TextureDataFormat::BC1_SRGB:
+        case TextureDataFormat::BC3_SRGB:
+        case TextureDataFormat::BC7_SRGB:
+            return TextureDataFormat::SRGBA;
+        case TextureDataFormat::BC4:
+            return TextureDataFormat::GRAYSCALE;
+        default:
+            return format;
+        }
+    }
+
+    /*
+     * The format that images in the given format should be stored in with the given compression.
+     * Grayscale images are compressed with BC4 regardless of which colour compression is chosen.
+     */
+    inline TextureDataFormat texture_compressed_format(TextureDataFormat format, TextureCompression compression) {
+        if (compression == TextureCompression::NONE || texture_format_compressed(format)) {
+            return format;
+        }
+
+        bool bc7 = compression == TextureCompression::BC7;
+
+        switch (format) {
+        case TextureDataFormat::GRAYSCALE:
+            return TextureDataFormat::BC4;
+        case TextureDataFormat::RGBA:
+            return bc7 ? TextureDataFormat::BC7 : TextureDataFormat::BC1;
+        case TextureDataFormat::SRGBA:
+        default:
+            return bc7 ? TextureDataFormat::BC7_SRGB : TextureDataFormat::BC1_SRGB;
+        }
+    }
+
+    // The number of levels in a full mipmap chain, down to 1x1
+    inline int texture_mipmap_levels(int width, int height) {
+        int levels = 1;
+
+        while (width > 1 || height > 1) {
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+            levels++;
+        }
+
+        return levels;
+    }
+
+    struct TextureLevel {
+        size_t offset;
+        size_t size;
+
+        int width;
+        int height;
+    };
+
+    // Lays out the first num_levels mipmap levels of a texture back to back, 8-byte aligned
+    std::vector<TextureLevel> texture_levels(TextureDataFormat format, int width, int height, int num_levels);
+
+    /*
+     * A decoded image in the layout expected by Texture2D::load_data. Decoding doesn't touch
+     * OpenGL, so unlike textures, images can be loaded on any thread.
+     *
+     * Images carry their whole mipmap chain (unless they come from a DDS or KTX file without
+     * one), so textures don't need to generate mipmaps after they've been loaded. The data either
+     * belongs to the image or points directly into a mapped file, which is then kept open for as
+     * long as the image is.
+     */
+    class TextureImage {
+        struct Deleter {
+            void operator ()(char* data) const;
+        };
+
+        const char* m_data = nullptr;
+        std::unique_ptr<char, Deleter> m_pixels;
+        std::vector<char> m_buffer;
+        MappedFile m_file;
+
+        TextureDataFormat m_format = TextureDataFormat::RGBA;
+        std::vector<TextureLevel> m_levels;
+
+        static bool load_container(const boost::filesystem::path& path, TextureDataFormat data_format, TextureImage& image);
+        static bool load_cache(
+            const boost::filesystem::path& path,
+            TextureDataFormat data_format,
+            MipmapFilter mipmap_filter,
+            TextureImage& image
+        );
+        void write_cache(
+            const boost::filesystem::path& path,
+            TextureDataFormat data_format,
+            MipmapFilter mipmap_filter
+        ) const;
+    public:
+        const char* data() const { return this->m_data; }
+        TextureDataFormat format() const { return this->m_format; }
+        const std::vector<TextureLevel>& levels() const { return this->m_levels; }
+
+        int width() const { return this->m_levels.empty() ? 0 : this->m_levels[0].width; }
+        int height() const { return this->m_levels.empty() ? 0 : this->m_levels[0].height; }
+        size_t size() const {
+            return this->m_levels.empty() ? 0 : this->m_levels.back().offset + this->m_levels.back().size;
+        }
+
+        // The data of the given level, which is followed by all of the smaller levels
+        const char* level_data(int level) const { return this->m_data + this->m_levels[level].offset; }
+
+        // The size of the data of the levels from first_level up to (but not including) end_level
+        size_t levels_size(int first_level, int end_level) const {
+            return this->m_levels[end_level - 1].offset + this->m_levels[end_level - 1].size
+                - this->m_levels[first_level].offset;
+        }
+
+        // Whether the data points into a memory-mapped texture cache, DDS or KTX file
+        bool mapped() const { return this->m_file.is_mapped(); }
+
+        // Faults in the levels from first_level down to the smallest one, see MappedFile::prefetch
+        void prefetch(int first_level = 0) const {
+            if (this->mapped()) {
+                this->m_file.prefetch(
+                    static_cast<size_t>(this->level_data(first_level) - this->m_file.data()),
+                    this->levels_size(first_level, static_cast<int>(this->m_levels.size()))
+                );
+            }
+        }
+
+        /*
+         * Loads an image in the given format. DDS and KTX files are loaded as they are, as long as
+         * they're block-compressed; for colour maps, a DDS file without colour space information is
+         * assumed to be in the colour space of data_format. Other images are decoded, their full
+         * mipmap chain is built on the CPU with the given filter (see build_mipmaps) and, if
+         * data_format is compressed, every level is compressed. Images with an alpha channel are
+         * compressed with BC3 rather than BC1.
+         *
+         * The finished mipmap chain is cached in a file next to the source image with the extension
+         * .hw3tex added, in exactly the layout that's uploaded to OpenGL, so later loads just map
+         * it. The cache is rebuilt whenever the source image's size or modification time, the
+         * requested format or the mipmap filter changes. Once it has been written, the returned
+         * image maps it as well, so that images kept around for streaming (see TextureStreamer)
+         * don't hold on to a copy of their data.
+         */
+        static TextureImage load_from_file(
+            const std::string& path,
+            TextureDataFormat data_format,
+            MipmapFilter mipmap_filter
+        );
+    };
+
+    /*
+     * A pixel buffer object that stages some of the levels of one or more same-sized images on
+     * their way into a texture array. The buffer is mapped as soon as it's created, so the images
+     * can be copied into it from any thread. finish then unmaps it, after which
+     * Texture2DArray::load_levels can have the driver copy it into the array asynchronously instead
+     * of stalling on a copy from client memory. Everything other than copy_layer must happen on the
+     * main thread.
+     */
+    class TextureUpload {
+        GLuint m_id = 0;
+        char* m_data = nullptr;
+        TextureDataFormat m_format;
+        std::vector<TextureLevel> m_levels;
+
+        int m_first_level;
+        int m_end_level;
+        int m_layers;
+
+        // Where each level starts in the buffer, with all of its layers back to back, followed by
+        // the size of the whole buffer
+        std::vector<size_t> m_offsets;
+    public:
+        /*
+         * Creates a buffer with room for the levels from first_level up to (but not including)
+         * end_level of the given number of images laid out like the given one.
+         */
+        TextureUpload(const TextureImage& image, int first_level, int end_level, int layers = 1);
+        TextureUpload(const TextureUpload& other) = delete;
+        ~TextureUpload();
+
+        TextureUpload& operator =(const TextureUpload& other) = delete;
+
+        char* data() const { return this->m_data; }
+        TextureDataFormat format() const { return this->m_format; }
+
+        // The layout of each image, including the levels that aren't in the buffer
+        const std::vector<TextureLevel>& levels() const { return this->m_levels; }
+        int first_level() const { return this->m_first_level; }
+        int end_level() const { return this->m_end_level; }
+        int layers() const { return this->m_layers; }
+
+        int width() const { return this->m_levels[0].width; }
+        int height() const { return this->m_levels[0].height; }
+        size_t size() const { return this->m_offsets.back(); }
+
+        // Where the given level starts in the buffer
+        size_t offset(int level) const { return this->m_offsets[level - this->m_first_level]; }
+
+        // Copies the levels held by the buffer from an image into the given layer
+        void copy_layer(int layer, const TextureImage& image) const;
+
+        GLuint id() const { return this->m_id; }
+        bool mapped() const { return this->m_data != nullptr; }
+
+        /*
+         * Unmaps the buffer. Returns false if the driver lost its contents while it was mapped (e.g.
+         * due to a display mode change), in which case the images must be uploaded some other way.
+         */
+        bool finish();
     };
 
     class Texture2D {
         GLuint m_id;
+        TextureDataFormat m_format;
 
         int m_width;
         int m_height;
+        int m_levels;
+
+        void tex_image(int level, const void* pixels, TextureDataFormat format, int width, int height);
+        void tex_levels(const char* data, TextureDataFormat format, const std::vector<TextureLevel>& levels);
     public:
-        Texture2D() : m_id(0) {}
+        Texture2D() : m_id(0), m_format(TextureDataFormat::RGBA), m_width(0), m_height(0), m_levels(0) {}
         Texture2D(const Texture2D& other) = delete;
         Texture2D(Texture2D&& other);
         Texture2D(TextureDataFormat format, int width, int height);
@@ -51,12 +344,24 @@ namespace hw3 {
         Texture2D& operator =(Texture2D&& other);
 
         Texture2D& load_data(const char* data, TextureDataFormat format, int width, int height);
+        Texture2D& load_data(const TextureImage& image);
         Texture2D& load_subimage_data(const char* data, TextureDataFormat format, int x, int y, int width, int height);
+
+        /*
+         * Has OpenGL generate the mipmaps of a texture that was loaded without them, e.g. one built
+         * up with load_subimage_data. Textures loaded from images already have all of theirs.
+         */
         Texture2D& generate_mipmap();
 
         glm::ivec2 size() const { return glm::ivec2(this->m_width, this->m_height); }
         float aspect_ratio() const { return (float)this->m_width / (float)this->m_height; }
 
+        TextureDataFormat format() const { return this->m_format; }
+        int levels() const { return this->m_levels; }
+
+        // The GPU memory used by the texture, including all of its mipmap levels
+        size_t data_size() const;
+
         operator bool() const { return this->m_id != 0; }
         GLuint id() const { return this->m_id; }
 
@@ -64,6 +369,155 @@ namespace hw3 {
         static std::shared_ptr<Texture2D> single_pixel();
     };
 
+    /*
+     * An array of same-sized 2D textures, which shaders pick from by layer, so that drawing with
+     * different images in the same array doesn't mean binding different textures.
+     *
+     * Arrays may only have some of their mipmap levels resident. The levels from base_level down to
+     * the smallest one are always there in every layer, and the array samples as if that level were
+     * its full size. Larger levels can be added with load_levels and dropped again with
+     * evict_levels (see TextureStreamer), one or more at a time.
+     */
+    class Texture2DArray {
+        GLuint m_id;
+        TextureDataFormat m_format;
+
+        int m_width;
+        int m_height;
+        int m_levels;
+        int m_layers;
+        int m_base_level;
+
+        // Defines the given level in every layer, from data with the layers back to back or with
+        // undefined contents if pixels is null
+        void tex_image(int level, const void* pixels);
+        void tex_subimage(int level, int layer, const void* pixels);
+        void set_base_level(int base_level);
+
+        // Replaces the array with an empty one with the levels from base_level down
+        void allocate(TextureDataFormat format, int width, int height, int levels, int layers, int base_level);
+    public:
+        Texture2DArray()
+            : m_id(0), m_format(TextureDataFormat::RGBA), m_width(0), m_height(0), m_levels(0), m_layers(0),
+              m_base_level(0) {}
+        Texture2DArray(const Texture2DArray& other) = delete;
+        Texture2DArray(Texture2DArray&& other);
+        ~Texture2DArray();
+
+        Texture2DArray& operator =(const Texture2DArray& other) = delete;
+        Texture2DArray& operator =(Texture2DArray&& other);
+
+        /*
+         * Replaces the array with the levels from base_level down of the given images, one per
+         * layer, which must all have the same format, size and number of levels.
+         */
+        Texture2DArray& load_data(const std::vector<std::shared_ptr<const TextureImage>>& images, int base_level = 0);
+
+        /*
+         * Makes the levels from base_level up to the current base level resident, from the images
+         * the array was loaded from or from an upload of them that ends at the current base level.
+         */
+        Texture2DArray& load_levels(const std::vector<std::shared_ptr<const TextureImage>>& images, int base_level);
+        Texture2DArray& load_levels(const TextureUpload& upload);
+
+        // Frees the levels larger than base_level, which becomes the array's new base level
+        Texture2DArray& evict_levels(int base_level);
+
+        glm::ivec2 size() const { return glm::ivec2(this->m_width, this->m_height); }
+
+        TextureDataFormat format() const { return this->m_format; }
+        int levels() const { return this->m_levels; }
+        int layers() const { return this->m_layers; }
+        int base_level() const { return this->m_base_level; }
+
+        // The GPU memory used by the array, including all of its resident mipmap levels
+        size_t data_size() const;
+
+        // The GPU memory used by the given mipmap level in all layers, whether or not it's resident
+        size_t level_size(int level) const {
+            return texture_data_size(
+                this->m_format,
+                std::max(this->m_width >> level, 1),
+                std::max(this->m_height >> level, 1)
+            ) * this->m_layers;
+        }
+
+        operator bool() const { return this->m_id != 0; }
+        GLuint id() const { return this->m_id; }
+
+        // The most layers an array can have
+        static int max_layers();
+
+        static std::shared_ptr<Texture2DArray> single_pixel();
+    };
+
+    /*
+     * Where an image ended up: a layer of a texture array. Everything that uses the same image
+     * shares its TextureLayer, so that the image can be moved to a layer of another array (see
+     * SceneLoader's texture packing) without any of them noticing. The texture is null until the
+     * image has been loaded.
+     */
+    struct TextureLayer {
+        std::shared_ptr<Texture2DArray> texture;
+        int layer = 0;
+    };
+
+    /*
+     * How a texture is filtered and wrapped when it's sampled. The defaults filter trilinearly,
+     * blending between the two mipmap levels nearest to the texture's size on screen, which keeps
+     * minified textures from aliasing and reads far fewer texels than sampling the full-size level.
+     */
+    struct SamplerState {
+        TextureSampleMode upsample = TextureSampleMode::LINEAR;
+        TextureSampleMode downsample = TextureSampleMode::LINEAR_MIPMAP_LINEAR;
+
+        TextureWrapMode wrap_x = TextureWrapMode::REPEAT;
+        TextureWrapMode wrap_y = TextureWrapMode::REPEAT;
+
+        // The most samples taken along the direction a texture is squashed in on screen, which
+        // keeps surfaces seen at grazing angles sharp. 1 disables anisotropic filtering.
+        float anisotropy = 1;
+
+        bool operator <(const SamplerState& other) const {
+            return std::tie(this->upsample, this->downsample, this->wrap_x, this->wrap_y, this->anisotropy)
+                < std::tie(other.upsample, other.downsample, other.wrap_x, other.wrap_y, other.anisotropy);
+        }
+    };
+
+    // A sampler object whose state is fixed when it's created, so that it can be shared
+    class Sampler {
+        GLuint m_id;
+        SamplerState m_state;
+    public:
+        Sampler() : m_id(0) {}
+        Sampler(const Sampler& other) = delete;
+        Sampler(Sampler&& other);
+        explicit Sampler(const SamplerState& state);
+        ~Sampler();
+
+        Sampler& operator =(const Sampler& other) = delete;
+        Sampler& operator =(Sampler&& other);
+
+        // The state the sampler was created with, with its anisotropy limited to what the driver
+        // supports
+        const SamplerState& state() const { return this->m_state; }
+
+        operator bool() const { return this->m_id != 0; }
+        GLuint id() const { return this->m_id; }
+
+        // The most anisotropy the driver supports, which is 1 if it can't filter anisotropically
+        static float max_anisotropy();
+    };
+
+    // Shares one sampler object between everything that samples textures the same way
+    class SamplerCache {
+        std::map<SamplerState, std::shared_ptr<const Sampler>> m_samplers;
+    public:
+        std::shared_ptr<const Sampler> get(SamplerState state);
+
+        size_t size() const { return this->m_samplers.size(); }
+    };
+
     class Sampler2D {
         GLuint m_id;
         std::shared_ptr<Texture2D> m_texture;
@@ -90,6 +544,71 @@ namespace hw3 {
 
         static std::shared_ptr<Sampler2D> single_pixel();
     };
+
+    // Samples a layer of a texture array. Shaders have to be told which layer that is.
+    class Sampler2DArray {
+        std::shared_ptr<TextureLayer> m_layer;
+        std::shared_ptr<const Sampler> m_sampler;
+    public:
+        Sampler2DArray() {}
+        Sampler2DArray(std::shared_ptr<TextureLayer> layer, std::shared_ptr<const Sampler> sampler)
+            : m_layer(std::move(layer)), m_sampler(std::move(sampler)) {}
+
+        void bind(GLuint unit) const;
+
+        // The array the layer is currently in, which is null until its image has been loaded
+        std::shared_ptr<Texture2DArray> texture() const { return this->m_layer->texture; }
+        int layer() const { return this->m_layer->texture ? this->m_layer->layer : 0; }
+
+        const std::shared_ptr<const Sampler>& sampler() const { return this->m_sampler; }
+
+        operator bool() const { return this->m_sampler && *this->m_sampler; }
+        GLuint id() const { return this->m_sampler->id(); }
+
+        static std::shared_ptr<Sampler2DArray> single_pixel();
+    };
+
+    struct TextureCacheStats {
+        size_t hits = 0;
+        size_t misses = 0;
+
+        // The number of texture arrays the loaded images are in
+        size_t arrays = 0;
+
+        // The GPU memory used by the resident mipmap levels of those arrays
+        size_t bytes = 0;
+
+        // The GPU memory the same levels would use without compression
+        size_t uncompressed_bytes = 0;
+    };
+
+    /*
+     * Shares images between everything that uses the same image file in the same format (and with
+     * the same mipmap filter). Files are identified by their canonical path, so different relative
+     * paths to the same file hit the same entry. Layers are created empty and are expected to be
+     * filled in once their images have been loaded; until then, samplers draw them as a single
+     * white pixel.
+     */
+    class TextureCache {
+        std::map<std::tuple<std::string, TextureDataFormat, MipmapFilter>, std::shared_ptr<TextureLayer>> m_layers;
+
+        size_t m_hits = 0;
+        size_t m_misses = 0;
+    public:
+        /*
+         * Returns the layer for the given image file and format. On a miss, a new empty layer is
+         * added to the cache and load is called with it and the canonical path of the file, and is
+         * responsible for (eventually) loading the image into it.
+         */
+        std::shared_ptr<TextureLayer> get(
+            const boost::filesystem::path& path,
+            TextureDataFormat format,
+            MipmapFilter mipmap_filter,
+            const std::function<void (const std::shared_ptr<TextureLayer>&, const std::string&)>& load
+        );
+
+        TextureCacheStats stats() const;
+    };
 }
 
 #endif
@@ -0,0 +1,41 @@
+#ifndef HW3_TEXTURECOMPRESS_HPP
+#define HW3_TEXTURECOMPRESS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "texture.hpp"
+
+namespace hw3 {
+    /*
+     * Encoders for single 4x4 blocks. Texels are given in row-major order, as 8-bit RGBA for the
+     * colour formats and 8-bit single-channel values for BC4. The colour space doesn't matter to the
+     * encoders, which fit endpoints to the stored values.
+     *
+     * BC7 blocks are always encoded in mode 6 (a single pair of RGBA endpoints with 16 levels in
+     * between), which handles typical colour maps well and is much cheaper to search than the
+     * partitioned modes.
+     */
+    void compress_bc1_block(const uint8_t* rgba, uint8_t* out);
+    void compress_bc3_block(const uint8_t* rgba, uint8_t* out);
+    void compress_bc4_block(const uint8_t* values, uint8_t* out);
+    void compress_bc7_block(const uint8_t* rgba, uint8_t* out);
+
+    /*
+     * Compresses a whole image in the decoded format of dst_format (see texture_decoded_format)
+     * into dst_format. out must have room for texture_data_size(dst_format, width, height) bytes.
+     * Rows of blocks are spread over several threads for large images.
+     */
+    void compress_texture(
+        const char* pixels,
+        int width,
+        int height,
+        TextureDataFormat dst_format,
+        char* out
+    );
+
+    // Whether any texel of an RGBA image is less than fully opaque
+    bool texture_has_alpha(const char* pixels, int width, int height);
+}
+
+#endif
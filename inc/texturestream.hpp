@@ -0,0 +1,127 @@
+#ifndef HW3_TEXTURESTREAM_HPP
+#define HW3_TEXTURESTREAM_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "assetloader.hpp"
+#include "texture.hpp"
+
+namespace hw3 {
+    struct TextureStreamingStats {
+        size_t textures = 0;
+
+        // The GPU memory used by the resident levels of the streamed textures, and the budget for it
+        size_t bytes = 0;
+        size_t budget = 0;
+
+        // The number of levels made resident and evicted again since the scene was loaded
+        size_t streamed_levels = 0;
+        size_t evicted_levels = 0;
+    };
+
+    /*
+     * Keeps only the mipmap levels of texture arrays that are actually needed resident. Arrays start
+     * out with just their small levels (see first_resident_level), which are never evicted. Every
+     * frame, whatever draws the arrays requests the level it needs at the size it's drawn on
+     * screen, and update then streams in the missing levels one at a time: each level of every
+     * layer is copied into a pixel buffer on a background thread and uploaded from there on the
+     * main thread. Since all of an array's layers share the same levels, drawing any of them close
+     * up streams in the level for all of them.
+     *
+     * Levels that aren't needed anymore stay resident until the memory used by streamed textures
+     * would go over the budget, at which point the levels of the textures that were least recently
+     * needed are evicted first. Textures that need more than the budget can hold stay blurrier.
+     */
+    class TextureStreamer {
+        struct Entry {
+            std::weak_ptr<Texture2DArray> texture;
+
+            // The image in each layer
+            std::vector<std::shared_ptr<const TextureImage>> images;
+
+            // The levels from here down are always resident
+            int first_resident_level;
+
+            // The largest level requested since the last update
+            int requested_level;
+
+            // The last update after which the texture was requested
+            uint64_t last_requested = 0;
+
+            bool pending = false;
+        };
+
+        std::unordered_map<const Texture2DArray*, Entry> m_entries;
+
+        size_t m_budget = static_cast<size_t>(256) * 1024 * 1024;
+        size_t m_pending_bytes = 0;
+        uint64_t m_updates = 0;
+
+        size_t m_streamed_levels = 0;
+        size_t m_evicted_levels = 0;
+
+        // Declared last so that it's destroyed first, since its jobs refer back to the streamer
+        std::unique_ptr<AssetLoader> m_loader;
+
+        bool make_room(size_t size, size_t& resident_bytes);
+        void stream_in(Entry& entry, const std::shared_ptr<Texture2DArray>& texture);
+        void finish_stream_in(
+            const std::weak_ptr<Texture2DArray>& weak_texture,
+            const std::vector<std::shared_ptr<const TextureImage>>& images,
+            TextureUpload& upload
+        );
+    public:
+        // Levels no larger than this in either dimension are always resident, so images that small
+        // aren't streamed at all
+        static constexpr int resident_size = 128;
+
+        // Levels streamed in at once, which bounds the memory used by their pixel buffers
+        static constexpr size_t max_pending = 2;
+
+        TextureStreamer() {}
+        TextureStreamer(const TextureStreamer& other) = delete;
+
+        TextureStreamer& operator =(const TextureStreamer& other) = delete;
+
+        size_t budget() const { return this->m_budget; }
+        TextureStreamer& budget(size_t budget) {
+            this->m_budget = budget;
+            return *this;
+        }
+
+        // The largest level of an image that's no larger than resident_size
+        static int first_resident_level(const TextureImage& image);
+
+        /*
+         * Starts streaming an array that has been loaded from first_resident_level of its images
+         * down. The images are kept until the array is destroyed, to stream the rest of its levels
+         * from.
+         */
+        void add(const std::shared_ptr<Texture2DArray>& texture, std::vector<std::shared_ptr<const TextureImage>> images);
+
+        /*
+         * Asks for enough levels of an array to draw it across the given number of pixels. Does
+         * nothing for arrays that aren't being streamed.
+         */
+        void request(const Texture2DArray& texture, float screen_size);
+
+        /*
+         * Uploads levels that have been streamed in for at most about the given time, evicts levels
+         * to stay within the budget and starts streaming in levels that were requested since the
+         * last update. Must be called on the main thread. Returns the number of levels uploaded.
+         */
+        size_t update(std::chrono::steady_clock::duration budget);
+
+        // Stops streaming and forgets about all arrays
+        void clear();
+
+        TextureStreamingStats stats() const;
+    };
+}
+
+#endif
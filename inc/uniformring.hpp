@@ -0,0 +1,81 @@
+#ifndef HW3_UNIFORMRING_HPP
+#define HW3_UNIFORMRING_HPP
+
+#include <cstddef>
+
+#define GLFW_INCLUDE_GLCOREARB
+#define GL_GLEXT_PROTOTYPES
+#include <GLFW/glfw3.h>
+
+namespace hw3 {
+    /*
+     * A uniform buffer that uniform blocks are written into as they're drawn, split into one region
+     * per frame in flight. Each frame writes into the next region after waiting on the fence set
+     * when that region was last used, so the CPU can be up to frames - 1 frames ahead of the GPU
+     * without ever overwriting data that's still being read.
+     *
+     * Where ARB_buffer_storage is available the buffer is persistently mapped and writing a block
+     * is just a copy. Otherwise each block is uploaded with glBufferSubData into the fenced region,
+     * which still saves the individual glProgramUniform* calls.
+     */
+    class UniformRing {
+    public:
+        static constexpr int frames = 3;
+    private:
+        GLuint m_id = 0;
+        char* m_data = nullptr;
+
+        // The size of each region, which is a multiple of offset_alignment
+        size_t m_region_size = 0;
+
+        // The region being written this frame and the offset of the next block in it
+        int m_region = 0;
+        size_t m_offset = 0;
+        bool m_in_frame = false;
+
+        GLsync m_fences[frames] = {};
+
+        void allocate(size_t region_size);
+        void release();
+    public:
+        UniformRing() {}
+        UniformRing(const UniformRing& other) = delete;
+
+        ~UniformRing();
+
+        UniformRing& operator =(const UniformRing& other) = delete;
+
+        // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, which every block starts on
+        static size_t offset_alignment();
+
+        // The space a block of the given size takes up in a region, for sizing begin_frame
+        static size_t block_size(size_t size) {
+            size_t alignment = UniformRing::offset_alignment();
+
+            return (size + alignment - 1) / alignment * alignment;
+        }
+
+        /*
+         * Starts writing the next region, which must have room for at least the given number of
+         * bytes (see block_size). The buffer is reallocated if it's too small, so scenes can grow.
+         * Waits for the GPU if it's still reading the region from frames frames ago.
+         */
+        void begin_frame(size_t size);
+
+        // Fences the region written this frame. Must be called after the frame's last draw.
+        void end_frame();
+
+        // Writes a block into this frame's region and binds it to a uniform block binding point
+        void bind(GLuint binding, const void* data, size_t size);
+
+        template <typename T>
+        void bind(GLuint binding, const T& block) {
+            this->bind(binding, &block, sizeof(T));
+        }
+
+        bool persistent() const { return this->m_data != nullptr; }
+        size_t region_size() const { return this->m_region_size; }
+    };
+}
+
+#endif
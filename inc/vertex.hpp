@@ -2,7 +2,9 @@
 #define HW3_VERTEX_HPP
 
 #include <array>
+#include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <functional>
 #include <stdexcept>
 #include <vector>
@@ -26,9 +28,56 @@ namespace hw3 {
     };
 
     enum class DataType {
-        FLOAT = GL_FLOAT
+        BYTE = GL_BYTE,
+        UNSIGNED_BYTE = GL_UNSIGNED_BYTE,
+        SHORT = GL_SHORT,
+        UNSIGNED_SHORT = GL_UNSIGNED_SHORT,
+        INT = GL_INT,
+        UNSIGNED_INT = GL_UNSIGNED_INT,
+        HALF_FLOAT = GL_HALF_FLOAT,
+        FLOAT = GL_FLOAT,
+        INT_2_10_10_10_REV = GL_INT_2_10_10_10_REV,
+        UNSIGNED_INT_2_10_10_10_REV = GL_UNSIGNED_INT_2_10_10_10_REV
     };
 
+    enum class IndexType {
+        UNSIGNED_BYTE = GL_UNSIGNED_BYTE,
+        UNSIGNED_SHORT = GL_UNSIGNED_SHORT,
+        UNSIGNED_INT = GL_UNSIGNED_INT
+    };
+
+    inline size_t index_type_size(IndexType type) {
+        switch (type) {
+        case IndexType::UNSIGNED_BYTE:
+            return 1;
+        case IndexType::UNSIGNED_SHORT:
+            return 2;
+        case IndexType::UNSIGNED_INT:
+        default:
+            return 4;
+        }
+    }
+
+    /*
+     * How the shader sees the components of a vertex attribute. FLOAT converts integers to floats
+     * directly (e.g. 255 -> 255.0), NORMALIZED maps them onto [0, 1] for unsigned types or [-1, 1]
+     * for signed ones, and INTEGER passes them through unchanged to an int/uint shader input.
+     */
+    enum class AttributeConversion {
+        FLOAT,
+        NORMALIZED,
+        INTEGER
+    };
+
+    /*
+     * Helpers for building packed vertex data. pack_half converts to an IEEE half float with
+     * round-to-nearest-even, and pack_snorm_2_10_10_10 packs a vector with components in [-1, 1]
+     * into the layout expected by DataType::INT_2_10_10_10_REV with the w component set to 0,
+     * rounded for OpenGL 3.3's normalization rule.
+     */
+    uint16_t pack_half(float value);
+    uint32_t pack_snorm_2_10_10_10(float x, float y, float z);
+
     class GlBuffer {
         GLuint m_id;
         std::size_t m_size;
@@ -59,11 +108,51 @@ namespace hw3 {
         operator bool() const { return this->m_id != 0; }
     };
 
+    /*
+     * A set of ranges of an index buffer that can be drawn with a single multi-draw call. Ranges are
+     * added in units of indices and converted to the byte offsets GL expects.
+     */
+    class IndexedDrawList {
+        IndexType m_index_type;
+
+        std::vector<GLsizei> m_counts;
+        std::vector<const void*> m_offsets;
+        std::vector<GLint> m_base_vertices;
+    public:
+        IndexedDrawList(IndexType index_type = IndexType::UNSIGNED_INT) : m_index_type(index_type) {}
+
+        IndexType index_type() const { return this->m_index_type; }
+        void index_type(IndexType index_type) {
+            assert(this->empty());
+            this->m_index_type = index_type;
+        }
+
+        size_t size() const { return this->m_counts.size(); }
+        bool empty() const { return this->m_counts.empty(); }
+
+        const GLsizei* counts() const { return this->m_counts.data(); }
+        const void* const* offsets() const { return this->m_offsets.data(); }
+        const GLint* base_vertices() const { return this->m_base_vertices.data(); }
+
+        void add(size_t first, size_t n, int base_vertex = 0) {
+            this->m_counts.push_back(static_cast<GLsizei>(n));
+            this->m_offsets.push_back((const void*)(intptr_t)(first * index_type_size(this->m_index_type)));
+            this->m_base_vertices.push_back(base_vertex);
+        }
+
+        void clear() {
+            this->m_counts.clear();
+            this->m_offsets.clear();
+            this->m_base_vertices.clear();
+        }
+    };
+
     class GlVertexArray {
         GLuint m_id;
         int m_size;
 
         std::vector<GlBuffer> m_buffers;
+        int m_index_buffer = -1;
     public:
         GlVertexArray() : m_id(0) {}
         GlVertexArray(const GlVertexArray& other) = delete;
@@ -90,12 +179,32 @@ namespace hw3 {
             DataType data_type,
             size_t stride,
             size_t start,
-            int buffer_index
+            int buffer_index,
+            AttributeConversion conversion = AttributeConversion::FLOAT
         );
 
+        /*
+         * Binds one of this vertex array's buffers as its element array buffer. This binding is part
+         * of the vertex array state, so draws using an IndexedDrawList don't need to rebind it.
+         */
+        void bind_index_buffer(int buffer_index);
+
         void draw(PrimitiveType type) const;
         void draw(int first, size_t n, PrimitiveType type) const;
-        void draw_indexed(const GlBuffer& buffer, int first, size_t n, PrimitiveType type) const;
+        /*
+         * Draws n indices starting at index first (not a byte offset) of the given index buffer.
+         * base_vertex is added to every index before it is used to fetch vertices, which allows
+         * narrow index types to address vertices beyond their range.
+         */
+        void draw_indexed(
+            const GlBuffer& buffer,
+            int first,
+            size_t n,
+            PrimitiveType type,
+            IndexType index_type = IndexType::UNSIGNED_INT,
+            int base_vertex = 0
+        ) const;
+        void draw_indexed(const IndexedDrawList& draws, PrimitiveType type) const;
     };
 }
 
@@ -1,6 +1,7 @@
 #ifndef HW3_WORLD_HPP
 #define HW3_WORLD_HPP
 
+#include <chrono>
 #include <memory>
 #include <sstream>
 #include <vector>
@@ -8,8 +9,12 @@
 #include <boost/filesystem.hpp>
 #include <glm/glm.hpp>
 
+#include "assetloader.hpp"
+#include "glstate.hpp"
 #include "objmodel.hpp"
 #include "shader.hpp"
+#include "texturestream.hpp"
+#include "uniformring.hpp"
 
 namespace hw3 {
     struct Orientation {
@@ -35,24 +40,61 @@ namespace hw3 {
         bool draw_textures = true;
         bool draw_bounding_boxes = false;
         bool draw_lights = false;
+
+        /*
+         * Objects are drawn with the coarsest LOD whose error covers at most lod_threshold pixels on
+         * screen. Each step of lod_bias doubles that threshold, so positive values favour speed and
+         * negative values favour detail.
+         */
+        float lod_threshold = 1.0f;
+        float lod_bias = 0.0f;
+
+        // Skip the meshlets of each model that are off screen or facing away from the camera
+        bool cull_meshlets = true;
+    };
+
+    struct FrameStats {
+        size_t objects = 0;
+
+        // Objects whose models are still loading, which are drawn as placeholders
+        size_t pending_objects = 0;
+        size_t triangles = 0;
+
+        // The number of triangles that would have been drawn if every object used LOD 0 and no
+        // meshlets were culled
+        size_t full_detail_triangles = 0;
+
+        // Vertex shader runs for the drawn triangles, estimated from the ACMR of each drawn LOD
+        double transformed_vertices = 0;
+
+        size_t meshlets = 0;
+        size_t culled_meshlets = 0;
+
+        std::vector<size_t> objects_per_lod;
+
+        // The program, vertex array, buffer, texture and sampler binds made while drawing the scene
+        GlStateStats binds;
     };
 
     class Object {
         std::shared_ptr<Model3D> m_model;
-        Material m_material;
+
+        // The index of the object's material in the world's material table
+        size_t m_material;
 
         glm::vec3 m_pos = glm::vec3(0);
         Orientation m_orientation;
         float m_scale = 1.0f;
 
+        size_t m_lod = 0;
     public:
-        Object(std::shared_ptr<Model3D> model, Material material)
-            : m_model(std::move(model)), m_material(std::move(material)) {}
+        Object(std::shared_ptr<Model3D> model, size_t material)
+            : m_model(std::move(model)), m_material(material) {}
 
         const std::shared_ptr<Model3D>& model() const { return this->m_model; }
-        const Material& material() const { return this->m_material; }
-        Object& material(Material material) {
-            this->m_material = std::move(material);
+        size_t material() const { return this->m_material; }
+        Object& material(size_t material) {
+            this->m_material = material;
             return *this;
         }
 
@@ -69,10 +111,29 @@ namespace hw3 {
         glm::mat4 transform_matrix() const;
         AABB bounding_box() const;
 
-        void draw(
+        /*
+         * The LOD this object is drawn with. select_lod picks it from the size the model's LOD
+         * errors would have on screen, given the number of pixels covered by one world unit at a
+         * distance of one unit from the camera. It only moves to a coarser LOD once that LOD is well
+         * within the threshold, so that objects near a boundary don't flicker between LODs.
+         */
+        size_t lod() const { return this->m_lod; }
+        size_t select_lod(const glm::vec3& camera_pos, float pixels_per_unit, float threshold);
+
+        /*
+         * Roughly how many pixels across the object is on screen, measured as the diameter of its
+         * bounding sphere at the point closest to the camera. Infinite if the camera is inside it.
+         */
+        float screen_size(const glm::vec3& camera_pos, float pixels_per_unit) const;
+
+        // Writes the object's transforms into the uniform ring and draws it with its material's maps
+        Model3DDrawStats draw(
             ShaderProgram& program,
+            UniformRing& uniform_ring,
+            const Material& material,
             const RenderSettings& render_settings,
-            const glm::mat4& view_projection_matrix
+            const glm::mat4& view_projection_matrix,
+            const glm::vec3& camera_pos
         ) const;
     };
 
@@ -88,14 +149,10 @@ namespace hw3 {
         float a2;
     };
 
-    template <>
-    struct ShaderProgram::uniform_setter<PointLight> {
-        void operator ()(ShaderProgram& program, std::string name, const PointLight& value);
-    };
-
     class Camera {
         glm::mat4 m_view_matrix = glm::mat4(1.0f);
         glm::mat4 m_projection_matrix = glm::mat4(1.0f);
+        glm::vec2 m_viewport_size = glm::vec2(1.0f);
     public:
         Camera() {}
         Camera(const glm::mat4& view_matrix) : m_view_matrix(view_matrix) {}
@@ -112,6 +169,13 @@ namespace hw3 {
             return this->m_projection_matrix * this->m_view_matrix;
         }
 
+        // The size of the viewport in pixels, used to work out how large things appear on screen
+        const glm::vec2& viewport_size() const { return this->m_viewport_size; }
+        Camera& viewport_size(const glm::vec2& viewport_size) {
+            this->m_viewport_size = viewport_size;
+            return *this;
+        }
+
         glm::mat3 orientation_matrix() const { return glm::mat3(this->m_view_matrix); }
         Camera& orientation_matrix(const glm::mat3& orientation_matrix) {
             this->m_view_matrix[0] = glm::vec4(orientation_matrix[0], this->m_view_matrix[0].w);
@@ -171,14 +235,40 @@ namespace hw3 {
         std::vector<std::unique_ptr<PointLight>> m_point_lights;
         glm::vec3 m_ambient_light;
 
+        // Materials never change once they've been parsed, but the layers their maps are in do
+        // while the scene loads, so the table on the GPU is rewritten whenever assets have loaded
+        std::vector<Material> m_materials;
+        GlBuffer m_material_buffer;
+        bool m_materials_changed = false;
+
         RenderSettings m_render_settings;
+        FrameStats m_frame_stats;
 
         Camera m_camera;
+        SamplerCache m_sampler_cache;
+        TextureCache m_texture_cache;
+        TextureStreamer m_texture_streamer;
+
+        // Holds the frame block and the object block of every object drawn, for the last few frames
+        UniformRing m_uniform_ring;
+
+        // Declared last so that it's destroyed first: the loader thread has to stop before the assets
+        // it's loading into are destroyed.
+        std::unique_ptr<AssetLoader> m_asset_loader;
 
         ShaderProgram& select_program() const;
+        void upload_materials();
+
+        // Asks the texture streamer for the levels of the object's maps that it needs on screen
+        void request_texture_levels(const Object& obj, const glm::vec3& camera_pos, float pixels_per_unit);
     public:
         World() {};
 
+        const std::vector<Material>& materials() const { return this->m_materials; }
+
+        // Adds a material to the table, returning the index objects refer to it by
+        size_t add_material(Material material);
+
         std::vector<std::unique_ptr<Object>>& objects() { return this->m_objects; }
         const std::vector<std::unique_ptr<Object>>& objects() const { return this->m_objects; }
 
@@ -199,11 +289,39 @@ namespace hw3 {
         Camera& camera() { return this->m_camera; }
         const Camera& camera() const { return this->m_camera; }
 
+        // The samplers of every scene loaded so far, shared between all maps sampled the same way
+        SamplerCache& sampler_cache() { return this->m_sampler_cache; }
+        const SamplerCache& sampler_cache() const { return this->m_sampler_cache; }
+
+        // The textures of the current scene, shared between all materials that use the same image
+        TextureCache& texture_cache() { return this->m_texture_cache; }
+        const TextureCache& texture_cache() const { return this->m_texture_cache; }
+
+        // Streams in the mipmap levels of the scene's textures as draw finds that they're needed
+        TextureStreamer& texture_streamer() { return this->m_texture_streamer; }
+        const TextureStreamer& texture_streamer() const { return this->m_texture_streamer; }
+
+        // Statistics about the last frame drawn
+        const FrameStats& frame_stats() const { return this->m_frame_stats; }
+
         AABB bounding_box() const;
 
+        /*
+         * Parses a scene file and starts loading its models and textures in the background. Until
+         * they're loaded, objects are drawn as bounding boxes (as soon as their size is known) and
+         * texture maps are left blank. update_assets must be called regularly, e.g. once per frame,
+         * on the thread that owns the OpenGL context to upload assets once they've been loaded.
+         */
         World& load_scene(boost::filesystem::path path);
 
-        void draw() const;
+        /*
+         * Uploads loaded assets and streamed texture levels for at most about the given time.
+         * Returns the number of updates made.
+         */
+        size_t update_assets(std::chrono::steady_clock::duration budget);
+        bool loading() const { return this->m_asset_loader && !this->m_asset_loader->idle(); }
+
+        void draw();
     };
 }
 
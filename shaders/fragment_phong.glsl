@@ -4,6 +4,7 @@
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec2 tex_coord;
 layout(location = 2) in vec3 unnormalized_normal;
+layout(location = 3) flat in int material_index;
 
 layout(location = 0) out vec4 frag_color;
 
@@ -19,27 +20,58 @@ struct PointLight {
     float a2;
 };
 
+// Each map is a layer of a texture array, so that materials whose maps are in the same arrays
+// only differ in which layers they use
 struct Material {
     vec3 ambient;
-    sampler2D ambient_occlusion_map;
+    int ambient_occlusion_layer;
 
     vec3 diffuse;
-    sampler2D diffuse_map;
+    int diffuse_layer;
 
     vec3 specular;
-    sampler2D specular_map;
+    int specular_layer;
 
     float shininess;
 };
 
-uniform vec3 camera_position;
-uniform vec3 scene_ambient;
-
 #define MAX_POINT_LIGHTS 16
-uniform int num_point_lights;
-uniform PointLight point_lights[MAX_POINT_LIGHTS];
+#define MAX_MATERIALS 256
+
+// Written once per frame (see shaders::FrameBlock)
+layout(std140) uniform Frame {
+    vec3 camera_position;
+    bool use_maps;
+    vec3 scene_ambient;
+    bool use_ambient_occlusion;
+
+    int num_point_lights;
+    PointLight point_lights[MAX_POINT_LIGHTS];
+};
+
+// Every material in the scene, written once the layers their maps are in are known (see
+// shaders::MaterialBlock)
+layout(std140) uniform Materials {
+    Material materials[MAX_MATERIALS];
+};
 
-uniform Material material;
+// The arrays the maps of the object's material are in
+uniform sampler2DArray ambient_occlusion_map;
+uniform sampler2DArray diffuse_map;
+uniform sampler2DArray specular_map;
+
+Material material;
+
+// Maps are treated as white when they're turned off
+vec3 sample_map(sampler2DArray map, int layer) {
+    return use_maps ? vec3(texture(map, vec3(tex_coord, layer))) : vec3(1.0);
+}
+
+vec3 sample_ambient_occlusion() {
+    return use_ambient_occlusion
+        ? vec3(sample_map(ambient_occlusion_map, material.ambient_occlusion_layer).r)
+        : vec3(1.0);
+}
 
 float calc_attenuation(PointLight light, vec3 pos) {
     float distance = length(light.pos - pos);
@@ -52,20 +84,20 @@ vec3 calc_point_light(PointLight light, vec3 view_dir, vec3 normal) {
 
     // Calculate ambient light
     vec3 ambient = light.ambient
-        * vec3(texture(material.diffuse_map, tex_coord))
-        * vec3(texture(material.ambient_occlusion_map, tex_coord).r)
+        * sample_map(diffuse_map, material.diffuse_layer)
+        * sample_ambient_occlusion()
         * material.ambient;
 
     // Calculate diffuse light
     vec3 diffuse = max(dot(normal, light_dir), 0.0)
         * light.diffuse
-        * vec3(texture(material.diffuse_map, tex_coord))
+        * sample_map(diffuse_map, material.diffuse_layer)
         * material.diffuse;
 
     // Calculate specular light
     vec3 specular = pow(max(dot(view_dir, reflect(-light_dir, normal)), 0.0), material.shininess)
         * light.specular
-        * vec3(texture(material.specular_map, tex_coord))
+        * sample_map(specular_map, material.specular_layer)
         * material.specular;
 
     // Add effects together and apply attenuation
@@ -74,12 +106,14 @@ vec3 calc_point_light(PointLight light, vec3 view_dir, vec3 normal) {
 
 vec3 calc_scene_ambient() {
     return scene_ambient
-        * vec3(texture(material.diffuse_map, tex_coord))
-        * vec3(texture(material.ambient_occlusion_map, tex_coord).r)
+        * sample_map(diffuse_map, material.diffuse_layer)
+        * sample_ambient_occlusion()
         * material.ambient;
 }
 
 void main() {
+    material = materials[material_index];
+
     vec3 normal = normalize(unnormalized_normal);
     vec3 view_dir = normalize(camera_position - position);
 
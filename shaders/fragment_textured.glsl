@@ -2,10 +2,11 @@
 #extension GL_ARB_separate_shader_objects : require
 
 layout(location = 0) in vec2 tex_coord;
-uniform sampler2D tex;
+uniform sampler2DArray tex;
+uniform int layer;
 
 layout(location = 0) out vec4 frag_color;
 
 void main() {
-    frag_color = texture(tex, tex_coord);
+    frag_color = texture(tex, vec3(tex_coord, layer));
 }
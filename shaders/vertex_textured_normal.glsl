@@ -8,14 +8,26 @@ layout(location = 2) in vec3 normal;
 layout(location = 0) out vec3 position_out;
 layout(location = 1) out vec2 tex_coord_out;
 layout(location = 2) out vec3 normal_out;
+layout(location = 3) flat out int material_index_out;
 
-uniform mat4 vertex_transform = mat4(1.0);
-uniform mat4 vertex_world_transform = mat4(1.0);
-uniform mat3 normal_transform = mat3(1.0);
+// Written once per object (see shaders::ObjectBlock)
+layout(std140) uniform Object {
+    mat4 vertex_transform;
+    mat4 vertex_world_transform;
+    mat3 normal_transform;
+
+    // Maps quantized vertex positions back into object space
+    vec3 position_offset;
+    int material_index;
+    vec3 position_scale;
+};
 
 void main() {
-    gl_Position = vec4(position, 1.0) * vertex_transform;
-    position_out = vec3(vec4(position, 1.0) * vertex_world_transform);
+    vec4 object_position = vec4(position_offset + position * position_scale, 1.0);
+
+    gl_Position = vertex_transform * object_position;
+    position_out = vec3(vertex_world_transform * object_position);
     tex_coord_out = tex_coord;
-    normal_out = normal * normal_transform;
+    normal_out = normal_transform * normal;
+    material_index_out = material_index;
 }
@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <exception>
+
+#include "assetloader.hpp"
+
+namespace hw3 {
+    // Whether the current thread belongs to a loader
+    static thread_local bool on_loader_thread = false;
+
+    AssetLoader::AssetLoader(size_t num_threads) {
+        if (num_threads == 0) {
+            num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+
+        for (size_t i = 0; i < num_threads; i++) {
+            this->m_threads.emplace_back([this]() { this->run(); });
+        }
+    }
+
+    AssetLoader::~AssetLoader() {
+        {
+            std::lock_guard<std::mutex> lock(this->m_mutex);
+
+            this->m_stopping = true;
+            this->m_jobs.clear();
+        }
+
+        this->m_job_available.notify_all();
+
+        for (auto& thread : this->m_threads) {
+            thread.join();
+        }
+    }
+
+    void AssetLoader::run() {
+        on_loader_thread = true;
+
+        while (true) {
+            std::function<void ()> job;
+
+            {
+                std::unique_lock<std::mutex> lock(this->m_mutex);
+
+                this->m_job_available.wait(lock, [&]() {
+                    return this->m_stopping || !this->m_jobs.empty();
+                });
+
+                if (this->m_stopping) {
+                    return;
+                }
+
+                job = std::move(this->m_jobs.front());
+                this->m_jobs.pop_front();
+            }
+
+            try {
+                job();
+            } catch (...) {
+                auto error = std::current_exception();
+
+                this->complete([error]() {
+                    std::rethrow_exception(error);
+                });
+            }
+
+            // Destroy the job before it's counted as finished, so that nothing it captured outlives
+            // the point where the loader reports being idle.
+            job = nullptr;
+
+            std::lock_guard<std::mutex> lock(this->m_mutex);
+            this->m_pending--;
+        }
+    }
+
+    void AssetLoader::queue(std::function<void ()> job) {
+        {
+            std::lock_guard<std::mutex> lock(this->m_mutex);
+
+            this->m_jobs.push_back(std::move(job));
+            this->m_pending++;
+        }
+
+        this->m_job_available.notify_one();
+    }
+
+    void AssetLoader::complete(std::function<void ()> completion) {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+
+        this->m_completions.push_back(std::move(completion));
+        this->m_pending++;
+    }
+
+    size_t AssetLoader::run_completions(std::chrono::steady_clock::duration budget) {
+        auto deadline = std::chrono::steady_clock::now() + budget;
+        size_t num_run = 0;
+
+        do {
+            std::function<void ()> completion;
+
+            {
+                std::lock_guard<std::mutex> lock(this->m_mutex);
+
+                if (this->m_completions.empty()) {
+                    break;
+                }
+
+                completion = std::move(this->m_completions.front());
+                this->m_completions.pop_front();
+                this->m_pending--;
+            }
+
+            completion();
+            num_run++;
+        } while (std::chrono::steady_clock::now() < deadline);
+
+        return num_run;
+    }
+
+    bool AssetLoader::idle() const {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+
+        return this->m_pending == 0;
+    }
+
+    unsigned int AssetLoader::worker_threads() {
+        if (on_loader_thread) {
+            return 1;
+        }
+
+        return std::max(std::thread::hardware_concurrency(), 1u);
+    }
+}
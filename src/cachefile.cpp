@@ -0,0 +1,80 @@
+#include <atomic>
+#include <iostream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/filesystem/fstream.hpp>
+
+#include "cachefile.hpp"
+
+namespace hw3 {
+    // Numbers the temporary files written by this process, since loader threads may write several
+    // at once, even for the same cache file
+    static std::atomic<uint64_t> next_temp_file(0);
+
+    bool cache_source_info(const boost::filesystem::path& path, CacheSource& source) {
+        struct stat st;
+
+        if (::stat(path.c_str(), &st) != 0) {
+            return false;
+        }
+
+        boost::system::error_code ec;
+        source.canonical_path = boost::filesystem::canonical(path, ec).string();
+
+        if (ec) {
+            return false;
+        }
+
+        source.size = st.st_size;
+        source.mtime_sec = st.st_mtim.tv_sec;
+        source.mtime_nsec = st.st_mtim.tv_nsec;
+
+        return true;
+    }
+
+    size_t cache_padded_path_length(size_t length) {
+        return (length + 7) & ~static_cast<size_t>(7);
+    }
+
+    void write_cache_file(
+        const boost::filesystem::path& path,
+        const char* kind,
+        const std::function<void (std::ostream&)>& write
+    ) {
+        auto temp_path = boost::filesystem::path(
+            path.native() + ".tmp" + std::to_string(::getpid()) + "." + std::to_string(next_temp_file++)
+        );
+
+        {
+            boost::filesystem::ofstream f(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+
+            if (!f) {
+                std::cerr << "Warning: Unable to write " << kind << " cache \"" << path.string() << "\""
+                          << std::endl;
+                return;
+            }
+
+            write(f);
+
+            if (!f) {
+                boost::system::error_code ec;
+
+                f.close();
+                boost::filesystem::remove(temp_path, ec);
+
+                std::cerr << "Warning: Unable to write " << kind << " cache \"" << path.string() << "\""
+                          << std::endl;
+                return;
+            }
+        }
+
+        boost::system::error_code ec;
+        boost::filesystem::rename(temp_path, path, ec);
+
+        if (ec) {
+            boost::filesystem::remove(temp_path, ec);
+        }
+    }
+}
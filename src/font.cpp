@@ -20,9 +20,9 @@ namespace hw3 {
     }
 
     void Text::draw(const glm::mat4& transform, glm::vec3 color) const {
-        shaders::font_program.set_uniform("color", color);
-        shaders::font_program.set_uniform("tex", &this->m_font->sampler());
-        shaders::font_program.set_uniform("vertex_transform", transform);
+        shaders::font_program.set_uniform(shaders::uniforms::color, color);
+        shaders::font_program.set_uniform(shaders::uniforms::tex, &this->m_font->sampler());
+        shaders::font_program.set_uniform(shaders::uniforms::vertex_transform, transform);
         shaders::font_program.use();
 
         this->m_vertex_array.draw_indexed(this->m_vertex_array.buffer(1), 0, this->m_vertex_array.size(), PrimitiveType::TRIANGLES);
@@ -0,0 +1,139 @@
+#include <cassert>
+#include <unordered_map>
+#include <vector>
+
+#include "glstate.hpp"
+#include "opengl.hpp"
+
+namespace hw3 {
+    namespace gl_state {
+        struct TextureUnit {
+            GLuint texture_2d = 0;
+            GLuint texture_2d_array = 0;
+            GLuint sampler = 0;
+        };
+
+        static GLuint current_program = 0;
+        static GLuint current_vertex_array = 0;
+
+        // The element buffer bound to each vertex array that has had one bound through here
+        static std::unordered_map<GLuint, GLuint> element_buffers;
+
+        static std::vector<TextureUnit> texture_units;
+
+        static GlStateStats counters;
+
+        // Counts a bind, returning whether it actually needs to be issued
+        static bool update(GLuint& current, GLuint value) {
+            if (current == value) {
+                counters.skipped++;
+                return false;
+            }
+
+            current = value;
+            counters.issued++;
+
+            return true;
+        }
+
+        static TextureUnit& texture_unit(GLuint unit) {
+            assert(unit != 0);
+
+            if (unit >= texture_units.size()) {
+                texture_units.resize(unit + 1);
+            }
+
+            return texture_units[unit];
+        }
+
+        void use_program(GLuint program) {
+            if (update(current_program, program)) {
+                glUseProgram(program);
+                handle_errors();
+            }
+        }
+
+        void bind_vertex_array(GLuint vertex_array) {
+            if (update(current_vertex_array, vertex_array)) {
+                glBindVertexArray(vertex_array);
+                handle_errors();
+            }
+        }
+
+        void bind_element_buffer(GLuint buffer) {
+            assert(current_vertex_array != 0);
+
+            if (update(element_buffers[current_vertex_array], buffer)) {
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+                handle_errors();
+            }
+        }
+
+        void bind_texture(GLuint unit, GLenum target, GLuint texture) {
+            assert(target == GL_TEXTURE_2D || target == GL_TEXTURE_2D_ARRAY);
+
+            TextureUnit& state = texture_unit(unit);
+
+            if (update(target == GL_TEXTURE_2D_ARRAY ? state.texture_2d_array : state.texture_2d, texture)) {
+                glActiveTexture(GL_TEXTURE0 + unit);
+                glBindTexture(target, texture);
+                handle_errors();
+            }
+        }
+
+        void bind_sampler(GLuint unit, GLuint sampler) {
+            if (update(texture_unit(unit).sampler, sampler)) {
+                glBindSampler(unit, sampler);
+                handle_errors();
+            }
+        }
+
+        void forget_program(GLuint program) {
+            // A deleted program stays in use until another one is, but whatever reuses its name
+            // still has to be bound
+            if (current_program == program) {
+                current_program = 0;
+            }
+        }
+
+        void forget_vertex_array(GLuint vertex_array) {
+            if (current_vertex_array == vertex_array) {
+                current_vertex_array = 0;
+            }
+
+            element_buffers.erase(vertex_array);
+        }
+
+        void forget_buffer(GLuint buffer) {
+            for (auto& element_buffer : element_buffers) {
+                if (element_buffer.second == buffer) {
+                    element_buffer.second = 0;
+                }
+            }
+        }
+
+        void forget_texture(GLuint texture) {
+            for (auto& unit : texture_units) {
+                if (unit.texture_2d == texture) {
+                    unit.texture_2d = 0;
+                }
+
+                if (unit.texture_2d_array == texture) {
+                    unit.texture_2d_array = 0;
+                }
+            }
+        }
+
+        void forget_sampler(GLuint sampler) {
+            for (auto& unit : texture_units) {
+                if (unit.sampler == sampler) {
+                    unit.sampler = 0;
+                }
+            }
+        }
+
+        GlStateStats stats() {
+            return counters;
+        }
+    }
+}
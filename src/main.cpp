@@ -1,7 +1,15 @@
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstddef>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <stb_image.h>
 
 #define GLFW_INCLUDE_GLCOREARB
 #define GL_GLEXT_PROTOTYPES
@@ -9,8 +17,11 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "assetloader.hpp"
 #include "font.hpp"
+#include "mipmap.hpp"
 #include "objmodel.hpp"
+#include "opengl.hpp"
 #include "shaderimpl.hpp"
 #include "texture.hpp"
 #include "window.hpp"
@@ -91,12 +102,301 @@ namespace hw3 {
         }
     };
 
+    /*
+     * Times building the mipmaps of an image on the CPU with each filter against uploading it and
+     * having the driver generate them with glGenerateMipmap. Each is run a few times and the
+     * fastest run is reported, to leave out one-off costs like page faults.
+     */
+    static int run_mipmap_benchmark(const char* path) {
+        constexpr int runs = 5;
+
+        int width, height, channels;
+        unsigned char* pixels = stbi_load(path, &width, &height, &channels, 4);
+
+        if (pixels == nullptr) {
+            std::cerr << "Failed to read texture from file " << path << std::endl;
+            return 1;
+        }
+
+        init_windowing_system();
+
+        Window window("HW3", 64, 64);
+        window.make_current_context();
+        enable_debug_output();
+
+        auto elapsed_since = [](std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        };
+
+        // fn returns the time taken by the part of it that's being measured
+        auto best_of_runs = [&](const std::function<double ()>& fn) {
+            double best = fn();
+
+            for (int i = 1; i < runs; i++) {
+                best = std::min(best, fn());
+            }
+
+            return best;
+        };
+
+        auto cpu_time = [&](MipmapFilter filter) {
+            return best_of_runs([&]() {
+                auto start = std::chrono::steady_clock::now();
+
+                build_mipmaps(reinterpret_cast<const char*>(pixels), width, height, TextureDataFormat::SRGBA, filter);
+
+                return elapsed_since(start);
+            });
+        };
+
+        std::cout << "Mipmaps for " << width << "x" << height << " image:" << std::endl;
+        std::cout << "  CPU, box filter: " << cpu_time(MipmapFilter::BOX) << " ms" << std::endl;
+        std::cout << "  CPU, Kaiser filter: " << cpu_time(MipmapFilter::KAISER) << " ms" << std::endl;
+
+        // Only generating the mipmaps is measured, not uploading the base level. glFinish makes
+        // sure the driver has actually done the work before the clock stops.
+        std::cout << "  Driver (glGenerateMipmap): " << best_of_runs([&]() {
+            Texture2D texture;
+
+            texture.load_data(reinterpret_cast<const char*>(pixels), TextureDataFormat::SRGBA, width, height);
+            glFinish();
+
+            auto start = std::chrono::steady_clock::now();
+
+            texture.generate_mipmap();
+            glFinish();
+
+            return elapsed_since(start);
+        }) << " ms" << std::endl;
+
+        stbi_image_free(pixels);
+
+        return 0;
+    }
+
+    /*
+     * Times drawing a minified texture with different sampler states on the GPU. A plane covered in
+     * repeats of the image stretches from just below the camera far into the distance, so most of
+     * it is minified and seen at a grazing angle. Each state draws the plane over the whole window
+     * many times inside a timer query, a few times over, and the fastest run is reported.
+     */
+    static int run_filter_benchmark(const char* path) {
+        constexpr int runs = 5;
+        constexpr int draws_per_run = 50;
+        constexpr int window_size = 1024;
+
+        init_windowing_system();
+
+        Window window("HW3", window_size, window_size);
+        window.make_current_context();
+        enable_debug_output();
+
+        shaders::init();
+
+        // Uncompressed, so that filtering is all that the texture fetches do
+        std::vector<std::shared_ptr<const TextureImage>> images;
+
+        try {
+            images.push_back(std::make_shared<const TextureImage>(
+                TextureImage::load_from_file(path, TextureDataFormat::SRGBA, MipmapFilter::KAISER)
+            ));
+        } catch (std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+
+        auto layer = std::make_shared<TextureLayer>();
+
+        layer->texture = std::make_shared<Texture2DArray>();
+        layer->texture->load_data(images);
+
+        struct VertData {
+            glm::vec3 pos;
+            glm::vec2 texcoord;
+        };
+
+        // One repeat of the image per unit
+        GlVertexArray plane(1, 4);
+
+        plane.buffer(0).load_data({
+            VertData { .pos = glm::vec3(-100, -1, 0), .texcoord = glm::vec2(0, 0) },
+            VertData { .pos = glm::vec3(100, -1, 0), .texcoord = glm::vec2(200, 0) },
+            VertData { .pos = glm::vec3(-100, -1, -1000), .texcoord = glm::vec2(0, 1000) },
+            VertData { .pos = glm::vec3(100, -1, -1000), .texcoord = glm::vec2(200, 1000) }
+        }, GL_STATIC_DRAW);
+        plane.bind_attribute(0, 3, DataType::FLOAT, sizeof(VertData), offsetof(VertData, pos), 0);
+        plane.bind_attribute(1, 2, DataType::FLOAT, sizeof(VertData), offsetof(VertData, texcoord), 0);
+
+        glm::mat4 transform = glm::infinitePerspective(default_fov, 1.0f, 0.1f)
+            * glm::lookAt(glm::vec3(0, 0, 0), glm::vec3(0, -0.2f, -1), glm::vec3(0, 1, 0));
+
+        SamplerCache samplers;
+        GLuint query;
+
+        glGenQueries(1, &query);
+
+        auto gpu_time = [&](TextureSampleMode downsample, float anisotropy) {
+            SamplerState state;
+
+            state.downsample = downsample;
+            state.anisotropy = anisotropy;
+
+            Sampler2DArray sampler(layer, samplers.get(state));
+            double best = 0;
+
+            shaders::textured_program.set_uniform(shaders::uniforms::tex, &sampler);
+            shaders::textured_program.set_uniform(shaders::uniforms::layer, sampler.layer());
+            shaders::textured_program.set_uniform(shaders::uniforms::vertex_transform, transform);
+            shaders::textured_program.use();
+
+            for (int i = 0; i < runs; i++) {
+                GLuint64 elapsed;
+
+                glBeginQuery(GL_TIME_ELAPSED, query);
+
+                for (int j = 0; j < draws_per_run; j++) {
+                    plane.draw(PrimitiveType::TRIANGLE_STRIP);
+                }
+
+                glEndQuery(GL_TIME_ELAPSED);
+                glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+
+                double time = elapsed / 1e6 / draws_per_run;
+
+                best = i == 0 ? time : std::min(best, time);
+            }
+
+            return best;
+        };
+
+        std::cout << "Drawing a minified " << images[0]->width() << "x" << images[0]->height() << " texture over "
+                  << window_size << "x" << window_size << " pixels:" << std::endl;
+        std::cout << "  Bilinear, full-size level only: "
+                  << gpu_time(TextureSampleMode::LINEAR, 1) << " ms" << std::endl;
+        std::cout << "  Bilinear: " << gpu_time(TextureSampleMode::LINEAR_MIPMAP_NEAREST, 1) << " ms" << std::endl;
+        std::cout << "  Trilinear: " << gpu_time(TextureSampleMode::LINEAR_MIPMAP_LINEAR, 1) << " ms" << std::endl;
+
+        for (float anisotropy = 2; anisotropy <= Sampler::max_anisotropy(); anisotropy *= 2) {
+            std::cout << "  Trilinear, " << anisotropy << "x anisotropic: "
+                      << gpu_time(TextureSampleMode::LINEAR_MIPMAP_LINEAR, anisotropy) << " ms" << std::endl;
+        }
+
+        glDeleteQueries(1, &query);
+
+        return 0;
+    }
+
+    /*
+     * Times parsing an OBJ file (e.g. one written by gen_benchmark_obj.sh) into deduplicated vertex
+     * and index buffers, without the model cache, mesh optimization or OpenGL. The parse is run a
+     * few times and the fastest run is reported; the first run also pulls the file into the page
+     * cache. It's timed both spread over every core and on a single asset loader thread, where the
+     * parser only uses the one thread, to show how well it scales.
+     */
+    static int run_obj_benchmark(const char* path) {
+        constexpr int runs = 5;
+
+        auto elapsed_since = [](std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        };
+
+        size_t num_vertices = 0;
+        size_t num_triangles = 0;
+
+        auto parse_time = [&]() {
+            double best = 0;
+
+            for (int i = 0; i < runs; i++) {
+                auto start = std::chrono::steady_clock::now();
+                auto data = Model3DData::load_obj(path);
+                double time = elapsed_since(start);
+
+                best = i == 0 ? time : std::min(best, time);
+                num_vertices = data.num_vertices();
+                num_triangles = data.num_indices() / 3;
+            }
+
+            return best;
+        };
+
+        double threaded_time = 0;
+        double serial_time = 0;
+        VertexDedupBenchmark dedup;
+
+        try {
+            threaded_time = parse_time();
+
+            AssetLoader loader(1);
+
+            loader.queue([&]() { serial_time = parse_time(); });
+
+            while (!loader.idle()) {
+                loader.run_completions(std::chrono::milliseconds(10));
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+
+            dedup = benchmark_vertex_dedup(path);
+        } catch (std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+
+        double size_mb = boost::filesystem::file_size(path) / (1024.0 * 1024.0);
+
+        std::cout << "Parsed " << path << " (" << std::fixed << std::setprecision(1) << size_mb << " MiB, "
+                  << num_vertices << " vertices, " << num_triangles << " triangles):" << std::endl;
+        std::cout << "  1 thread: " << serial_time << " ms (" << size_mb / (serial_time / 1000) << " MiB/s)" << std::endl;
+        std::cout << "  " << AssetLoader::worker_threads() << " threads: " << threaded_time << " ms ("
+                  << size_mb / (threaded_time / 1000) << " MiB/s, " << std::setprecision(2)
+                  << serial_time / threaded_time << "x faster)" << std::endl;
+
+        auto dedup_stats = [&](const VertexDedupStats& stats) {
+            std::ostringstream out;
+
+            out << std::fixed << std::setprecision(1) << stats.time_ms << " ms ("
+                << dedup.lookups / (stats.time_ms * 1000) << " M lookups/s)";
+
+            if (stats.heap_bytes > 0) {
+                out << ", " << stats.heap_bytes / 1024 << " KiB of heap";
+            }
+
+            return out.str();
+        };
+
+        std::cout << "Deduplicating " << dedup.lookups << " face corners into " << dedup.unique_vertices
+                  << " vertices:" << std::endl;
+        std::cout << "  Hash table: " << dedup_stats(dedup.hash_table) << std::endl;
+        std::cout << "  std::map: " << dedup_stats(dedup.ordered_map) << std::endl;
+
+        return 0;
+    }
+
     extern "C" int main(int argc, char** argv) {
+        if (argc == 3 && std::string(argv[1]) == "--mipmap-benchmark") {
+            return run_mipmap_benchmark(argv[2]);
+        }
+
+        if (argc == 3 && std::string(argv[1]) == "--filter-benchmark") {
+            return run_filter_benchmark(argv[2]);
+        }
+
+        if (argc == 3 && std::string(argv[1]) == "--obj-benchmark") {
+            return run_obj_benchmark(argv[2]);
+        }
+
         if (argc != 2) {
             std::cerr << "Usage: " << argv[0] << " <scene file>" << std::endl;
+            std::cerr << "       " << argv[0] << " --mipmap-benchmark <image>" << std::endl;
+            std::cerr << "       " << argv[0] << " --filter-benchmark <image>" << std::endl;
+            std::cerr << "       " << argv[0] << " --obj-benchmark <obj file>" << std::endl;
             return 1;
         }
 
+        auto start_time = std::chrono::steady_clock::now();
+        auto elapsed_ms = [&]() {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+        };
+
         init_windowing_system();
         init_fonts();
 
@@ -106,6 +406,7 @@ namespace hw3 {
         window.set_vsync(true);
 
         window.make_current_context();
+        enable_debug_output();
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
         shaders::init();
@@ -123,16 +424,44 @@ namespace hw3 {
             window_size.x / window_size.y,
             0.1f
         ));
+        world.camera().viewport_size(window_size);
 
-        std::cout << "Scene loaded" << std::endl;
+        std::cout << "Scene parsed, loading assets in the background" << std::endl;
 
-        help_text.set_upper_text("<R> Switch Render Mode\n<B> Show/Hide Bounding Boxes\n<L> Show/Hide Lights\n<T> Enable/Disable Textures\n<O> Enable/Disable AO\n<C> Reset Camera\n<H> Show/Hide Help");
+        help_text.set_upper_text("<R> Switch Render Mode\n<B> Show/Hide Bounding Boxes\n<L> Show/Hide Lights\n<T> Enable/Disable Textures\n<O> Enable/Disable AO\n<C> Reset Camera\n<[/]> Adjust LOD Bias\n<M> Enable/Disable Meshlet Culling\n<F> Print Frame Stats\n<H> Show/Hide Help");
         help_text.set_lower_text("No object selected\nUse TAB and SHIFT+TAB to select an object");
 
         float edit_speed = 1.0f;
         int edit_object = -1;
 
+        bool first_frame_drawn = false;
+        bool scene_loading = true;
+
+        // The CPU time spent on frames since frame stats were last printed, which doesn't include
+        // waiting for v-sync
+        double frame_cpu_ms = 0;
+        size_t frames_timed = 0;
+
+        // The camera is reset to show the whole scene once everything has loaded, unless the user has
+        // already moved it by then.
+        bool camera_moved = false;
+
+        auto reset_camera = [&]() {
+            auto aabb = world.bounding_box();
+            auto center = aabb.center();
+            float distance = calculate_camera_distance(aabb, default_fov);
+
+            world.camera()
+                .pos(center + glm::vec3(0, 0, distance))
+                .look_at(center, glm::vec3(0, 1, 0));
+            orbit.rotate_origin(center);
+        };
+
         window.set_mouse_button_callback([&](int button, int action, int mods) {
+            if (action == GLFW_PRESS) {
+                camera_moved = true;
+            }
+
             if (button == GLFW_MOUSE_BUTTON_LEFT) {
                 if (action == GLFW_PRESS) {
                     orbit.begin_rotate(get_gl_coord(window.cursor_pos(), window));
@@ -158,8 +487,10 @@ namespace hw3 {
                 window_size.x / window_size.y,
                 0.1f
             ));
+            world.camera().viewport_size(window_size);
         });
         window.set_scroll_callback([&](glm::dvec2 offset) {
+            camera_moved = true;
             orbit.handle_zoom(offset.y);
         });
 
@@ -215,14 +546,60 @@ namespace hw3 {
                     std::cout << "Ambient occlusion DISABLED" << std::endl;
                 }
             } else if (key == GLFW_KEY_C && action == GLFW_PRESS) {
-                auto aabb = world.bounding_box();
-                auto center = aabb.center();
-                float distance = calculate_camera_distance(aabb, default_fov);
-
-                world.camera()
-                    .pos(center + glm::vec3(0, 0, distance))
-                    .look_at(center, glm::vec3(0, 1, 0));
-                orbit.rotate_origin(center);
+                reset_camera();
+            } else if (key == GLFW_KEY_LEFT_BRACKET && action == GLFW_PRESS) {
+                world.render_settings().lod_bias -= 0.5f;
+                std::cout << "LOD bias: " << world.render_settings().lod_bias << std::endl;
+            } else if (key == GLFW_KEY_RIGHT_BRACKET && action == GLFW_PRESS) {
+                world.render_settings().lod_bias += 0.5f;
+                std::cout << "LOD bias: " << world.render_settings().lod_bias << std::endl;
+            } else if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+                const auto& stats = world.frame_stats();
+
+                std::cout << std::endl;
+                std::cout << "Objects drawn: " << stats.objects << " (" << stats.pending_objects
+                          << " still loading)" << std::endl;
+                std::cout << "Triangles drawn: " << stats.triangles << " (" << stats.full_detail_triangles
+                          << " at full detail)" << std::endl;
+
+                if (stats.triangles > 0) {
+                    std::cout << "Vertex cache ACMR: " << stats.transformed_vertices / stats.triangles
+                              << " (about " << static_cast<size_t>(stats.transformed_vertices)
+                              << " vertices transformed)" << std::endl;
+                }
+
+                for (size_t i = 0; i < stats.objects_per_lod.size(); i++) {
+                    std::cout << "  LOD " << i << ": " << stats.objects_per_lod[i] << " objects" << std::endl;
+                }
+
+                std::cout << "Meshlets drawn: " << stats.meshlets << " (" << stats.culled_meshlets
+                          << " culled)" << std::endl;
+                std::cout << "Binds: " << stats.binds.issued << " issued, " << stats.binds.skipped
+                          << " skipped as redundant" << std::endl;
+
+                if (frames_timed > 0) {
+                    std::cout << "CPU time per frame: " << frame_cpu_ms / frames_timed << " ms (average of "
+                              << frames_timed << " frames)" << std::endl;
+
+                    frame_cpu_ms = 0;
+                    frames_timed = 0;
+                }
+
+                auto streaming_stats = world.texture_streamer().stats();
+
+                std::cout << "Streamed textures: " << streaming_stats.textures << " ("
+                          << streaming_stats.bytes / 1024 << " KiB resident, budget "
+                          << streaming_stats.budget / 1024 << " KiB), "
+                          << streaming_stats.streamed_levels << " levels streamed in, "
+                          << streaming_stats.evicted_levels << " evicted" << std::endl;
+            } else if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+                world.render_settings().cull_meshlets = !world.render_settings().cull_meshlets;
+
+                if (world.render_settings().cull_meshlets) {
+                    std::cout << "Meshlet culling ENABLED" << std::endl;
+                } else {
+                    std::cout << "Meshlet culling DISABLED" << std::endl;
+                }
             } else if (key == GLFW_KEY_I && action == GLFW_PRESS) {
                 edit_speed *= 1.1f;
             } else if (key == GLFW_KEY_K && action == GLFW_PRESS) {
@@ -276,21 +653,36 @@ namespace hw3 {
 
         glDepthFunc(GL_LEQUAL);
 
-        {
-            auto aabb = world.bounding_box();
-            auto center = aabb.center();
-            float distance = calculate_camera_distance(aabb, default_fov);
-
-            world.camera()
-                .pos(center + glm::vec3(0, 0, distance))
-                .look_at(center, glm::vec3(0, 1, 0));
-            orbit.rotate_origin(center);
-        }
+        reset_camera();
 
         window.do_main_loop([&](double delta_t) {
+            auto frame_start = std::chrono::steady_clock::now();
+
+            // Spend a few milliseconds per frame uploading assets that have finished loading, which
+            // keeps the viewer responsive while a large scene streams in.
+            world.update_assets(std::chrono::milliseconds(4));
+
+            if (scene_loading && !world.loading()) {
+                scene_loading = false;
+                std::cout << "Scene fully loaded after " << elapsed_ms() << " ms" << std::endl;
+
+                auto texture_stats = world.texture_cache().stats();
+
+                std::cout << "Texture cache: " << texture_stats.misses << " textures loaded into "
+                          << texture_stats.arrays << " arrays ("
+                          << texture_stats.bytes / 1024 << " KiB, "
+                          << texture_stats.uncompressed_bytes / 1024 << " KiB uncompressed), "
+                          << texture_stats.hits << " reused, "
+                          << world.sampler_cache().size() << " samplers" << std::endl;
+
+                if (!camera_moved) {
+                    reset_camera();
+                }
+            }
+
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-            shaders::point_program.set_uniform("point_half_size", glm::vec2(3.0) / window_size);
+            shaders::point_program.set_uniform(shaders::uniforms::point_half_size, glm::vec2(3.0) / window_size);
 
             if (edit_object >= 0) {
                 if (window.is_key_pressed(GLFW_KEY_LEFT_SHIFT) || window.is_key_pressed(GLFW_KEY_RIGHT_SHIFT)) {
@@ -345,6 +737,16 @@ namespace hw3 {
                 glDisable(GL_DEPTH_TEST);
                 help_text.draw(window_size);
             }
+
+            check_frame_errors();
+
+            if (!first_frame_drawn) {
+                first_frame_drawn = true;
+                std::cout << "First frame drawn after " << elapsed_ms() << " ms" << std::endl;
+            }
+
+            frame_cpu_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+            frames_timed++;
         });
 
         return 0;
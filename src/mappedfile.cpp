@@ -0,0 +1,150 @@
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mappedfile.hpp"
+
+namespace hw3 {
+    static std::runtime_error file_error(const char* what, const boost::filesystem::path& path) {
+        std::ostringstream ss;
+
+        ss << what << " \"" << path.string() << "\": " << std::strerror(errno);
+
+        return std::runtime_error(ss.str());
+    }
+
+    MappedFile::MappedFile(MappedFile&& other)
+        : m_data(other.m_data), m_size(other.m_size), m_mapped(other.m_mapped),
+          m_buffer(std::move(other.m_buffer)) {
+        other.m_data = nullptr;
+        other.m_size = 0;
+        other.m_mapped = false;
+    }
+
+    MappedFile::MappedFile(const boost::filesystem::path& path)
+        : m_data(nullptr), m_size(0), m_mapped(false) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0) {
+            throw file_error("Failed to open file", path);
+        }
+
+        struct stat st;
+
+        if (::fstat(fd, &st) != 0) {
+            auto error = file_error("Failed to stat file", path);
+
+            ::close(fd);
+            throw error;
+        }
+
+        if (S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* ptr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (ptr != MAP_FAILED) {
+                // The parsers only ever make a single forward pass, so let the kernel read ahead
+                // aggressively and drop pages behind us.
+                ::madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+                ::close(fd);
+
+                this->m_data = static_cast<const char*>(ptr);
+                this->m_size = st.st_size;
+                this->m_mapped = true;
+
+                return;
+            }
+        }
+
+        // Fall back to reading everything into memory. For regular files we already know how much
+        // to expect, so this is normally a single read call.
+        this->m_buffer.resize(S_ISREG(st.st_mode) && st.st_size > 0 ? st.st_size + 1 : 65536);
+
+        std::size_t length = 0;
+
+        while (true) {
+            if (length == this->m_buffer.size()) {
+                this->m_buffer.resize(this->m_buffer.size() * 2);
+            }
+
+            ssize_t n = ::read(fd, this->m_buffer.data() + length, this->m_buffer.size() - length);
+
+            if (n < 0) {
+                if (errno == EINTR) continue;
+
+                auto error = file_error("Error reading file", path);
+
+                ::close(fd);
+                throw error;
+            } else if (n == 0) {
+                break;
+            }
+
+            length += n;
+        }
+
+        ::close(fd);
+
+        this->m_buffer.resize(length);
+        this->m_data = this->m_buffer.data();
+        this->m_size = length;
+    }
+
+    MappedFile::~MappedFile() {
+        this->unmap();
+    }
+
+    MappedFile& MappedFile::operator =(MappedFile&& other) {
+        this->unmap();
+
+        this->m_data = other.m_data;
+        this->m_size = other.m_size;
+        this->m_mapped = other.m_mapped;
+        this->m_buffer = std::move(other.m_buffer);
+
+        other.m_data = nullptr;
+        other.m_size = 0;
+        other.m_mapped = false;
+
+        return *this;
+    }
+
+    void MappedFile::prefetch(std::size_t offset, std::size_t size) const {
+        assert(offset + size <= this->m_size);
+
+        if (!this->m_mapped || size == 0) {
+            return;
+        }
+
+        // madvise needs a page-aligned address, so the range is extended back to a page boundary
+        std::size_t page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        std::size_t begin = offset / page_size * page_size;
+
+        ::madvise(const_cast<char*>(this->m_data) + begin, offset + size - begin, MADV_WILLNEED);
+
+        // The advice is only a hint, so touch every page to make sure it's actually resident
+        volatile char sink = 0;
+
+        for (std::size_t i = begin; i < offset + size; i += page_size) {
+            sink = this->m_data[i];
+        }
+
+        (void)sink;
+    }
+
+    void MappedFile::unmap() {
+        if (this->m_mapped) {
+            ::munmap(const_cast<char*>(this->m_data), this->m_size);
+        }
+
+        this->m_data = nullptr;
+        this->m_size = 0;
+        this->m_mapped = false;
+    }
+}
@@ -0,0 +1,1180 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <tuple>
+
+#include "meshoptimize.hpp"
+
+namespace hw3 {
+    float calculate_acmr(const unsigned int* indices, size_t num_indices, size_t num_vertices, size_t cache_size) {
+        if (num_indices < 3) {
+            return 0.0f;
+        }
+
+        // A vertex is in the FIFO cache if it was inserted less than cache_size insertions ago.
+        std::vector<size_t> inserted_at(num_vertices, std::numeric_limits<size_t>::max());
+        size_t timestamp = cache_size + 1;
+        size_t misses = 0;
+
+        for (size_t i = 0; i < num_indices; i++) {
+            unsigned int v = indices[i];
+
+            if (inserted_at[v] == std::numeric_limits<size_t>::max() || timestamp - inserted_at[v] > cache_size) {
+                inserted_at[v] = timestamp++;
+                misses++;
+            }
+        }
+
+        return static_cast<float>(misses) / (num_indices / 3);
+    }
+
+    size_t remove_degenerate_triangles(unsigned int* indices, size_t num_indices, const Model3DVertex* vertices) {
+        size_t out = 0;
+
+        for (size_t i = 0; i + 2 < num_indices; i += 3) {
+            unsigned int a = indices[i];
+            unsigned int b = indices[i + 1];
+            unsigned int c = indices[i + 2];
+
+            if (a == b || b == c || c == a) {
+                continue;
+            }
+
+            glm::vec3 normal = glm::cross(
+                vertices[b].pos - vertices[a].pos,
+                vertices[c].pos - vertices[a].pos
+            );
+
+            if (normal == glm::vec3(0)) {
+                continue;
+            }
+
+            indices[out++] = a;
+            indices[out++] = b;
+            indices[out++] = c;
+        }
+
+        return out;
+    }
+
+    // Scoring constants from Forsyth's original description of the algorithm. The cache being
+    // modelled is an LRU cache, which is a reasonable approximation of the FIFO caches in hardware.
+    static constexpr int forsyth_cache_size = 32;
+    static constexpr float forsyth_cache_decay_power = 1.5f;
+    static constexpr float forsyth_last_triangle_score = 0.75f;
+    static constexpr float forsyth_valence_boost_scale = 2.0f;
+    static constexpr float forsyth_valence_boost_power = 0.5f;
+
+    static float forsyth_vertex_score(int cache_position, unsigned int remaining_valence) {
+        if (remaining_valence == 0) {
+            return -1.0f;
+        }
+
+        float score = 0.0f;
+
+        if (cache_position >= 0) {
+            if (cache_position < 3) {
+                // The vertices of the last triangle get a fixed score regardless of their exact
+                // position, to avoid favouring strips over fans.
+                score = forsyth_last_triangle_score;
+            } else {
+                float scale = 1.0f / (forsyth_cache_size - 3);
+
+                score = std::pow(1.0f - (cache_position - 3) * scale, forsyth_cache_decay_power);
+            }
+        }
+
+        // Boost vertices with few remaining triangles, so that we finish off lone vertices rather
+        // than leaving them to be picked up later with a cold cache.
+        score += forsyth_valence_boost_scale
+            * std::pow(static_cast<float>(remaining_valence), -forsyth_valence_boost_power);
+
+        return score;
+    }
+
+    void optimize_vertex_cache(unsigned int* indices, size_t num_indices, size_t num_vertices) {
+        size_t num_triangles = num_indices / 3;
+
+        if (num_triangles == 0) {
+            return;
+        }
+
+        // Build a compact vertex -> triangle adjacency list. Each vertex's list is kept partitioned
+        // so that the first live_valence entries are the triangles that have not been emitted yet.
+        std::vector<unsigned int> live_valence(num_vertices, 0);
+        std::vector<size_t> adjacency_offsets(num_vertices + 1, 0);
+        std::vector<unsigned int> adjacency(num_triangles * 3);
+
+        for (size_t i = 0; i < num_triangles * 3; i++) {
+            live_valence[indices[i]]++;
+        }
+
+        for (size_t v = 0; v < num_vertices; v++) {
+            adjacency_offsets[v + 1] = adjacency_offsets[v] + live_valence[v];
+        }
+
+        {
+            std::vector<size_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+
+            for (size_t i = 0; i < num_triangles * 3; i++) {
+                adjacency[fill[indices[i]]++] = i / 3;
+            }
+        }
+
+        std::vector<int> cache_position(num_vertices, -1);
+        std::vector<float> vertex_score(num_vertices);
+        std::vector<float> triangle_score(num_triangles, 0.0f);
+        std::vector<bool> emitted(num_triangles, false);
+
+        for (size_t v = 0; v < num_vertices; v++) {
+            vertex_score[v] = forsyth_vertex_score(-1, live_valence[v]);
+        }
+
+        for (size_t t = 0; t < num_triangles; t++) {
+            triangle_score[t] = vertex_score[indices[t * 3]]
+                + vertex_score[indices[t * 3 + 1]]
+                + vertex_score[indices[t * 3 + 2]];
+        }
+
+        std::vector<unsigned int> output(num_triangles * 3);
+        std::vector<unsigned int> cache;
+        std::vector<unsigned int> new_cache;
+
+        cache.reserve(forsyth_cache_size + 3);
+        new_cache.reserve(forsyth_cache_size + 3);
+
+        size_t best_triangle = std::max_element(triangle_score.begin(), triangle_score.end())
+            - triangle_score.begin();
+        size_t next_unemitted = 0;
+
+        for (size_t out = 0; out < num_triangles; out++) {
+            if (best_triangle == num_triangles) {
+                // Nothing in the cache has any triangles left, so start over from the first
+                // triangle that hasn't been emitted yet.
+                while (emitted[next_unemitted]) next_unemitted++;
+
+                best_triangle = next_unemitted;
+            }
+
+            const unsigned int* tri = indices + best_triangle * 3;
+
+            output[out * 3] = tri[0];
+            output[out * 3 + 1] = tri[1];
+            output[out * 3 + 2] = tri[2];
+            emitted[best_triangle] = true;
+
+            new_cache.clear();
+
+            for (int i = 0; i < 3; i++) {
+                unsigned int v = tri[i];
+
+                // Remove the triangle from this vertex's list of live triangles
+                size_t begin = adjacency_offsets[v];
+                size_t end = begin + live_valence[v];
+
+                for (size_t j = begin; j < end; j++) {
+                    if (adjacency[j] == best_triangle) {
+                        std::swap(adjacency[j], adjacency[end - 1]);
+                        break;
+                    }
+                }
+
+                live_valence[v]--;
+                new_cache.push_back(v);
+            }
+
+            for (unsigned int v : cache) {
+                if (v != tri[0] && v != tri[1] && v != tri[2]) {
+                    new_cache.push_back(v);
+                }
+            }
+
+            // Anything pushed off the end of the cache loses its cache score
+            for (size_t i = forsyth_cache_size; i < new_cache.size(); i++) {
+                cache_position[new_cache[i]] = -1;
+                vertex_score[new_cache[i]] = forsyth_vertex_score(-1, live_valence[new_cache[i]]);
+            }
+
+            if (new_cache.size() > static_cast<size_t>(forsyth_cache_size)) {
+                for (size_t i = forsyth_cache_size; i < new_cache.size(); i++) {
+                    unsigned int v = new_cache[i];
+
+                    for (size_t j = adjacency_offsets[v]; j < adjacency_offsets[v] + live_valence[v]; j++) {
+                        unsigned int t = adjacency[j];
+
+                        triangle_score[t] = vertex_score[indices[t * 3]]
+                            + vertex_score[indices[t * 3 + 1]]
+                            + vertex_score[indices[t * 3 + 2]];
+                    }
+                }
+
+                new_cache.resize(forsyth_cache_size);
+            }
+
+            cache.swap(new_cache);
+
+            for (size_t i = 0; i < cache.size(); i++) {
+                cache_position[cache[i]] = static_cast<int>(i);
+                vertex_score[cache[i]] = forsyth_vertex_score(static_cast<int>(i), live_valence[cache[i]]);
+            }
+
+            // Only triangles touching the cache can have changed score, so the next triangle is
+            // picked from among those.
+            best_triangle = num_triangles;
+            float best_score = -std::numeric_limits<float>::infinity();
+
+            for (unsigned int v : cache) {
+                for (size_t j = adjacency_offsets[v]; j < adjacency_offsets[v] + live_valence[v]; j++) {
+                    unsigned int t = adjacency[j];
+                    float score = vertex_score[indices[t * 3]]
+                        + vertex_score[indices[t * 3 + 1]]
+                        + vertex_score[indices[t * 3 + 2]];
+
+                    triangle_score[t] = score;
+
+                    if (score > best_score) {
+                        best_score = score;
+                        best_triangle = t;
+                    }
+                }
+            }
+        }
+
+        std::copy(output.begin(), output.end(), indices);
+    }
+
+    // Simulates a FIFO cache over the triangles [begin, end), returning the number of misses for
+    // each triangle.
+    static void simulate_cache_misses(
+        const unsigned int* indices,
+        size_t begin,
+        size_t end,
+        std::vector<size_t>& inserted_at,
+        size_t& timestamp,
+        unsigned char* misses,
+        size_t cache_size = 16
+    ) {
+        for (size_t t = begin; t < end; t++) {
+            misses[t] = 0;
+
+            for (int i = 0; i < 3; i++) {
+                unsigned int v = indices[t * 3 + i];
+
+                if (timestamp - inserted_at[v] > cache_size) {
+                    inserted_at[v] = timestamp++;
+                    misses[t]++;
+                }
+            }
+        }
+    }
+
+    void optimize_overdraw(
+        unsigned int* indices,
+        size_t num_indices,
+        const Model3DVertex* vertices,
+        size_t num_vertices,
+        float threshold
+    ) {
+        size_t num_triangles = num_indices / 3;
+
+        if (num_triangles == 0) {
+            return;
+        }
+
+        constexpr size_t cache_size = 16;
+
+        std::vector<unsigned char> misses(num_triangles);
+        std::vector<size_t> inserted_at(num_vertices, 0);
+        size_t timestamp = cache_size + 1;
+
+        simulate_cache_misses(indices, 0, num_triangles, inserted_at, timestamp, misses.data());
+
+        // Hard boundaries are the points at which the vertex cache order had to start again with a
+        // completely cold cache; splitting there doesn't cost anything.
+        std::vector<size_t> hard_clusters;
+
+        for (size_t t = 0; t < num_triangles; t++) {
+            if (t == 0 || misses[t] == 3) {
+                hard_clusters.push_back(t);
+            }
+        }
+
+        hard_clusters.push_back(num_triangles);
+
+        // Soft boundaries split hard clusters further wherever the ACMR of the part before the
+        // split, simulated with a cold cache, is within the threshold of the whole cluster's.
+        std::vector<size_t> clusters;
+
+        for (size_t c = 0; c + 1 < hard_clusters.size(); c++) {
+            size_t begin = hard_clusters[c];
+            size_t end = hard_clusters[c + 1];
+
+            timestamp += cache_size + 1;
+            simulate_cache_misses(indices, begin, end, inserted_at, timestamp, misses.data());
+
+            size_t cluster_misses = 0;
+
+            for (size_t t = begin; t < end; t++) {
+                cluster_misses += misses[t];
+            }
+
+            float cluster_threshold = threshold * cluster_misses / (end - begin);
+
+            clusters.push_back(begin);
+            timestamp += cache_size + 1;
+
+            size_t start = begin;
+            size_t running_misses = 0;
+
+            for (size_t t = begin; t < end; t++) {
+                simulate_cache_misses(indices, t, t + 1, inserted_at, timestamp, misses.data());
+                running_misses += misses[t];
+
+                if (t + 1 < end && static_cast<float>(running_misses) / (t + 1 - start) <= cluster_threshold) {
+                    clusters.push_back(t + 1);
+
+                    // The next cluster might be drawn after something else entirely, so start it
+                    // with a cold cache.
+                    timestamp += cache_size + 1;
+                    start = t + 1;
+                    running_misses = 0;
+                }
+            }
+        }
+
+        clusters.push_back(num_triangles);
+
+        // Sort clusters so that the ones facing furthest away from the centre of the mesh are drawn
+        // first, since they are the most likely to occlude the others.
+        glm::vec3 mesh_centroid(0);
+        float mesh_area = 0;
+
+        std::vector<glm::vec3> cluster_centroid(clusters.size() - 1, glm::vec3(0));
+        std::vector<glm::vec3> cluster_normal(clusters.size() - 1, glm::vec3(0));
+
+        for (size_t c = 0; c + 1 < clusters.size(); c++) {
+            float cluster_area = 0;
+
+            for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+                const glm::vec3& a = vertices[indices[t * 3]].pos;
+                const glm::vec3& b = vertices[indices[t * 3 + 1]].pos;
+                const glm::vec3& d = vertices[indices[t * 3 + 2]].pos;
+
+                glm::vec3 normal = glm::cross(b - a, d - a);
+                float area = glm::length(normal);
+
+                cluster_centroid[c] += (a + b + d) * (area / 3);
+                cluster_normal[c] += normal;
+                cluster_area += area;
+            }
+
+            mesh_centroid += cluster_centroid[c];
+            mesh_area += cluster_area;
+
+            if (cluster_area > 0) {
+                cluster_centroid[c] /= cluster_area;
+            }
+
+            float normal_length = glm::length(cluster_normal[c]);
+
+            if (normal_length > 0) {
+                cluster_normal[c] /= normal_length;
+            }
+        }
+
+        if (mesh_area > 0) {
+            mesh_centroid /= mesh_area;
+        }
+
+        std::vector<float> sort_key(clusters.size() - 1);
+        std::vector<size_t> order(clusters.size() - 1);
+
+        for (size_t c = 0; c + 1 < clusters.size(); c++) {
+            sort_key[c] = glm::dot(cluster_centroid[c] - mesh_centroid, cluster_normal[c]);
+            order[c] = c;
+        }
+
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return sort_key[a] > sort_key[b];
+        });
+
+        std::vector<unsigned int> output;
+        output.reserve(num_triangles * 3);
+
+        for (size_t c : order) {
+            output.insert(output.end(), indices + clusters[c] * 3, indices + clusters[c + 1] * 3);
+        }
+
+        std::copy(output.begin(), output.end(), indices);
+    }
+
+    void optimize_vertex_fetch(std::vector<Model3DVertex>& vertices, std::vector<unsigned int>& indices) {
+        constexpr unsigned int unused = std::numeric_limits<unsigned int>::max();
+
+        std::vector<unsigned int> remap(vertices.size(), unused);
+        std::vector<Model3DVertex> output;
+
+        output.reserve(vertices.size());
+
+        for (unsigned int& i : indices) {
+            if (remap[i] == unused) {
+                remap[i] = output.size();
+                output.push_back(vertices[i]);
+            }
+
+            i = remap[i];
+        }
+
+        vertices.swap(output);
+    }
+
+    // Vertex classification for simplification. Manifold vertices can collapse onto any neighbour.
+    // Border and seam vertices can only slide along the border or seam they lie on, so that holes
+    // and texture seams keep their shape. Anything more complicated is locked in place.
+    enum class SimplifyVertexKind : unsigned char {
+        MANIFOLD,
+        BORDER,
+        SEAM,
+        LOCKED
+    };
+
+    struct Quadric {
+        // Symmetric 3x3 matrix A, vector b and constant c such that the error of a point p is
+        // p'Ap + 2b'p + c. w is the total weight, which error() divides out so that errors are
+        // squared distances.
+        float a00 = 0, a11 = 0, a22 = 0;
+        float a10 = 0, a20 = 0, a21 = 0;
+        float b0 = 0, b1 = 0, b2 = 0;
+        float c = 0;
+        float w = 0;
+
+        static Quadric from_plane(const glm::vec3& n, float d, float weight) {
+            Quadric q;
+
+            q.a00 = weight * n.x * n.x;
+            q.a11 = weight * n.y * n.y;
+            q.a22 = weight * n.z * n.z;
+            q.a10 = weight * n.y * n.x;
+            q.a20 = weight * n.z * n.x;
+            q.a21 = weight * n.z * n.y;
+            q.b0 = weight * n.x * d;
+            q.b1 = weight * n.y * d;
+            q.b2 = weight * n.z * d;
+            q.c = weight * d * d;
+            q.w = weight;
+
+            return q;
+        }
+
+        Quadric& operator +=(const Quadric& other) {
+            this->a00 += other.a00;
+            this->a11 += other.a11;
+            this->a22 += other.a22;
+            this->a10 += other.a10;
+            this->a20 += other.a20;
+            this->a21 += other.a21;
+            this->b0 += other.b0;
+            this->b1 += other.b1;
+            this->b2 += other.b2;
+            this->c += other.c;
+            this->w += other.w;
+
+            return *this;
+        }
+
+        float error(const glm::vec3& p) const {
+            float rx = this->b0 + this->a00 * p.x + this->a10 * p.y + this->a20 * p.z;
+            float ry = this->b1 + this->a10 * p.x + this->a11 * p.y + this->a21 * p.z;
+            float rz = this->b2 + this->a20 * p.x + this->a21 * p.y + this->a22 * p.z;
+
+            float r = rx * p.x + ry * p.y + rz * p.z
+                + this->b0 * p.x + this->b1 * p.y + this->b2 * p.z
+                + this->c;
+
+            return this->w == 0 ? 0 : std::fabs(r) / this->w;
+        }
+    };
+
+    // Outgoing half-edges of every vertex of a triangle list, in compressed row form.
+    class EdgeAdjacency {
+        std::vector<size_t> m_offsets;
+        std::vector<unsigned int> m_targets;
+    public:
+        void build(const unsigned int* indices, size_t num_indices, size_t num_vertices) {
+            this->m_offsets.assign(num_vertices + 1, 0);
+            this->m_targets.resize(num_indices);
+
+            for (size_t i = 0; i < num_indices; i++) {
+                this->m_offsets[indices[i] + 1]++;
+            }
+
+            for (size_t v = 0; v < num_vertices; v++) {
+                this->m_offsets[v + 1] += this->m_offsets[v];
+            }
+
+            std::vector<size_t> fill(this->m_offsets.begin(), this->m_offsets.end() - 1);
+
+            for (size_t i = 0; i < num_indices; i += 3) {
+                for (int e = 0; e < 3; e++) {
+                    unsigned int a = indices[i + e];
+                    unsigned int b = indices[i + (e + 1) % 3];
+
+                    this->m_targets[fill[a]++] = b;
+                }
+            }
+        }
+
+        bool has_edge(unsigned int a, unsigned int b) const {
+            for (size_t i = this->m_offsets[a]; i < this->m_offsets[a + 1]; i++) {
+                if (this->m_targets[i] == b) return true;
+            }
+
+            return false;
+        }
+
+        const unsigned int* begin(unsigned int v) const { return this->m_targets.data() + this->m_offsets[v]; }
+        const unsigned int* end(unsigned int v) const { return this->m_targets.data() + this->m_offsets[v + 1]; }
+    };
+
+    // Vertices that were split by the OBJ loader because of differing texture coordinates or normals
+    // share a position. remap maps each vertex to the first vertex with its position, and wedge links
+    // all vertices with the same position into a cycle.
+    static void build_position_remap(
+        const Model3DVertex* vertices,
+        size_t num_vertices,
+        std::vector<unsigned int>& remap,
+        std::vector<unsigned int>& wedge
+    ) {
+        std::vector<unsigned int> order(num_vertices);
+
+        remap.resize(num_vertices);
+        wedge.resize(num_vertices);
+
+        for (size_t v = 0; v < num_vertices; v++) {
+            order[v] = v;
+            wedge[v] = v;
+        }
+
+        auto key = [&](unsigned int v) {
+            const glm::vec3& p = vertices[v].pos;
+            uint32_t bits[3];
+
+            std::memcpy(bits, &p, sizeof(bits));
+
+            return std::make_tuple(bits[0], bits[1], bits[2]);
+        };
+
+        std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+            auto ka = key(a);
+            auto kb = key(b);
+
+            return ka < kb || (ka == kb && a < b);
+        });
+
+        for (size_t i = 0; i < num_vertices;) {
+            size_t j = i + 1;
+
+            while (j < num_vertices && key(order[j]) == key(order[i])) j++;
+
+            for (size_t k = i; k < j; k++) {
+                remap[order[k]] = order[i];
+                wedge[order[k]] = order[k + 1 < j ? k + 1 : i];
+            }
+
+            i = j;
+        }
+    }
+
+    struct SimplifyCollapse {
+        unsigned int from;
+        unsigned int to;
+        float error;
+    };
+
+    size_t simplify(
+        unsigned int* destination,
+        const unsigned int* indices,
+        size_t num_indices,
+        const Model3DVertex* vertices,
+        size_t num_vertices,
+        size_t target_index_count,
+        float target_error,
+        float* result_error
+    ) {
+        std::copy(indices, indices + num_indices, destination);
+
+        if (result_error) {
+            *result_error = 0;
+        }
+
+        if (num_indices <= target_index_count || num_vertices == 0) {
+            return num_indices;
+        }
+
+        // Work on positions normalized to the unit cube so that errors are relative to the size of
+        // the mesh.
+        glm::vec3 min(std::numeric_limits<float>::infinity());
+        glm::vec3 max(-std::numeric_limits<float>::infinity());
+
+        for (size_t v = 0; v < num_vertices; v++) {
+            min = glm::min(min, vertices[v].pos);
+            max = glm::max(max, vertices[v].pos);
+        }
+
+        float extent = std::max(max.x - min.x, std::max(max.y - min.y, max.z - min.z));
+        float inv_extent = extent > 0 ? 1 / extent : 0;
+
+        std::vector<glm::vec3> positions(num_vertices);
+
+        for (size_t v = 0; v < num_vertices; v++) {
+            positions[v] = (vertices[v].pos - min) * inv_extent;
+        }
+
+        // Find the vertices that share a position, so that seams can be detected and kept intact
+        std::vector<unsigned int> remap, wedge;
+
+        build_position_remap(vertices, num_vertices, remap, wedge);
+
+        // Classify vertices by looking for open edges, both between vertices and between positions.
+        std::vector<SimplifyVertexKind> kind(num_vertices, SimplifyVertexKind::MANIFOLD);
+
+        {
+            std::vector<unsigned int> position_indices(num_indices);
+
+            for (size_t i = 0; i < num_indices; i++) {
+                position_indices[i] = remap[indices[i]];
+            }
+
+            EdgeAdjacency edges, position_edges;
+
+            edges.build(indices, num_indices, num_vertices);
+            position_edges.build(position_indices.data(), num_indices, num_vertices);
+
+            std::vector<unsigned int> open_out(num_vertices, 0), open_in(num_vertices, 0);
+            std::vector<unsigned int> position_open_out(num_vertices, 0), position_open_in(num_vertices, 0);
+
+            for (size_t i = 0; i < num_indices; i += 3) {
+                for (int e = 0; e < 3; e++) {
+                    unsigned int a = indices[i + e];
+                    unsigned int b = indices[i + (e + 1) % 3];
+
+                    if (!edges.has_edge(b, a)) {
+                        open_out[a]++;
+                        open_in[b]++;
+                    }
+
+                    if (!position_edges.has_edge(remap[b], remap[a])) {
+                        position_open_out[remap[a]]++;
+                        position_open_in[remap[b]]++;
+                    }
+                }
+            }
+
+            for (size_t v = 0; v < num_vertices; v++) {
+                if (remap[v] != v) {
+                    continue;
+                }
+
+                SimplifyVertexKind k;
+
+                if (wedge[v] == v) {
+                    if (position_open_out[v] == 0 && position_open_in[v] == 0) {
+                        k = SimplifyVertexKind::MANIFOLD;
+                    } else if (position_open_out[v] == 1 && position_open_in[v] == 1) {
+                        k = SimplifyVertexKind::BORDER;
+                    } else {
+                        k = SimplifyVertexKind::LOCKED;
+                    }
+                } else if (wedge[wedge[v]] == v) {
+                    unsigned int w = wedge[v];
+
+                    if (position_open_out[v] == 0 && position_open_in[v] == 0
+                        && open_out[v] == 1 && open_in[v] == 1
+                        && open_out[w] == 1 && open_in[w] == 1) {
+                        k = SimplifyVertexKind::SEAM;
+                    } else {
+                        k = SimplifyVertexKind::LOCKED;
+                    }
+                } else {
+                    k = SimplifyVertexKind::LOCKED;
+                }
+
+                unsigned int w = v;
+
+                do {
+                    kind[w] = k;
+                    w = wedge[w];
+                } while (w != v);
+            }
+        }
+
+        // Every triangle contributes the quadric of its plane to its corners. Open edges also
+        // contribute a plane perpendicular to the triangle, which keeps borders from shrinking.
+        std::vector<Quadric> quadrics(num_vertices);
+
+        {
+            EdgeAdjacency position_edges;
+            std::vector<unsigned int> position_indices(num_indices);
+
+            for (size_t i = 0; i < num_indices; i++) {
+                position_indices[i] = remap[indices[i]];
+            }
+
+            position_edges.build(position_indices.data(), num_indices, num_vertices);
+
+            constexpr float border_weight = 10.0f;
+
+            for (size_t i = 0; i < num_indices; i += 3) {
+                unsigned int t[3] = { position_indices[i], position_indices[i + 1], position_indices[i + 2] };
+
+                glm::vec3 normal = glm::cross(positions[t[1]] - positions[t[0]], positions[t[2]] - positions[t[0]]);
+                float area = glm::length(normal);
+
+                if (area == 0) {
+                    continue;
+                }
+
+                normal /= area;
+
+                Quadric q = Quadric::from_plane(normal, -glm::dot(normal, positions[t[0]]), area);
+
+                for (int e = 0; e < 3; e++) {
+                    quadrics[t[e]] += q;
+                }
+
+                for (int e = 0; e < 3; e++) {
+                    unsigned int a = t[e];
+                    unsigned int b = t[(e + 1) % 3];
+
+                    if (position_edges.has_edge(b, a)) {
+                        continue;
+                    }
+
+                    glm::vec3 edge = positions[b] - positions[a];
+                    float length = glm::length(edge);
+                    glm::vec3 edge_normal = glm::cross(edge, normal);
+                    float edge_normal_length = glm::length(edge_normal);
+
+                    if (edge_normal_length == 0) {
+                        continue;
+                    }
+
+                    edge_normal /= edge_normal_length;
+
+                    Quadric eq = Quadric::from_plane(
+                        edge_normal,
+                        -glm::dot(edge_normal, positions[a]),
+                        length * length * border_weight
+                    );
+
+                    quadrics[a] += eq;
+                    quadrics[b] += eq;
+                }
+            }
+        }
+
+        size_t result_count = num_indices;
+        float max_error = 0;
+        float error_limit = target_error * target_error;
+
+        // The facing of every triangle in the original mesh. Collapses are checked against this as
+        // well as against the current facing, since many small rotations over several passes could
+        // otherwise add up to a flipped triangle.
+        std::vector<glm::vec3> triangle_normals(num_indices / 3);
+
+        for (size_t i = 0; i < num_indices; i += 3) {
+            const glm::vec3& a = positions[indices[i]];
+            const glm::vec3& b = positions[indices[i + 1]];
+            const glm::vec3& c = positions[indices[i + 2]];
+
+            glm::vec3 normal = glm::cross(b - a, c - a);
+            float length = glm::length(normal);
+
+            triangle_normals[i / 3] = length > 0 ? normal / length : glm::vec3(0);
+        }
+
+        EdgeAdjacency edges;
+        std::vector<size_t> triangle_offsets(num_vertices + 1);
+        std::vector<unsigned int> triangles;
+        std::vector<SimplifyCollapse> collapses;
+        std::vector<unsigned int> collapse_remap(num_vertices);
+        std::vector<bool> collapse_locked(num_vertices);
+
+        auto can_collapse = [&](unsigned int from, unsigned int to) {
+            switch (kind[from]) {
+            case SimplifyVertexKind::MANIFOLD:
+                return true;
+            case SimplifyVertexKind::BORDER:
+                // Only along the border itself
+                return kind[to] == SimplifyVertexKind::BORDER && edges.has_edge(from, to) != edges.has_edge(to, from);
+            case SimplifyVertexKind::SEAM:
+                // Only along the seam, and only if the other side of the seam has a matching edge
+                return kind[to] == SimplifyVertexKind::SEAM
+                    && edges.has_edge(from, to) != edges.has_edge(to, from)
+                    && (edges.has_edge(wedge[from], wedge[to]) || edges.has_edge(wedge[to], wedge[from]));
+            default:
+                return false;
+            }
+        };
+
+        // Moving a vertex must not flip any of the triangles around it that survive the collapse.
+        auto collapse_flips = [&](unsigned int from, unsigned int to) {
+            unsigned int w = from;
+
+            do {
+                for (size_t j = triangle_offsets[w]; j < triangle_offsets[w + 1]; j++) {
+                    const unsigned int* tri = destination + triangles[j] * 3;
+                    unsigned int r[3] = { remap[tri[0]], remap[tri[1]], remap[tri[2]] };
+
+                    if (r[0] == remap[to] || r[1] == remap[to] || r[2] == remap[to]) {
+                        continue;
+                    }
+
+                    glm::vec3 p[3] = { positions[r[0]], positions[r[1]], positions[r[2]] };
+                    glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+
+                    for (int k = 0; k < 3; k++) {
+                        if (r[k] == remap[from]) p[k] = positions[remap[to]];
+                    }
+
+                    glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+                    float after_length = glm::length(after);
+
+                    if (glm::dot(before, after) <= 1e-2f * glm::length(before) * after_length
+                        || glm::dot(triangle_normals[triangles[j]], after) <= 1e-2f * after_length) {
+                        return true;
+                    }
+                }
+
+                w = wedge[w];
+            } while (w != from);
+
+            return false;
+        };
+
+        while (result_count > target_index_count) {
+            edges.build(destination, result_count, num_vertices);
+
+            // Vertex -> triangle adjacency for the flip checks
+            std::fill(triangle_offsets.begin(), triangle_offsets.end(), 0);
+            triangles.resize(result_count);
+
+            for (size_t i = 0; i < result_count; i++) {
+                triangle_offsets[destination[i] + 1]++;
+            }
+
+            for (size_t v = 0; v < num_vertices; v++) {
+                triangle_offsets[v + 1] += triangle_offsets[v];
+            }
+
+            {
+                std::vector<size_t> fill(triangle_offsets.begin(), triangle_offsets.end() - 1);
+
+                for (size_t i = 0; i < result_count; i++) {
+                    triangles[fill[destination[i]]++] = i / 3;
+                }
+            }
+
+            // Collect the cheapest valid direction of every edge
+            collapses.clear();
+
+            for (size_t i = 0; i < result_count; i += 3) {
+                for (int e = 0; e < 3; e++) {
+                    unsigned int a = destination[i + e];
+                    unsigned int b = destination[i + (e + 1) % 3];
+
+                    bool a_to_b = can_collapse(a, b);
+                    bool b_to_a = can_collapse(b, a);
+
+                    float a_error = a_to_b ? quadrics[remap[a]].error(positions[b]) : 0;
+                    float b_error = b_to_a ? quadrics[remap[b]].error(positions[a]) : 0;
+
+                    if (a_to_b && (!b_to_a || a_error <= b_error)) {
+                        collapses.push_back(SimplifyCollapse { .from = a, .to = b, .error = a_error });
+                    } else if (b_to_a) {
+                        collapses.push_back(SimplifyCollapse { .from = b, .to = a, .error = b_error });
+                    }
+                }
+            }
+
+            if (collapses.empty()) {
+                break;
+            }
+
+            std::sort(collapses.begin(), collapses.end(), [](const SimplifyCollapse& a, const SimplifyCollapse& b) {
+                return a.error < b.error;
+            });
+
+            for (size_t v = 0; v < num_vertices; v++) {
+                collapse_remap[v] = v;
+            }
+
+            std::fill(collapse_locked.begin(), collapse_locked.end(), false);
+
+            // Each edge collapse removes about two triangles, or four along a seam. Don't aim to
+            // remove much more than is needed in one pass, since the error estimates of later
+            // collapses get stale as the mesh changes.
+            size_t triangle_goal = (result_count - target_index_count) / 3;
+            size_t triangles_collapsed = 0;
+            size_t num_collapsed = 0;
+
+            for (const SimplifyCollapse& c : collapses) {
+                if (c.error > error_limit) {
+                    break;
+                }
+
+                if (triangles_collapsed >= triangle_goal) {
+                    break;
+                }
+
+                unsigned int r0 = remap[c.from];
+                unsigned int r1 = remap[c.to];
+
+                if (collapse_locked[r0] || collapse_locked[r1]) {
+                    continue;
+                }
+
+                if (collapse_flips(c.from, c.to)) {
+                    continue;
+                }
+
+                if (kind[c.from] == SimplifyVertexKind::SEAM) {
+                    collapse_remap[c.from] = c.to;
+                    collapse_remap[wedge[c.from]] = wedge[c.to];
+                    triangles_collapsed += 4;
+                } else {
+                    collapse_remap[c.from] = c.to;
+                    triangles_collapsed += 2;
+                }
+
+                quadrics[r1] += quadrics[r0];
+
+                // The flip check above assumed that no other corner of the triangles around this
+                // vertex moves, so lock all of them for the rest of this pass.
+                unsigned int w = c.from;
+
+                do {
+                    for (size_t j = triangle_offsets[w]; j < triangle_offsets[w + 1]; j++) {
+                        const unsigned int* tri = destination + triangles[j] * 3;
+
+                        collapse_locked[remap[tri[0]]] = true;
+                        collapse_locked[remap[tri[1]]] = true;
+                        collapse_locked[remap[tri[2]]] = true;
+                    }
+
+                    w = wedge[w];
+                } while (w != c.from);
+
+                max_error = std::max(max_error, c.error);
+                num_collapsed++;
+            }
+
+            if (num_collapsed == 0) {
+                break;
+            }
+
+            // Apply the collapses and drop the triangles that became degenerate
+            size_t out = 0;
+
+            for (size_t i = 0; i < result_count; i += 3) {
+                unsigned int a = collapse_remap[destination[i]];
+                unsigned int b = collapse_remap[destination[i + 1]];
+                unsigned int c = collapse_remap[destination[i + 2]];
+
+                if (remap[a] == remap[b] || remap[b] == remap[c] || remap[c] == remap[a]) {
+                    continue;
+                }
+
+                triangle_normals[out / 3] = triangle_normals[i / 3];
+
+                destination[out++] = a;
+                destination[out++] = b;
+                destination[out++] = c;
+            }
+
+            result_count = out;
+        }
+
+        if (result_error) {
+            *result_error = std::sqrt(max_error);
+        }
+
+        return result_count;
+    }
+
+    static Meshlet compute_meshlet_bounds(
+        const unsigned int* indices,
+        size_t begin,
+        size_t end,
+        size_t first_index,
+        const Model3DVertex* vertices,
+        bool closed
+    ) {
+        glm::vec3 min(std::numeric_limits<float>::infinity());
+        glm::vec3 max(-std::numeric_limits<float>::infinity());
+
+        for (size_t i = begin; i < end; i++) {
+            min = glm::min(min, vertices[indices[i]].pos);
+            max = glm::max(max, vertices[indices[i]].pos);
+        }
+
+        glm::vec3 center = (min + max) / 2.0f;
+        float radius = 0;
+
+        for (size_t i = begin; i < end; i++) {
+            radius = std::max(radius, glm::distance(center, vertices[indices[i]].pos));
+        }
+
+        // The winding only says which side of a triangle is the outside if the file winds its faces
+        // counter-clockwise, so it's checked against the vertex normals. A meshlet whose faces are
+        // all wound the other way just has its normals flipped, but one where the two disagree
+        // for some faces and not others can't be trusted to face any particular way.
+        size_t num_agreeing = 0;
+        size_t num_disagreeing = 0;
+
+        for (size_t i = begin; i < end; i += 3) {
+            const Model3DVertex& a = vertices[indices[i]];
+            const Model3DVertex& b = vertices[indices[i + 1]];
+            const Model3DVertex& c = vertices[indices[i + 2]];
+
+            float facing = glm::dot(glm::cross(b.pos - a.pos, c.pos - a.pos), a.norm + b.norm + c.norm);
+
+            if (facing > 0) {
+                num_agreeing++;
+            } else if (facing < 0) {
+                num_disagreeing++;
+            }
+        }
+
+        bool oriented = num_agreeing == 0 || num_disagreeing == 0;
+        float winding = num_disagreeing > 0 ? -1.0f : 1.0f;
+
+        auto triangle_normal = [&](size_t i) {
+            const glm::vec3& a = vertices[indices[i]].pos;
+            const glm::vec3& b = vertices[indices[i + 1]].pos;
+            const glm::vec3& c = vertices[indices[i + 2]].pos;
+
+            glm::vec3 n = glm::cross(b - a, c - a) * winding;
+            float length = glm::length(n);
+
+            return length > 0 ? n / length : glm::vec3(0);
+        };
+
+        glm::vec3 axis(0);
+
+        for (size_t i = begin; i < end; i += 3) {
+            axis += triangle_normal(i);
+        }
+
+        float axis_length = glm::length(axis);
+        float cutoff = 1;
+
+        if (closed && oriented && axis_length > 0) {
+            axis /= axis_length;
+
+            float min_dot = 1;
+
+            for (size_t i = begin; i < end; i += 3) {
+                min_dot = std::min(min_dot, glm::dot(triangle_normal(i), axis));
+            }
+
+            // The triangles all face away from the camera once the view direction is within
+            // 90 degrees of every normal, i.e. within asin(cutoff) of the axis. Cones wider than about
+            // 84 degrees leave almost no such directions, so they aren't worth testing.
+            if (min_dot > 0.1f) {
+                cutoff = std::sqrt(1 - min_dot * min_dot);
+            }
+        } else {
+            axis = glm::vec3(0);
+        }
+
+        return Meshlet {
+            .center = center,
+            .radius = radius,
+            .cone_axis = axis,
+            .cone_cutoff = cutoff,
+            .first_index = static_cast<uint32_t>(first_index + begin),
+            .num_indices = static_cast<uint32_t>(end - begin)
+        };
+    }
+
+    void build_meshlets(
+        std::vector<Meshlet>& meshlets,
+        const unsigned int* indices,
+        size_t first_index,
+        size_t num_indices,
+        const Model3DVertex* vertices,
+        size_t num_vertices,
+        size_t max_vertices,
+        size_t max_triangles
+    ) {
+        if (num_indices == 0) {
+            return;
+        }
+
+        // The surface is closed if every edge has a matching edge in the opposite direction. Edges
+        // are compared by position, since texture and normal seams split the vertices along them.
+        bool closed = true;
+
+        {
+            std::vector<unsigned int> remap, wedge;
+
+            build_position_remap(vertices, num_vertices, remap, wedge);
+
+            std::vector<unsigned int> position_indices(num_indices);
+
+            for (size_t i = 0; i < num_indices; i++) {
+                position_indices[i] = remap[indices[i]];
+            }
+
+            EdgeAdjacency edges;
+
+            edges.build(position_indices.data(), num_indices, num_vertices);
+
+            for (size_t i = 0; i < num_indices && closed; i += 3) {
+                for (int e = 0; e < 3; e++) {
+                    unsigned int a = position_indices[i + e];
+                    unsigned int b = position_indices[i + (e + 1) % 3];
+
+                    if (!edges.has_edge(b, a)) {
+                        closed = false;
+                        break;
+                    }
+                }
+            }
+        }
+
+        // used[v] is the number of the meshlet that last used vertex v
+        std::vector<size_t> used(num_vertices, std::numeric_limits<size_t>::max());
+        size_t meshlet = 0;
+        size_t meshlet_vertices = 0;
+        size_t start = 0;
+
+        for (size_t i = 0; i < num_indices; i += 3) {
+            size_t new_vertices = 0;
+
+            for (int c = 0; c < 3; c++) {
+                if (used[indices[i + c]] != meshlet) new_vertices++;
+            }
+
+            if (meshlet_vertices + new_vertices > max_vertices || (i - start) / 3 >= max_triangles) {
+                meshlets.push_back(compute_meshlet_bounds(indices, start, i, first_index, vertices, closed));
+
+                meshlet++;
+                meshlet_vertices = 0;
+                start = i;
+            }
+
+            for (int c = 0; c < 3; c++) {
+                if (used[indices[i + c]] != meshlet) {
+                    used[indices[i + c]] = meshlet;
+                    meshlet_vertices++;
+                }
+            }
+        }
+
+        meshlets.push_back(compute_meshlet_bounds(indices, start, num_indices, first_index, vertices, closed));
+    }
+}
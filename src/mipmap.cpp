@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "assetloader.hpp"
+#include "mipmap.hpp"
+
+namespace hw3 {
+    // Levels with fewer rows than this per thread are filtered on the calling thread
+    static constexpr int min_rows_per_thread = 32;
+
+    // The Kaiser filter covers 1.5 texels of the smaller level on either side of each texel
+    static constexpr float kaiser_half_width = 1.5f;
+    static constexpr float kaiser_alpha = 4.0f;
+
+    static const float pi = 3.14159265358979f;
+
+    static constexpr int srgb_buckets = 4096;
+
+    struct SrgbTables {
+        float to_linear[256];
+
+        // The linear value halfway between each pair of consecutive sRGB values, for rounding
+        // linear values back to the nearest sRGB value
+        float thresholds[255];
+
+        // The smallest sRGB value for each bucket of linear values, so that rounding only has to
+        // check a few thresholds
+        uint8_t buckets[srgb_buckets + 1];
+
+        SrgbTables() {
+            for (int i = 0; i < 256; i++) {
+                float c = i / 255.0f;
+
+                to_linear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+
+            for (int i = 0; i < 255; i++) {
+                thresholds[i] = (to_linear[i] + to_linear[i + 1]) / 2;
+            }
+
+            for (int i = 0; i <= srgb_buckets; i++) {
+                float value = static_cast<float>(i) / srgb_buckets;
+
+                buckets[i] = static_cast<uint8_t>(std::upper_bound(thresholds, thresholds + 255, value) - thresholds);
+            }
+        }
+    };
+
+    static const SrgbTables srgb_tables;
+
+    static uint8_t linear_to_srgb(float value) {
+        if (!(value > 0)) {
+            return 0;
+        } else if (value >= 1) {
+            return 255;
+        }
+
+        int result = srgb_tables.buckets[static_cast<int>(value * srgb_buckets)];
+
+        while (result < 255 && value >= srgb_tables.thresholds[result]) {
+            result++;
+        }
+
+        return static_cast<uint8_t>(result);
+    }
+
+    static uint8_t linear_to_unorm(float value) {
+        return static_cast<uint8_t>(std::min(std::max(value, 0.0f), 1.0f) * 255 + 0.5f);
+    }
+
+    // Runs fn(begin, end) over ranges of rows, spread over the available worker threads for large
+    // images
+    template <typename F>
+    static void for_each_row_range(int rows, F fn) {
+        int num_threads = std::max(1, std::min(
+            static_cast<int>(AssetLoader::worker_threads()),
+            rows / min_rows_per_thread
+        ));
+        std::vector<std::thread> threads;
+
+        for (int i = 1; i < num_threads; i++) {
+            threads.emplace_back(fn, rows * i / num_threads, rows * (i + 1) / num_threads);
+        }
+
+        fn(0, rows / num_threads);
+
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+    // The zeroth-order modified Bessel function of the first kind, which shapes the Kaiser window
+    static float bessel_i0(float x) {
+        float sum = 1;
+        float term = 1;
+
+        for (int k = 1; k < 20; k++) {
+            term *= (x / (2 * k)) * (x / (2 * k));
+            sum += term;
+        }
+
+        return sum;
+    }
+
+    static float kaiser(float t) {
+        float x = t / kaiser_half_width;
+
+        if (std::abs(x) >= 1) {
+            return 0;
+        }
+
+        float sinc = t == 0 ? 1 : std::sin(pi * t) / (pi * t);
+
+        return sinc * bessel_i0(kaiser_alpha * std::sqrt(1 - x * x)) / bessel_i0(kaiser_alpha);
+    }
+
+    /*
+     * The taps that produce each texel of one axis of the smaller level: taps source indices
+     * (clamped to the edge of the image) and normalized weights per texel.
+     */
+    struct AxisFilter {
+        int taps;
+        std::vector<int> indices;
+        std::vector<float> weights;
+    };
+
+    static AxisFilter make_axis_filter(int src_size, int dst_size, MipmapFilter filter) {
+        float ratio = static_cast<float>(src_size) / dst_size;
+        float support = filter == MipmapFilter::KAISER ? kaiser_half_width * ratio : ratio / 2;
+
+        AxisFilter result;
+
+        result.taps = static_cast<int>(std::ceil(support * 2)) + 1;
+        result.indices.resize(static_cast<size_t>(result.taps) * dst_size);
+        result.weights.resize(static_cast<size_t>(result.taps) * dst_size);
+
+        for (int x = 0; x < dst_size; x++) {
+            float center = (x + 0.5f) * ratio;
+            int first = static_cast<int>(std::floor(center - support));
+            float total = 0;
+
+            for (int i = 0; i < result.taps; i++) {
+                int s = first + i;
+                float weight;
+
+                if (filter == MipmapFilter::KAISER) {
+                    weight = kaiser((s + 0.5f - center) / ratio);
+                } else {
+                    // The part of the source texel covered by the box of the smaller texel
+                    weight = std::max(
+                        std::min(static_cast<float>(s + 1), center + support)
+                            - std::max(static_cast<float>(s), center - support),
+                        0.0f
+                    );
+                }
+
+                result.indices[x * result.taps + i] = std::min(std::max(s, 0), src_size - 1);
+                result.weights[x * result.taps + i] = weight;
+                total += weight;
+            }
+
+            for (int i = 0; i < result.taps; i++) {
+                result.weights[x * result.taps + i] /= total;
+            }
+        }
+
+        return result;
+    }
+
+    // dst[i] += weight * src[i] for each channel of one texel
+    static inline void accumulate(float* dst, const float* src, float weight, size_t channels) {
+#ifdef __SSE2__
+        if (channels == 4) {
+            _mm_storeu_ps(dst, _mm_add_ps(
+                _mm_loadu_ps(dst),
+                _mm_mul_ps(_mm_set1_ps(weight), _mm_loadu_ps(src))
+            ));
+            return;
+        }
+#endif
+
+        for (size_t c = 0; c < channels; c++) {
+            dst[c] += weight * src[c];
+        }
+    }
+
+    // Filters a level down to the next smaller one, separably: first along rows, then along columns
+    static std::vector<float> downsample(
+        const std::vector<float>& src,
+        int width,
+        int height,
+        size_t channels,
+        MipmapFilter filter
+    ) {
+        int dst_width = std::max(width / 2, 1);
+        int dst_height = std::max(height / 2, 1);
+
+        AxisFilter x_filter = make_axis_filter(width, dst_width, filter);
+        AxisFilter y_filter = make_axis_filter(height, dst_height, filter);
+
+        std::vector<float> rows(static_cast<size_t>(dst_width) * height * channels, 0.0f);
+        std::vector<float> dst(static_cast<size_t>(dst_width) * dst_height * channels, 0.0f);
+
+        for_each_row_range(height, [&](int begin, int end) {
+            for (int y = begin; y < end; y++) {
+                const float* src_row = src.data() + static_cast<size_t>(y) * width * channels;
+                float* dst_row = rows.data() + static_cast<size_t>(y) * dst_width * channels;
+
+                for (int x = 0; x < dst_width; x++) {
+                    for (int i = 0; i < x_filter.taps; i++) {
+                        accumulate(
+                            dst_row + x * channels,
+                            src_row + x_filter.indices[x * x_filter.taps + i] * channels,
+                            x_filter.weights[x * x_filter.taps + i],
+                            channels
+                        );
+                    }
+                }
+            }
+        });
+
+        for_each_row_range(dst_height, [&](int begin, int end) {
+            size_t row_size = static_cast<size_t>(dst_width) * channels;
+
+            for (int y = begin; y < end; y++) {
+                float* dst_row = dst.data() + y * row_size;
+
+                for (int i = 0; i < y_filter.taps; i++) {
+                    const float* src_row = rows.data() + y_filter.indices[y * y_filter.taps + i] * row_size;
+                    float weight = y_filter.weights[y * y_filter.taps + i];
+
+                    for (size_t j = 0; j < row_size; j += channels) {
+                        accumulate(dst_row + j, src_row + j, weight, channels);
+                    }
+                }
+            }
+        });
+
+        return dst;
+    }
+
+    std::vector<std::vector<char>> build_mipmaps(
+        const char* pixels,
+        int width,
+        int height,
+        TextureDataFormat format,
+        MipmapFilter filter
+    ) {
+        size_t channels = texture_pixel_size(format);
+        bool srgb = format == TextureDataFormat::SRGBA;
+
+        // Alpha is always linear, even in sRGB images
+        auto is_srgb_channel = [&](size_t c) {
+            return srgb && c < 3;
+        };
+
+        const uint8_t* src = reinterpret_cast<const uint8_t*>(pixels);
+        std::vector<float> level(static_cast<size_t>(width) * height * channels);
+
+        for (size_t i = 0; i < level.size(); i += channels) {
+            for (size_t c = 0; c < channels; c++) {
+                level[i + c] = is_srgb_channel(c) ? srgb_tables.to_linear[src[i + c]] : src[i + c] / 255.0f;
+            }
+        }
+
+        std::vector<std::vector<char>> mipmaps;
+
+        while (width > 1 || height > 1) {
+            level = downsample(level, width, height, channels, filter);
+            width = std::max(width / 2, 1);
+            height = std::max(height / 2, 1);
+
+            std::vector<char> mipmap(level.size());
+            uint8_t* dst = reinterpret_cast<uint8_t*>(mipmap.data());
+
+            for (size_t i = 0; i < level.size(); i += channels) {
+                for (size_t c = 0; c < channels; c++) {
+                    dst[i + c] = is_srgb_channel(c) ? linear_to_srgb(level[i + c]) : linear_to_unorm(level[i + c]);
+                }
+            }
+
+            mipmaps.push_back(std::move(mipmap));
+        }
+
+        return mipmaps;
+    }
+}
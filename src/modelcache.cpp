@@ -0,0 +1,248 @@
+#include <cstdint>
+#include <cstring>
+
+#include "cachefile.hpp"
+#include "objmodel.hpp"
+
+namespace hw3 {
+    // Bump this whenever the layout of the cache file, Model3DVertex or Meshlet changes.
+    static constexpr uint32_t model_cache_version = 4;
+    static const char model_cache_magic[8] = { 'H', 'W', '3', 'M', 'D', 'L', '\0', '\0' };
+
+    /*
+     * A model cache file consists of this header, followed by:
+     *
+     * - The canonical path of the source OBJ file, padded to a multiple of 8 bytes
+     * - The size of each sub-object in each LOD (uint64_t[num_lods * num_sub_objects])
+     * - The error of each LOD (float[num_lods]), padded to a multiple of 8 bytes
+     * - The meshlets of all index lists (Meshlet[num_meshlets])
+     * - The vertex array (Model3DVertex[num_vertices])
+     * - The index lists of all LODs and sub-objects, back to back (uint32_t[num_indices])
+     */
+    struct ModelCacheHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t vertex_size;
+
+        uint64_t source_size;
+        int64_t source_mtime_sec;
+        int64_t source_mtime_nsec;
+
+        uint32_t optimize_level;
+        uint32_t max_lods;
+
+        uint64_t path_length;
+        uint64_t num_lods;
+        uint64_t num_sub_objects;
+        uint64_t num_meshlets;
+        uint64_t num_vertices;
+        uint64_t num_indices;
+
+        float bounding_box_min[3];
+        float bounding_box_max[3];
+    };
+
+    static_assert(sizeof(ModelCacheHeader) % 8 == 0, "Model cache header must be 8-byte aligned");
+
+    static boost::filesystem::path cache_path(const boost::filesystem::path& path) {
+        return boost::filesystem::path(path.native() + ".hw3mdl");
+    }
+
+    static size_t padded_errors_size(size_t num_lods) {
+        return (num_lods * sizeof(float) + 7) & ~static_cast<size_t>(7);
+    }
+
+    // Fills in the fields of the header that identify the source file and the options it was
+    // loaded with. Returns false if there's nothing to cache the model against.
+    static bool fill_source_info(
+        const boost::filesystem::path& path,
+        const Model3DLoadOptions& options,
+        ModelCacheHeader& header,
+        std::string& canonical
+    ) {
+        CacheSource source;
+
+        if (!cache_source_info(path, source)) {
+            return false;
+        }
+
+        canonical = std::move(source.canonical_path);
+
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, model_cache_magic, sizeof(header.magic));
+
+        header.version = model_cache_version;
+        header.vertex_size = sizeof(Model3DVertex);
+
+        header.source_size = source.size;
+        header.source_mtime_sec = source.mtime_sec;
+        header.source_mtime_nsec = source.mtime_nsec;
+
+        header.optimize_level = static_cast<uint32_t>(options.optimize);
+        header.max_lods = static_cast<uint32_t>(options.max_lods);
+
+        header.path_length = canonical.size();
+
+        return true;
+    }
+
+    bool Model3DData::load_cache(
+        const boost::filesystem::path& path,
+        const Model3DLoadOptions& options,
+        Model3DData& data
+    ) {
+        ModelCacheHeader expected;
+        std::string canonical;
+
+        if (!fill_source_info(path, options, expected, canonical)) {
+            return false;
+        }
+
+        MappedFile f;
+
+        try {
+            f = MappedFile(cache_path(path));
+        } catch (std::runtime_error& e) {
+            return false;
+        }
+
+        if (f.size() < sizeof(ModelCacheHeader)) {
+            return false;
+        }
+
+        ModelCacheHeader header;
+        std::memcpy(&header, f.data(), sizeof(header));
+
+        if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+            || header.version != expected.version
+            || header.vertex_size != expected.vertex_size
+            || header.source_size != expected.source_size
+            || header.source_mtime_sec != expected.source_mtime_sec
+            || header.source_mtime_nsec != expected.source_mtime_nsec
+            || header.optimize_level != expected.optimize_level
+            || header.max_lods != expected.max_lods
+            || header.path_length != expected.path_length) {
+            return false;
+        }
+
+        // Guard against overflow below if the file is corrupt. Every count must fit in the file.
+        if (header.num_lods == 0 || header.num_lods > f.size() || header.num_sub_objects > f.size()
+            || header.num_meshlets > f.size() || header.num_vertices > f.size()
+            || header.num_indices > f.size()
+            || header.num_lods * header.num_sub_objects > f.size()) {
+            return false;
+        }
+
+        size_t num_sizes = header.num_lods * header.num_sub_objects;
+
+        size_t path_offset = sizeof(ModelCacheHeader);
+        size_t sizes_offset = path_offset + cache_padded_path_length(header.path_length);
+        size_t errors_offset = sizes_offset + num_sizes * sizeof(uint64_t);
+        size_t meshlets_offset = errors_offset + padded_errors_size(header.num_lods);
+        size_t vertices_offset = meshlets_offset + header.num_meshlets * sizeof(Meshlet);
+        size_t indices_offset = vertices_offset + header.num_vertices * sizeof(Model3DVertex);
+        size_t total_size = indices_offset + header.num_indices * sizeof(uint32_t);
+
+        if (f.size() != total_size
+            || std::memcmp(f.data() + path_offset, canonical.data(), canonical.size()) != 0) {
+            return false;
+        }
+
+        const uint64_t* sizes = reinterpret_cast<const uint64_t*>(f.data() + sizes_offset);
+        std::vector<size_t> sub_object_sizes(sizes, sizes + num_sizes);
+
+        const float* errors = reinterpret_cast<const float*>(f.data() + errors_offset);
+        std::vector<float> lod_errors(errors, errors + header.num_lods);
+        size_t num_indices = 0;
+
+        for (size_t size : sub_object_sizes) {
+            num_indices += size;
+        }
+
+        if (num_indices != header.num_indices) {
+            return false;
+        }
+
+        const Meshlet* meshlets = reinterpret_cast<const Meshlet*>(f.data() + meshlets_offset);
+
+        for (size_t i = 0; i < header.num_meshlets; i++) {
+            if (static_cast<uint64_t>(meshlets[i].first_index) + meshlets[i].num_indices > num_indices) {
+                return false;
+            }
+        }
+
+        Model3DData result;
+
+        result.m_vertices = reinterpret_cast<const Model3DVertex*>(f.data() + vertices_offset);
+        result.m_num_vertices = header.num_vertices;
+
+        result.m_indices = reinterpret_cast<const unsigned int*>(f.data() + indices_offset);
+        result.m_num_indices = header.num_indices;
+
+        result.m_sub_object_sizes = std::move(sub_object_sizes);
+        result.m_num_sub_objects = header.num_sub_objects;
+        result.m_lod_errors = std::move(lod_errors);
+
+        result.m_meshlets = meshlets;
+        result.m_num_meshlets = header.num_meshlets;
+        result.m_bounding_box = AABB(
+            glm::vec3(header.bounding_box_min[0], header.bounding_box_min[1], header.bounding_box_min[2]),
+            glm::vec3(header.bounding_box_max[0], header.bounding_box_max[1], header.bounding_box_max[2])
+        );
+
+        result.m_file = std::move(f);
+        data = std::move(result);
+
+        return true;
+    }
+
+    void Model3DData::write_cache(const boost::filesystem::path& path, const Model3DLoadOptions& options) const {
+        ModelCacheHeader header;
+        std::string canonical;
+
+        if (!fill_source_info(path, options, header, canonical)) {
+            return;
+        }
+
+        header.num_lods = this->m_lod_errors.size();
+        header.num_sub_objects = this->m_num_sub_objects;
+        header.num_meshlets = this->m_num_meshlets;
+        header.num_vertices = this->m_num_vertices;
+        header.num_indices = this->m_num_indices;
+
+        header.bounding_box_min[0] = this->m_bounding_box.min().x;
+        header.bounding_box_min[1] = this->m_bounding_box.min().y;
+        header.bounding_box_min[2] = this->m_bounding_box.min().z;
+
+        header.bounding_box_max[0] = this->m_bounding_box.max().x;
+        header.bounding_box_max[1] = this->m_bounding_box.max().y;
+        header.bounding_box_max[2] = this->m_bounding_box.max().z;
+
+        std::vector<uint64_t> sizes(this->m_sub_object_sizes.begin(), this->m_sub_object_sizes.end());
+        std::vector<float> errors(this->m_lod_errors.begin(), this->m_lod_errors.end());
+
+        errors.resize(padded_errors_size(errors.size()) / sizeof(float), 0.0f);
+        std::string padded_path = canonical;
+
+        padded_path.resize(cache_padded_path_length(canonical.size()), '\0');
+
+        write_cache_file(cache_path(path), "model", [&](std::ostream& f) {
+            f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            f.write(padded_path.data(), padded_path.size());
+            f.write(reinterpret_cast<const char*>(sizes.data()), sizes.size() * sizeof(uint64_t));
+            f.write(reinterpret_cast<const char*>(errors.data()), errors.size() * sizeof(float));
+            f.write(
+                reinterpret_cast<const char*>(this->m_meshlets),
+                this->m_num_meshlets * sizeof(Meshlet)
+            );
+            f.write(
+                reinterpret_cast<const char*>(this->m_vertices),
+                this->m_num_vertices * sizeof(Model3DVertex)
+            );
+            f.write(
+                reinterpret_cast<const char*>(this->m_indices),
+                this->m_num_indices * sizeof(unsigned int)
+            );
+        });
+    }
+}
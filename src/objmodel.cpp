@@ -1,14 +1,29 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <exception>
 #include <limits>
 #include <map>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
+#include <tuple>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
-#include <boost/algorithm/string.hpp>
-#include <boost/filesystem/fstream.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "assetloader.hpp"
+#include "mappedfile.hpp"
+#include "meshoptimize.hpp"
 #include "objmodel.hpp"
 #include "shaderimpl.hpp"
+#include "textparse.hpp"
 
 namespace hw3 {
     static GlVertexArray box_va;
@@ -64,10 +79,10 @@ namespace hw3 {
 
     void AABB::draw(const glm::mat4& transform, glm::vec4 colour) const {
         shaders::fixed_program.set_uniform(
-            "vertex_transform",
+            shaders::uniforms::vertex_transform,
             transform * glm::scale(glm::translate(glm::mat4(1), this->m_min), this->size())
         );
-        shaders::fixed_program.set_uniform("fixed_color", colour);
+        shaders::fixed_program.set_uniform(shaders::uniforms::fixed_color, colour);
         shaders::fixed_program.use();
 
         const auto& geometry = AABB::box_geometry();
@@ -108,245 +123,458 @@ namespace hw3 {
         return AABB(min, max);
     }
 
-    Material Material::without_maps() const {
-        return Material {
-            .ambient = this->ambient,
-            .ambient_occlusion_map = Sampler2D::single_pixel(),
-
-            .diffuse = this->diffuse,
-            .diffuse_map = Sampler2D::single_pixel(),
+    // Index triple for a single face corner, with all indices already resolved to 0-based offsets
+    // into the file's position, texture coordinate and normal lists.
+    struct ObjVertexRef {
+        unsigned int pos;
+        unsigned int tex;
+        unsigned int norm;
+    };
 
-            .specular = this->specular,
-            .specular_map = Sampler2D::single_pixel(),
+    /*
+     * A line-aligned piece of an OBJ file that can be parsed independently of the others. Parsing
+     * happens in two passes: the first only counts the v/vt/vn records in each chunk, which tells
+     * every chunk how many records precede it. The second pass then parses the records straight
+     * into their final place in the shared arrays and resolves every face index (including relative
+     * ones) to an absolute index, exactly as a serial parse would have at that point in the file.
+     */
+    struct ObjChunk {
+        const char* begin;
+        const char* end;
+
+        size_t num_pos = 0;
+        size_t num_tex = 0;
+        size_t num_norm = 0;
+
+        size_t pos_base = 0;
+        size_t tex_base = 0;
+        size_t norm_base = 0;
+
+        std::vector<ObjVertexRef> refs;
+        std::exception_ptr error;
+
+        void count();
+        void parse(std::vector<glm::vec3>& pos, std::vector<glm::vec2>& tex, std::vector<glm::vec3>& norm);
+    };
 
-            .shininess = this->shininess
+    /*
+     * Open-addressing hash table mapping a face corner's (pos, tex, norm) triple to the index of
+     * the deduplicated vertex it produced. Keys and values are stored inline in a single flat array
+     * and probed linearly, so a lookup normally touches one cache line and never allocates.
+     */
+    class VertexIndexTable {
+        static constexpr unsigned int empty = std::numeric_limits<unsigned int>::max();
+
+        struct Slot {
+            ObjVertexRef key;
+            unsigned int value;
         };
-    }
 
-    Material Material::without_ao() const {
-        return Material {
-            .ambient = this->ambient,
-            .ambient_occlusion_map = Sampler2D::single_pixel(),
+        std::vector<Slot> m_slots;
+        size_t m_mask = 0;
+        size_t m_size = 0;
 
-            .diffuse = this->diffuse,
-            .diffuse_map = this->diffuse_map,
+        static size_t hash(const ObjVertexRef& key) {
+            uint64_t h = (static_cast<uint64_t>(key.pos) * UINT64_C(0x9e3779b97f4a7c15))
+                ^ (static_cast<uint64_t>(key.tex) * UINT64_C(0xc2b2ae3d27d4eb4f))
+                ^ (static_cast<uint64_t>(key.norm) * UINT64_C(0x165667b19e3779f9));
 
-            .specular = this->specular,
-            .specular_map = this->specular_map,
+            return static_cast<size_t>(h ^ (h >> 29));
+        }
 
-            .shininess = this->shininess
-        };
-    }
+        void rehash(size_t capacity) {
+            std::vector<Slot> old_slots(capacity, Slot { .key = {}, .value = empty });
 
-    void ShaderProgram::uniform_setter<Material>::operator ()(
-        ShaderProgram& program, std::string name, const Material& value
-    ) {
-        program.set_uniform(name + ".ambient", value.ambient);
-        program.set_uniform(name + ".ambient_occlusion_map", value.ambient_occlusion_map.get());
+            old_slots.swap(this->m_slots);
+            this->m_mask = capacity - 1;
 
-        program.set_uniform(name + ".diffuse", value.diffuse);
-        program.set_uniform(name + ".diffuse_map", value.diffuse_map.get());
+            for (const auto& slot : old_slots) {
+                if (slot.value != empty) {
+                    size_t i = hash(slot.key) & this->m_mask;
 
-        program.set_uniform(name + ".specular", value.specular);
-        program.set_uniform(name + ".specular_map", value.specular_map.get());
+                    while (this->m_slots[i].value != empty) i = (i + 1) & this->m_mask;
 
-        program.set_uniform(name + ".shininess", value.shininess);
-    }
+                    this->m_slots[i] = slot;
+                }
+            }
+        }
+    public:
+        // Sizes the table for the given number of entries at a load factor of at most 3/4.
+        void reserve(size_t n) {
+            size_t capacity = 16;
+
+            while (capacity * 3 / 4 < n) capacity *= 2;
+
+            if (capacity > this->m_slots.size()) {
+                this->rehash(capacity);
+            }
+        }
+
+        size_t size() const { return this->m_size; }
 
-    struct Model3DVertex {
-        glm::vec3 pos;
-        glm::vec2 tex;
-        glm::vec3 norm;
+        // Returns the value stored for key, inserting value if the key is not yet present.
+        unsigned int find_or_insert(const ObjVertexRef& key, unsigned int value) {
+            if ((this->m_size + 1) * 4 > this->m_slots.size() * 3) {
+                this->rehash(std::max<size_t>(16, this->m_slots.size() * 2));
+            }
+
+            size_t i = hash(key) & this->m_mask;
+
+            while (true) {
+                Slot& slot = this->m_slots[i];
+
+                if (slot.value == empty) {
+                    slot.key = key;
+                    slot.value = value;
+                    this->m_size++;
+
+                    return value;
+                } else if (slot.key.pos == key.pos && slot.key.tex == key.tex
+                           && slot.key.norm == key.norm) {
+                    return slot.value;
+                }
+
+                i = (i + 1) & this->m_mask;
+            }
+        }
     };
 
     class Model3DLoader {
-        Model3D* m_model;
+        // Files smaller than this are always parsed on the calling thread, since starting threads
+        // would cost more than it saves.
+        static constexpr size_t min_chunk_size = 1 << 20;
 
         std::vector<glm::vec3> m_pos;
         std::vector<glm::vec2> m_tex;
         std::vector<glm::vec3> m_norm;
 
         std::vector<Model3DVertex> m_vertices;
-        std::map<std::tuple<unsigned int, unsigned int, unsigned int>, unsigned int> m_vertex_indices;
+        VertexIndexTable m_vertex_indices;
 
-        std::vector<unsigned int> m_current_vertices;
+        std::vector<unsigned int> m_indices;
+        std::vector<size_t> m_sub_object_sizes;
+        size_t m_sub_object_start = 0;
 
         void emit_subobject();
-        unsigned int add_vertex(unsigned int pos, unsigned int tex, unsigned int norm);
-        unsigned int add_vertex(std::string spec);
+        unsigned int add_vertex(const ObjVertexRef& ref);
     public:
-        Model3DLoader(Model3D* model) : m_model(model) {}
+        Model3DLoader() {}
         Model3DLoader(const Model3DLoader& other) = delete;
 
         Model3DLoader& operator =(const Model3DLoader& other) = delete;
 
-        void handle_line(std::string line);
-        void finish();
+        void load(const char* begin, const char* end);
+        Model3DData finish();
     };
 
     void Model3DLoader::emit_subobject() {
-        if (this->m_current_vertices.size() > 0) {
-            ModelSubObject3D subobj;
-
-            subobj.index_buffer.load_data(this->m_current_vertices, GL_STATIC_DRAW);
-            subobj.num_indices = this->m_current_vertices.size();
-            this->m_current_vertices.clear();
-
-            this->m_model->m_sub_objects.push_back(std::move(subobj));
+        if (this->m_indices.size() > this->m_sub_object_start) {
+            this->m_sub_object_sizes.push_back(this->m_indices.size() - this->m_sub_object_start);
+            this->m_sub_object_start = this->m_indices.size();
         }
     }
 
-    unsigned int Model3DLoader::add_vertex(unsigned int pos, unsigned int tex, unsigned int norm) {
-        auto t = std::make_tuple(pos, tex, norm);
-        auto existing_entry = this->m_vertex_indices.find(t);
+    unsigned int Model3DLoader::add_vertex(const ObjVertexRef& ref) {
+        unsigned int index = this->m_vertex_indices.find_or_insert(ref, this->m_vertices.size());
 
-        if (existing_entry != this->m_vertex_indices.end()) {
-            return existing_entry->second;
+        if (index == this->m_vertices.size()) {
+            this->m_vertices.push_back(Model3DVertex {
+                .pos = this->m_pos[ref.pos],
+                .tex = this->m_tex[ref.tex],
+                .norm = this->m_norm[ref.norm]
+            });
         }
 
-        if (pos >= this->m_pos.size() || tex >= this->m_tex.size() || norm >= this->m_norm.size()) {
+        return index;
+    }
+
+    static unsigned int resolve_index(int index, size_t count) {
+        if (index < 0) {
+            index += count + 1;
+
+            if (index <= 0) {
+                throw std::out_of_range("Negative index out of range");
+            }
+        } else if (index == 0) {
+            throw std::out_of_range("0 is not a valid index");
+        } else if (static_cast<size_t>(index) > count) {
             throw std::runtime_error("Face vertex index out of range");
         }
 
-        this->m_vertices.push_back(Model3DVertex {
-            .pos = this->m_pos[pos],
-            .tex = this->m_tex[tex],
-            .norm = this->m_norm[norm]
-        });
-        this->m_vertex_indices.emplace(t, this->m_vertices.size() - 1);
+        return static_cast<unsigned int>(index - 1);
+    }
 
-        return this->m_vertices.size() - 1;
+    static glm::vec3 parse_vec3(const TextToken* tokens) {
+        return glm::vec3(
+            parse_float(tokens[0]),
+            parse_float(tokens[1]),
+            parse_float(tokens[2])
+        );
     }
 
-    unsigned int Model3DLoader::add_vertex(std::string spec) {
-        std::vector<std::string> parts;
+    static glm::vec2 parse_vec2(const TextToken* tokens) {
+        return glm::vec2(
+            parse_float(tokens[0]),
+            parse_float(tokens[1])
+        );
+    }
 
-        boost::split(parts, spec, boost::is_any_of("/"));
+    static const char* strip_comment(const char* begin, const char* end) {
+        const char* comment = static_cast<const char*>(std::memchr(begin, '#', end - begin));
 
-        if (parts.size() != 3) {
-            throw std::runtime_error(([&]() {
-                std::ostringstream ss;
+        return comment != nullptr ? comment : end;
+    }
 
-                ss << "Invalid face vertex specification \"" << spec << "\"";
+    void ObjChunk::count() {
+        LineReader lines(this->begin, this->end);
+        TextToken line;
 
-                return ss.str();
-            })());
-        }
+        while (lines.next(line)) {
+            TextToken cmd;
 
-        int pos = std::stoi(parts[0]);
-        if (pos < 0) {
-            pos += this->m_pos.size() + 1;
+            if (split_tokens(line.begin, strip_comment(line.begin, line.end), &cmd, 1) == 0) {
+                continue;
+            }
 
-            if (pos <= 0) {
-                throw std::out_of_range("Negative index out of range");
+            if (cmd == "v") {
+                this->num_pos++;
+            } else if (cmd == "vt") {
+                this->num_tex++;
+            } else if (cmd == "vn") {
+                this->num_norm++;
             }
-        } else if (pos == 0) {
-            throw std::out_of_range("0 is not a valid index");
         }
+    }
 
-        int tex = std::stoi(parts[1]);
-        if (tex < 0) {
-            tex += this->m_tex.size() + 1;
-
-            if (tex <= 0) {
-                throw std::out_of_range("Negative index out of range");
-            }
-        } else if (tex == 0) {
-            throw std::out_of_range("0 is not a valid index");
+    // When a file is split into several chunks, the shared arrays have already been sized by the
+    // counting pass and each chunk only writes to its own slots. A single chunk skips the counting
+    // pass, so it simply appends to the (initially empty) arrays instead.
+    template <typename T>
+    static void store_record(std::vector<T>& v, size_t i, const T& value) {
+        if (i == v.size()) {
+            v.push_back(value);
+        } else {
+            v[i] = value;
         }
+    }
 
-        int norm = std::stoi(parts[2]);
-        if (norm < 0) {
-            norm += this->m_norm.size() + 1;
+    void ObjChunk::parse(std::vector<glm::vec3>& pos, std::vector<glm::vec2>& tex, std::vector<glm::vec3>& norm) {
+        LineReader lines(this->begin, this->end);
+        TextToken line;
 
-            if (norm <= 0) {
-                throw std::out_of_range("Negative index out of range");
+        size_t pos_count = this->pos_base;
+        size_t tex_count = this->tex_base;
+        size_t norm_count = this->norm_base;
+
+        auto add_vertex = [&](const TextToken& spec) {
+            const char* slash1 = static_cast<const char*>(std::memchr(spec.begin, '/', spec.size()));
+            const char* slash2 = slash1
+                ? static_cast<const char*>(std::memchr(slash1 + 1, '/', spec.end - slash1 - 1))
+                : nullptr;
+
+            if (slash2 == nullptr || std::memchr(slash2 + 1, '/', spec.end - slash2 - 1) != nullptr) {
+                throw std::runtime_error(([&]() {
+                    std::ostringstream ss;
+
+                    ss << "Invalid face vertex specification \"" << spec.str() << "\"";
+
+                    return ss.str();
+                })());
             }
-        } else if (norm == 0) {
-            throw std::out_of_range("0 is not a valid index");
-        }
 
-        return this->add_vertex(
-            static_cast<unsigned int>(pos - 1),
-            static_cast<unsigned int>(tex - 1),
-            static_cast<unsigned int>(norm - 1)
-        );
-    }
+            this->refs.push_back(ObjVertexRef {
+                .pos = resolve_index(parse_int(spec.begin, slash1), pos_count),
+                .tex = resolve_index(parse_int(slash1 + 1, slash2), tex_count),
+                .norm = resolve_index(parse_int(slash2 + 1, spec.end), norm_count)
+            });
+        };
 
-    static glm::vec3 parse_vec3(const std::vector<std::string>& parts, int start) {
-        return glm::vec3(
-            std::stof(parts[start]),
-            std::stof(parts[start + 1]),
-            std::stof(parts[start + 2])
-        );
-    }
+        while (lines.next(line)) {
+            // None of the commands we care about take more than 3 arguments, so anything past that
+            // is only counted in order to produce the correct error.
+            TextToken parts[4];
+            size_t num_parts = split_tokens(line.begin, strip_comment(line.begin, line.end), parts, 4);
 
-    static glm::vec2 parse_vec2(const std::vector<std::string>& parts, int start) {
-        return glm::vec2(
-            std::stof(parts[start]),
-            std::stof(parts[start + 1])
-        );
+            if (num_parts == 0) {
+                continue;
+            }
+
+            if (parts[0] == "v") {
+                if (num_parts != 4) {
+                    throw std::runtime_error("Wrong number of arguments for \"v\"");
+                }
+
+                store_record(pos, pos_count++, parse_vec3(parts + 1));
+            } else if (parts[0] == "vt") {
+                if (num_parts != 3) {
+                    throw std::runtime_error("Wrong number of arguments for \"vt\"");
+                }
+
+                auto v = parse_vec2(parts + 1);
+
+                store_record(tex, tex_count++, glm::vec2(v.x, 1 - v.y));
+            } else if (parts[0] == "vn") {
+                if (num_parts != 4) {
+                    throw std::runtime_error("Wrong number of arguments for \"vn\"");
+                }
+
+                store_record(norm, norm_count++, parse_vec3(parts + 1));
+            } else if (parts[0] == "f") {
+                if (num_parts != 4) {
+                    throw std::runtime_error("Wrong number of arguments for \"f\"");
+                }
+
+                add_vertex(parts[1]);
+                add_vertex(parts[2]);
+                add_vertex(parts[3]);
+            }
+        }
     }
 
-    void Model3DLoader::handle_line(std::string line) {
-        size_t comment_pos = line.find("#");
+    // Runs fn(i) for every chunk, spreading the work over one thread per chunk. The first chunk is
+    // always handled on the calling thread. Exceptions are stored in the chunk that raised them so
+    // that the caller can report them in file order.
+    template <typename F>
+    static void for_each_chunk(std::vector<ObjChunk>& chunks, F fn) {
+        auto run = [&](size_t i) {
+            try {
+                fn(chunks[i]);
+            } catch (...) {
+                chunks[i].error = std::current_exception();
+            }
+        };
 
-        if (comment_pos != std::string::npos) {
-            line = line.substr(0, comment_pos);
+        std::vector<std::thread> threads;
+
+        for (size_t i = 1; i < chunks.size(); i++) {
+            threads.emplace_back(run, i);
         }
 
-        boost::trim(line);
+        run(0);
 
-        if (line.size() == 0) {
-            return;
+        for (auto& t : threads) {
+            t.join();
         }
 
-        std::vector<std::string> parts;
+        for (const auto& c : chunks) {
+            if (c.error) {
+                std::rethrow_exception(c.error);
+            }
+        }
+    }
 
-        boost::split(parts, line, boost::is_any_of(" \t"), boost::token_compress_on);
+    void Model3DLoader::load(const char* begin, const char* end) {
+        size_t size = end - begin;
+        size_t num_chunks = std::max<size_t>(1, std::min<size_t>(
+            AssetLoader::worker_threads(),
+            size / min_chunk_size
+        ));
 
-        if (parts[0] == "v") {
-            if (parts.size() != 4) {
-                throw std::runtime_error("Wrong number of arguments for \"v\"");
-            }
+        std::vector<ObjChunk> chunks(num_chunks);
+
+        // Split the file into roughly equal chunks, moving each split point forward to the start of
+        // the next line.
+        const char* chunk_begin = begin;
+
+        for (size_t i = 0; i < num_chunks; i++) {
+            const char* chunk_end = i == num_chunks - 1 ? end : begin + size * (i + 1) / num_chunks;
+
+            if (chunk_end < chunk_begin) {
+                chunk_end = chunk_begin;
+            } else if (chunk_end != end) {
+                const char* eol = static_cast<const char*>(
+                    std::memchr(chunk_end, '\n', end - chunk_end)
+                );
 
-            this->m_pos.push_back(parse_vec3(parts, 1));
-        } else if (parts[0] == "vt") {
-            if (parts.size() != 3) {
-                throw std::runtime_error("Wrong number of arguments for \"vt\"");
+                chunk_end = eol == nullptr ? end : eol + 1;
             }
 
-            auto v = parse_vec2(parts, 1);
+            chunks[i].begin = chunk_begin;
+            chunks[i].end = chunk_end;
+            chunk_begin = chunk_end;
+        }
+
+        if (num_chunks > 1) {
+            for_each_chunk(chunks, [](ObjChunk& c) { c.count(); });
+
+            size_t num_pos = 0;
+            size_t num_tex = 0;
+            size_t num_norm = 0;
+
+            for (auto& c : chunks) {
+                c.pos_base = num_pos;
+                c.tex_base = num_tex;
+                c.norm_base = num_norm;
 
-            this->m_tex.push_back(glm::vec2(v.x, 1 - v.y));
-        } else if (parts[0] == "vn") {
-            if (parts.size() != 4) {
-                throw std::runtime_error("Wrong number of arguments for \"vn\"");
+                num_pos += c.num_pos;
+                num_tex += c.num_tex;
+                num_norm += c.num_norm;
             }
 
-            this->m_norm.push_back(parse_vec3(parts, 1));
-        } else if (parts[0] == "f") {
-            if (parts.size() != 4) {
-                throw std::runtime_error("Wrong number of arguments for \"f\"");
+            this->m_pos.resize(num_pos);
+            this->m_tex.resize(num_tex);
+            this->m_norm.resize(num_norm);
+        }
+
+        for_each_chunk(chunks, [&](ObjChunk& c) {
+            c.parse(this->m_pos, this->m_tex, this->m_norm);
+        });
+
+        size_t num_refs = 0;
+
+        for (const auto& c : chunks) {
+            num_refs += c.refs.size();
+        }
+
+        // num_refs / 3 is the number of triangles, and a closed triangle mesh has about half as many
+        // vertices as triangles, so this leaves room for texture coordinate and normal seams to
+        // split every vertex in two before the table has to grow.
+        this->m_vertex_indices.reserve(num_refs / 3);
+        this->m_indices.reserve(num_refs);
+
+        // Deduplication has to happen in file order so that vertices are numbered in the order in
+        // which they were first seen, exactly like a serial parse. This loop is the serial part of
+        // loading, so however many threads the parse above runs on, loading can't get faster than
+        // this loop alone. With face lines taking up most of a file it's a sizeable share of a
+        // single-threaded load; --obj-benchmark shows how much is left for more threads to gain.
+        for (auto& c : chunks) {
+            for (const auto& ref : c.refs) {
+                this->m_indices.push_back(this->add_vertex(ref));
             }
 
-            this->m_current_vertices.push_back(this->add_vertex(parts[1]));
-            this->m_current_vertices.push_back(this->add_vertex(parts[2]));
-            this->m_current_vertices.push_back(this->add_vertex(parts[3]));
+            std::vector<ObjVertexRef>().swap(c.refs);
         }
     }
 
-    void Model3DLoader::finish() {
+    Model3DData Model3DLoader::finish() {
         this->emit_subobject();
 
-        this->m_model->m_vertices.buffer(0).load_data(this->m_vertices, GL_STATIC_DRAW);
-        this->m_model->m_vertices.size(this->m_vertices.size());
+        return Model3DData(
+            std::move(this->m_vertices),
+            std::move(this->m_indices),
+            std::move(this->m_sub_object_sizes)
+        );
+    }
 
-        if (this->m_vertices.size() > 0) {
+    Model3DData::Model3DData(
+        std::vector<Model3DVertex>&& vertices,
+        std::vector<unsigned int>&& indices,
+        std::vector<size_t>&& sub_object_sizes
+    ) : m_vertex_storage(std::move(vertices)), m_index_storage(std::move(indices)),
+        m_sub_object_sizes(std::move(sub_object_sizes)), m_lod_errors(1, 0.0f) {
+        this->m_num_sub_objects = this->m_sub_object_sizes.size();
+
+        this->m_vertices = this->m_vertex_storage.data();
+        this->m_num_vertices = this->m_vertex_storage.size();
+
+        this->m_indices = this->m_index_storage.data();
+        this->m_num_indices = this->m_index_storage.size();
+
+        if (this->m_num_vertices > 0) {
             glm::vec3 min(std::numeric_limits<float>::infinity());
             glm::vec3 max(-std::numeric_limits<float>::infinity());
 
-            for (const auto& v : this->m_vertices) {
+            for (const auto& v : this->m_vertex_storage) {
                 if (v.pos.x < min.x) min.x = v.pos.x;
                 if (v.pos.x > max.x) max.x = v.pos.x;
 
@@ -357,58 +585,607 @@ namespace hw3 {
                 if (v.pos.z > max.z) max.z = v.pos.z;
             }
 
-            this->m_model->m_bounding_box = AABB(min, max);
-        } else {
-            this->m_model->m_bounding_box = AABB();
+            this->m_bounding_box = AABB(min, max);
         }
     }
 
-    Model3D::Model3D() : m_vertices(1, 0) {}
+    Model3DData Model3DData::load_obj(const boost::filesystem::path& path) {
+        MappedFile f(path);
+        Model3DLoader loader;
+
+        loader.load(f.begin(), f.end());
+
+        return loader.finish();
+    }
+
+    // The number of bytes currently allocated from the heap, or 0 where that can't be measured.
+    // glibc serves large allocations (like the vertex table) with their own mappings, which
+    // uordblks doesn't include.
+    static size_t heap_in_use() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+        struct mallinfo2 info = mallinfo2();
+
+        return info.uordblks + info.hblkhd;
+#else
+        return 0;
+#endif
+    }
+
+    VertexDedupBenchmark benchmark_vertex_dedup(const boost::filesystem::path& path) {
+        MappedFile f(path);
+        ObjChunk chunk;
+        std::vector<glm::vec3> pos;
+        std::vector<glm::vec2> tex;
+        std::vector<glm::vec3> norm;
+
+        chunk.begin = f.begin();
+        chunk.end = f.end();
+        chunk.parse(pos, tex, norm);
+
+        const auto& refs = chunk.refs;
+        VertexDedupBenchmark result;
+
+        result.lookups = refs.size();
+
+        // Both structures are kept alive until the end, so the heap use measured after the last
+        // insert is also the peak; nothing is freed before then. The table is reserved the same
+        // way Model3DLoader does it.
+        VertexIndexTable table;
+        std::map<std::tuple<unsigned int, unsigned int, unsigned int>, unsigned int> map;
+
+        auto time_dedup = [&](const std::function<size_t ()>& dedup) {
+            size_t heap_before = heap_in_use();
+            auto start = std::chrono::steady_clock::now();
+
+            result.unique_vertices = dedup();
+
+            return VertexDedupStats {
+                .time_ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start
+                ).count(),
+                .heap_bytes = heap_in_use() - heap_before
+            };
+        };
+
+        result.hash_table = time_dedup([&]() {
+            unsigned int num_vertices = 0;
+
+            table.reserve(refs.size() / 3);
+
+            for (const auto& ref : refs) {
+                if (table.find_or_insert(ref, num_vertices) == num_vertices) {
+                    num_vertices++;
+                }
+            }
+
+            return table.size();
+        });
+
+        result.ordered_map = time_dedup([&]() {
+            for (const auto& ref : refs) {
+                map.emplace(std::make_tuple(ref.pos, ref.tex, ref.norm), map.size());
+            }
+
+            return map.size();
+        });
+
+        return result;
+    }
+
+    void Model3DData::build_lods(size_t max_lods) {
+        auto& indices = this->m_index_storage;
+
+        glm::vec3 size = this->m_bounding_box.size();
+        float extent = std::max(size.x, std::max(size.y, size.z));
+
+        // Each LOD aims for half the triangles of the previous one. A single level is allowed to
+        // deviate by up to a tenth of the model's size, which is far more than should ever be
+        // visible: LOD selection is driven by the error that was actually reached.
+        constexpr float max_level_error = 0.1f;
+
+        size_t prev_offset = 0;
+        std::vector<unsigned int> level_indices;
+        std::vector<size_t> level_sizes;
 
-    Model3D& Model3D::load_geometry(boost::filesystem::path path) {
-        boost::filesystem::ifstream f(path);
+        while (this->m_lod_errors.size() < max_lods) {
+            size_t prev_lod = this->m_lod_errors.size() - 1;
+            size_t prev_total = 0;
+            float level_error = 0;
 
-        if (!f) {
-            throw std::runtime_error(([&]() {
-                std::ostringstream ss;
+            level_indices.clear();
+            level_sizes.clear();
 
-                ss << "Failed to open object file \"" << path.string() << "\"";
+            size_t offset = prev_offset;
+
+            for (size_t i = 0; i < this->m_num_sub_objects; i++) {
+                size_t prev_size = this->sub_object_size(prev_lod, i);
+                size_t start = level_indices.size();
+                float error;
+
+                level_indices.resize(start + prev_size);
+
+                size_t new_size = simplify(
+                    level_indices.data() + start,
+                    indices.data() + offset,
+                    prev_size,
+                    this->m_vertex_storage.data(),
+                    this->m_vertex_storage.size(),
+                    prev_size / 6 * 3,
+                    max_level_error,
+                    &error
+                );
+
+                level_indices.resize(start + new_size);
+                level_sizes.push_back(new_size);
+                level_error = std::max(level_error, error);
+
+                offset += prev_size;
+                prev_total += prev_size;
+            }
+
+            // Stop once simplification stops making meaningful progress, since a LOD that's nearly
+            // as detailed as the previous one just wastes memory.
+            if (level_indices.size() * 10 > prev_total * 9) {
+                break;
+            }
 
-                return ss.str();
-            })());
+            prev_offset = indices.size();
+            indices.insert(indices.end(), level_indices.begin(), level_indices.end());
+            this->m_sub_object_sizes.insert(this->m_sub_object_sizes.end(), level_sizes.begin(), level_sizes.end());
+
+            // The errors of successive simplifications add up, since each one starts from the last.
+            this->m_lod_errors.push_back(this->m_lod_errors.back() + level_error * extent);
+        }
+    }
+
+    MeshOptimizeStats Model3DData::optimize(const Model3DLoadOptions& options) {
+        assert(this->m_vertices == this->m_vertex_storage.data());
+        assert(this->m_indices == this->m_index_storage.data());
+        assert(this->num_lods() == 1);
+
+        auto& vertices = this->m_vertex_storage;
+        auto& indices = this->m_index_storage;
+
+        MeshOptimizeStats stats = {
+            .degenerate_triangles = 0,
+            .acmr_before = calculate_acmr(indices.data(), indices.size(), vertices.size()),
+            .acmr_after = 0
+        };
+
+        if (options.optimize != MeshOptimizeLevel::NONE) {
+            // The sub-objects are compacted towards the front of the index list as degenerate
+            // triangles are removed.
+            size_t in_offset = 0;
+            size_t out_offset = 0;
+
+            for (size_t& size : this->m_sub_object_sizes) {
+                unsigned int* sub_indices = indices.data() + out_offset;
+
+                std::copy(indices.begin() + in_offset, indices.begin() + in_offset + size, sub_indices);
+                in_offset += size;
+
+                size_t new_size = remove_degenerate_triangles(sub_indices, size, vertices.data());
+
+                stats.degenerate_triangles += (size - new_size) / 3;
+                size = new_size;
+                out_offset += size;
+            }
+
+            indices.resize(out_offset);
+        }
+
+        if (options.max_lods > 1) {
+            this->build_lods(options.max_lods);
+        }
+
+        size_t lod0_size = 0;
+
+        for (size_t i = 0; i < this->m_num_sub_objects; i++) {
+            lod0_size += this->sub_object_size(0, i);
+        }
+
+        if (options.optimize != MeshOptimizeLevel::NONE) {
+            // Each index list is optimized separately, since they're drawn with separate draws
+            size_t offset = 0;
+
+            for (size_t size : this->m_sub_object_sizes) {
+                optimize_vertex_cache(indices.data() + offset, size, vertices.size());
+
+                if (options.optimize == MeshOptimizeLevel::OVERDRAW) {
+                    optimize_overdraw(indices.data() + offset, size, vertices.data(), vertices.size());
+                }
+
+                offset += size;
+            }
+
+            // The full-detail LOD comes first, so this orders the vertices for it. The other LODs
+            // only use a subset of its vertices.
+            optimize_vertex_fetch(vertices, indices);
+        }
+
+        // Meshlets are runs of the final triangle order, so they have to be built last
+        auto& meshlets = this->m_meshlet_storage;
+        size_t first_index = 0;
+
+        meshlets.clear();
+
+        for (size_t size : this->m_sub_object_sizes) {
+            build_meshlets(meshlets, indices.data() + first_index, first_index, size, vertices.data(), vertices.size());
+            first_index += size;
+        }
+
+        this->m_vertices = vertices.data();
+        this->m_num_vertices = vertices.size();
+
+        this->m_indices = indices.data();
+        this->m_num_indices = indices.size();
+
+        this->m_meshlets = meshlets.data();
+        this->m_num_meshlets = meshlets.size();
+
+        stats.acmr_after = calculate_acmr(indices.data(), lod0_size, vertices.size());
+
+        return stats;
+    }
+
+    Model3D::Model3D() : m_vertices(2, 0) {}
+
+    Model3DData Model3DData::load(
+        const boost::filesystem::path& path,
+        const Model3DLoadOptions& options,
+        const std::function<void (const AABB&)>& on_bounds
+    ) {
+        Model3DData data;
+
+        if (!Model3DData::load_cache(path, options, data)) {
+            data = Model3DData::load_obj(path);
+
+            if (on_bounds) {
+                on_bounds(data.bounding_box());
+            }
+
+            data.optimize(options);
+            data.write_cache(path, options);
+        } else if (on_bounds) {
+            on_bounds(data.bounding_box());
+        }
+
+        // Measured here rather than by optimize so that cached models have it too
+        data.measure_acmr();
+
+        return data;
+    }
+
+    void Model3DData::measure_acmr() {
+        size_t offset = 0;
+
+        this->m_lod_acmrs.clear();
+
+        for (size_t l = 0; l < this->num_lods(); l++) {
+            size_t size = 0;
+
+            for (size_t i = 0; i < this->m_num_sub_objects; i++) {
+                size += this->sub_object_size(l, i);
+            }
+
+            this->m_lod_acmrs.push_back(calculate_acmr(this->m_indices + offset, size, this->m_num_vertices));
+            offset += size;
+        }
+    }
+
+    Model3D& Model3D::load_geometry(boost::filesystem::path path, const Model3DLoadOptions& options) {
+        return this->load_data(Model3DData::load(path, options), options.vertex_format);
+    }
+
+    static std::vector<Model3DPackedVertex> pack_vertices(const Model3DData& data) {
+        const glm::vec3& min = data.bounding_box().min();
+        glm::vec3 size = data.bounding_box().size();
+
+        // Flat models have a zero extent along one axis; everything quantizes to 0 along it.
+        glm::vec3 inv_size(
+            size.x > 0 ? 1 / size.x : 0,
+            size.y > 0 ? 1 / size.y : 0,
+            size.z > 0 ? 1 / size.z : 0
+        );
+
+        auto quantize = [](float v) {
+            return static_cast<uint16_t>(std::round(std::min(std::max(v, 0.0f), 1.0f) * 65535.0f));
+        };
+
+        std::vector<Model3DPackedVertex> packed(data.num_vertices());
+
+        for (size_t i = 0; i < data.num_vertices(); i++) {
+            const Model3DVertex& v = data.vertices()[i];
+            glm::vec3 pos = (v.pos - min) * inv_size;
+
+            packed[i] = Model3DPackedVertex {
+                .pos = { quantize(pos.x), quantize(pos.y), quantize(pos.z) },
+                .padding = 0,
+                .tex = { pack_half(v.tex.x), pack_half(v.tex.y) },
+                .norm = pack_snorm_2_10_10_10(v.norm.x, v.norm.y, v.norm.z)
+            };
+        }
+
+        return packed;
+    }
+
+    template <class T>
+    static std::vector<T> rebase_indices(
+        const Model3DData& data,
+        const std::vector<ModelSubObject3D>& sub_objects
+    ) {
+        std::vector<T> rebased(data.num_indices());
+
+        for (const ModelSubObject3D& so : sub_objects) {
+            for (size_t i = so.first_index; i < so.first_index + so.num_indices; i++) {
+                rebased[i] = static_cast<T>(data.indices()[i] - so.base_vertex);
+            }
         }
 
+        return rebased;
+    }
+
+    Model3D& Model3D::load_data(const Model3DData& data, Model3DVertexFormat format) {
         this->m_sub_objects.clear();
+        this->m_meshlets.assign(data.meshlets(), data.meshlets() + data.num_meshlets());
+
+        switch (format) {
+        case Model3DVertexFormat::FLOAT:
+            this->m_vertices.buffer(0).load_data(
+                data.vertices(),
+                data.num_vertices() * sizeof(Model3DVertex),
+                GL_STATIC_DRAW
+            );
+
+            this->m_position_offset = glm::vec3(0);
+            this->m_position_scale = glm::vec3(1);
+
+            this->m_vertices.bind_attribute(0, 3, DataType::FLOAT, sizeof(Model3DVertex), offsetof(Model3DVertex, pos), 0);
+            this->m_vertices.bind_attribute(1, 2, DataType::FLOAT, sizeof(Model3DVertex), offsetof(Model3DVertex, tex), 0);
+            this->m_vertices.bind_attribute(2, 3, DataType::FLOAT, sizeof(Model3DVertex), offsetof(Model3DVertex, norm), 0);
+            break;
+        case Model3DVertexFormat::PACKED: {
+            auto packed = pack_vertices(data);
+
+            this->m_vertices.buffer(0).load_data(
+                packed.data(),
+                packed.size() * sizeof(Model3DPackedVertex),
+                GL_STATIC_DRAW
+            );
+
+            this->m_position_offset = data.bounding_box().min();
+            this->m_position_scale = data.bounding_box().size();
+
+            this->m_vertices.bind_attribute(
+                0, 3, DataType::UNSIGNED_SHORT,
+                sizeof(Model3DPackedVertex), offsetof(Model3DPackedVertex, pos), 0,
+                AttributeConversion::NORMALIZED
+            );
+            this->m_vertices.bind_attribute(
+                1, 2, DataType::HALF_FLOAT,
+                sizeof(Model3DPackedVertex), offsetof(Model3DPackedVertex, tex), 0
+            );
+            this->m_vertices.bind_attribute(
+                2, 4, DataType::INT_2_10_10_10_REV,
+                sizeof(Model3DPackedVertex), offsetof(Model3DPackedVertex, norm), 0,
+                AttributeConversion::NORMALIZED
+            );
+            break;
+        }
+        }
+
+        this->m_vertices.size(data.num_vertices());
+
+        // All sub-objects share one index buffer so that they can be drawn with a single call, which
+        // means they also have to share an index type. 16-bit indices are used if every sub-object's
+        // vertex range fits in them. 8-bit indices are deliberately never used: many GPUs don't
+        // support them natively and convert them in a slow path, which would cost far more than
+        // the few bytes saved on tiny meshes.
+        const unsigned int* indices = data.indices();
+        size_t first_index = 0;
+        size_t next_meshlet = 0;
+        bool fits_16_bit = true;
+
+        for (size_t size : data.sub_object_sizes()) {
+            unsigned int min_index = std::numeric_limits<unsigned int>::max();
+            unsigned int max_index = 0;
+
+            for (size_t i = first_index; i < first_index + size; i++) {
+                min_index = std::min(min_index, indices[i]);
+                max_index = std::max(max_index, indices[i]);
+            }
+
+            if (size == 0) {
+                min_index = max_index = 0;
+            }
+
+            if (max_index - min_index > std::numeric_limits<uint16_t>::max()
+                || min_index > static_cast<unsigned int>(std::numeric_limits<int>::max())) {
+                fits_16_bit = false;
+            }
+
+            // The meshlets are stored in the same order as the index lists they cover
+            size_t first_meshlet = next_meshlet;
+
+            while (next_meshlet < this->m_meshlets.size()
+                   && this->m_meshlets[next_meshlet].first_index >= first_index
+                   && this->m_meshlets[next_meshlet].first_index + this->m_meshlets[next_meshlet].num_indices
+                       <= first_index + size) {
+                next_meshlet++;
+            }
 
-        Model3DLoader loader(this);
-        std::string line;
+            this->m_sub_objects.push_back(ModelSubObject3D {
+                .first_index = first_index,
+                .num_indices = size,
+                .base_vertex = fits_16_bit ? static_cast<int>(min_index) : 0,
+                .first_meshlet = first_meshlet,
+                .num_meshlets = next_meshlet - first_meshlet
+            });
 
-        while (std::getline(f, line)) {
-            loader.handle_line(line);
+            first_index += size;
         }
 
-        if (f.bad()) {
-            throw std::runtime_error(([&]() {
-                std::ostringstream ss;
+        if (fits_16_bit) {
+            auto rebased = rebase_indices<uint16_t>(data, this->m_sub_objects);
 
-                ss << "Error reading object file \"" << path.string() << "\"";
+            this->m_vertices.buffer(1).load_data(rebased.data(), rebased.size() * sizeof(uint16_t), GL_STATIC_DRAW);
+            this->m_index_type = IndexType::UNSIGNED_SHORT;
+        } else {
+            for (ModelSubObject3D& so : this->m_sub_objects) {
+                so.base_vertex = 0;
+            }
 
-                return ss.str();
-            })());
+            auto rebased = rebase_indices<uint32_t>(data, this->m_sub_objects);
+
+            this->m_vertices.buffer(1).load_data(rebased.data(), rebased.size() * sizeof(uint32_t), GL_STATIC_DRAW);
+            this->m_index_type = IndexType::UNSIGNED_INT;
         }
 
-        loader.finish();
+        this->m_vertices.bind_index_buffer(1);
+        this->m_culled_draws = IndexedDrawList(this->m_index_type);
+
+        this->m_num_sub_objects = data.num_sub_objects();
+        this->m_lods.clear();
 
-        this->m_vertices.bind_attribute(0, 3, DataType::FLOAT, sizeof(Model3DVertex), offsetof(Model3DVertex, pos), 0);
-        this->m_vertices.bind_attribute(1, 2, DataType::FLOAT, sizeof(Model3DVertex), offsetof(Model3DVertex, tex), 0);
-        this->m_vertices.bind_attribute(2, 3, DataType::FLOAT, sizeof(Model3DVertex), offsetof(Model3DVertex, norm), 0);
+        for (size_t l = 0; l < data.num_lods(); l++) {
+            Model3DLod lod = {
+                .draws = IndexedDrawList(this->m_index_type),
+                .num_triangles = 0,
+                .error = data.lod_error(l),
+                .acmr = data.lod_acmr(l)
+            };
+
+            for (size_t i = 0; i < this->m_num_sub_objects; i++) {
+                const ModelSubObject3D& so = this->m_sub_objects[l * this->m_num_sub_objects + i];
+
+                lod.draws.add(so.first_index, so.num_indices, so.base_vertex);
+                lod.num_triangles += so.num_indices / 3;
+            }
+
+            this->m_lods.push_back(std::move(lod));
+        }
+
+        this->m_bounding_box = data.bounding_box();
 
         return *this;
     }
 
-    void Model3D::draw() const {
-        for (const ModelSubObject3D& so : this->m_sub_objects) {
-            this->m_vertices.draw_indexed(so.index_buffer, 0, so.num_indices, PrimitiveType::TRIANGLES);
+    void Model3D::draw(size_t lod) const {
+        assert(lod < this->m_lods.size());
+
+        this->m_vertices.draw_indexed(this->m_lods[lod].draws, PrimitiveType::TRIANGLES);
+    }
+
+    Model3DDrawStats Model3D::draw_culled(size_t lod, const glm::mat4& transform, const glm::vec3& camera_pos) const {
+        assert(lod < this->m_lods.size());
+
+        // Extract the left, right, bottom, top and near planes of the view frustum in object space.
+        // A point p is inside a plane if dot(plane, (p, 1)) >= 0.
+        auto row = [&](int i) {
+            return glm::vec4(transform[0][i], transform[1][i], transform[2][i], transform[3][i]);
+        };
+
+        glm::vec4 planes[5] = {
+            row(3) + row(0),
+            row(3) - row(0),
+            row(3) + row(1),
+            row(3) - row(1),
+            row(3) + row(2)
+        };
+
+        for (glm::vec4& plane : planes) {
+            float length = glm::length(glm::vec3(plane));
+
+            if (length > 0) {
+                plane /= length;
+            }
+        }
+
+        auto in_frustum = [&](const glm::vec3& center, float radius) {
+            for (const glm::vec4& plane : planes) {
+                if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+                    return false;
+                }
+            }
+
+            return true;
+        };
+
+        // Back faces are only hidden when they're seen from outside of the surface, and a camera
+        // inside the bounding box might be inside of it.
+        const glm::vec3& box_min = this->m_bounding_box.min();
+        const glm::vec3& box_max = this->m_bounding_box.max();
+        bool cull_back_faces = camera_pos.x < box_min.x || camera_pos.x > box_max.x
+            || camera_pos.y < box_min.y || camera_pos.y > box_max.y
+            || camera_pos.z < box_min.z || camera_pos.z > box_max.z;
+
+        auto faces_away = [&](const Meshlet& m) {
+            glm::vec3 view = m.center - camera_pos;
+
+            return glm::dot(view, m.cone_axis) >= m.cone_cutoff * glm::length(view) + m.radius;
+        };
+
+        Model3DDrawStats stats;
+        bool model_visible = in_frustum(
+            this->m_bounding_box.center(),
+            glm::length(this->m_bounding_box.size()) / 2
+        );
+
+        this->m_culled_draws.clear();
+
+        for (size_t i = 0; i < this->m_num_sub_objects; i++) {
+            const ModelSubObject3D& so = this->sub_object(i, lod);
+
+            if (so.num_meshlets == 0) {
+                if (model_visible) {
+                    this->m_culled_draws.add(so.first_index, so.num_indices, so.base_vertex);
+                    stats.triangles += so.num_indices / 3;
+                }
+
+                continue;
+            }
+
+            if (!model_visible) {
+                stats.culled_meshlets += so.num_meshlets;
+                continue;
+            }
+
+            // Neighbouring meshlets that both survive are merged into a single draw
+            size_t run_start = 0;
+            size_t run_end = 0;
+
+            for (size_t j = so.first_meshlet; j < so.first_meshlet + so.num_meshlets; j++) {
+                const Meshlet& m = this->m_meshlets[j];
+
+                if (!in_frustum(m.center, m.radius) || (cull_back_faces && faces_away(m))) {
+                    stats.culled_meshlets++;
+                    continue;
+                }
+
+                stats.meshlets++;
+                stats.triangles += m.num_indices / 3;
+
+                if (run_end != run_start && run_end == m.first_index) {
+                    run_end += m.num_indices;
+                } else {
+                    if (run_end != run_start) {
+                        this->m_culled_draws.add(run_start, run_end - run_start, so.base_vertex);
+                    }
+
+                    run_start = m.first_index;
+                    run_end = m.first_index + m.num_indices;
+                }
+            }
+
+            if (run_end != run_start) {
+                this->m_culled_draws.add(run_start, run_end - run_start, so.base_vertex);
+            }
+        }
+
+        if (!this->m_culled_draws.empty()) {
+            this->m_vertices.draw_indexed(this->m_culled_draws, PrimitiveType::TRIANGLES);
         }
+
+        return stats;
     }
 }
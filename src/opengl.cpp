@@ -0,0 +1,84 @@
+#include <iostream>
+#include <string>
+
+#include "opengl.hpp"
+
+namespace hw3 {
+    // The message of the last error the driver reported, until it's thrown or discarded
+    static std::string debug_message;
+
+#if HW3_GL_CHECKS
+    static void APIENTRY handle_debug_message(
+        GLenum source,
+        GLenum type,
+        GLuint id,
+        GLenum severity,
+        GLsizei length,
+        const GLchar* message,
+        const void* user_param
+    ) {
+        if (type == GL_DEBUG_TYPE_ERROR) {
+            debug_message.assign(message, length);
+        } else if (severity != GL_DEBUG_SEVERITY_NOTIFICATION) {
+            std::cerr << "OpenGL: " << std::string(message, length) << std::endl;
+        }
+    }
+#endif
+
+    void request_debug_context() {
+#if HW3_GL_CHECKS
+        glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+#endif
+    }
+
+    void enable_debug_output() {
+#if HW3_GL_CHECKS
+        // KHR_debug is only core since OpenGL 4.3
+        if (glfwExtensionSupported("GL_KHR_debug") != GLFW_TRUE) {
+            return;
+        }
+
+        // Synchronous output calls back from within the call that raised the error, rather than
+        // whenever the driver gets around to it
+        glEnable(GL_DEBUG_OUTPUT);
+        glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+        glDebugMessageCallback(handle_debug_message, nullptr);
+        clear_errors();
+#endif
+    }
+
+    void discard_debug_message() {
+        debug_message.clear();
+    }
+
+    void throw_gl_error(GLenum error, const char* file, int line) {
+        std::ostringstream ss;
+
+        ss << "Unhandled OpenGL error 0x" << std::hex << error << std::dec;
+
+        if (file) {
+            ss << " at " << file << ":" << line;
+        } else {
+            ss << " during the last frame";
+        }
+
+        if (!debug_message.empty()) {
+            ss << ": " << debug_message;
+        }
+
+        clear_errors();
+        discard_debug_message();
+
+        throw std::runtime_error(ss.str());
+    }
+
+    void check_frame_errors() {
+#if HW3_GL_FRAME_CHECKS
+        GLenum error = glGetError();
+
+        if (error != GL_NO_ERROR) {
+            throw_gl_error(error, nullptr, 0);
+        }
+#endif
+    }
+}
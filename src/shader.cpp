@@ -1,7 +1,9 @@
+#include <algorithm>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 
+#include "glstate.hpp"
 #include "opengl.hpp"
 #include "shader.hpp"
 #include "texture.hpp"
@@ -87,10 +89,68 @@ namespace hw3 {
 
             throw std::runtime_error(ss.str());
         }
+
+        this->load_uniform_locations();
+    }
+
+    void ShaderProgram::load_uniform_locations() {
+        GLint num_uniforms = 0;
+        GLint max_length = 0;
+
+        glGetProgramiv(this->m_id, GL_ACTIVE_UNIFORMS, &num_uniforms);
+        glGetProgramiv(this->m_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+        std::vector<char> buf(std::max(max_length, 1));
+
+        this->m_uniform_locations.clear();
+
+        for (GLint i = 0; i < num_uniforms; i++) {
+            GLsizei length;
+            GLint size;
+            GLenum type;
+
+            glGetActiveUniform(this->m_id, i, static_cast<GLsizei>(buf.size()), &length, &size, &type, buf.data());
+
+            std::string name(buf.data(), length);
+            GLint location = glGetUniformLocation(this->m_id, name.c_str());
+
+            // Uniforms in uniform blocks don't have locations
+            if (location == -1) {
+                continue;
+            }
+
+            this->add_uniform_location(name, location);
+
+            // Arrays of basic types are only listed once, by the name of their first element. The
+            // array's own name also refers to that element, and every other element has a location
+            // of its own.
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+                std::string array_name = name.substr(0, name.size() - 3);
+
+                this->add_uniform_location(array_name, location);
+
+                for (GLint j = 1; j < size; j++) {
+                    std::string element_name = array_name + "[" + std::to_string(j) + "]";
+
+                    this->add_uniform_location(element_name, glGetUniformLocation(this->m_id, element_name.c_str()));
+                }
+            }
+        }
+
+        handle_errors();
+    }
+
+    void ShaderProgram::add_uniform_location(const std::string& name, GLint location) {
+        auto result = this->m_uniform_locations.emplace(UniformName(name).hash(), location);
+
+        if (!result.second && result.first->second != location) {
+            throw std::runtime_error("Uniform name " + name + " has the same hash as another uniform");
+        }
     }
 
     ShaderProgram::ShaderProgram(ShaderProgram&& other)
         : m_id(other.m_id), m_shaders(std::move(other.m_shaders)),
+          m_uniform_locations(std::move(other.m_uniform_locations)),
           m_next_texture(other.m_next_texture),
           m_texture_bindings(std::move(other.m_texture_bindings)),
           m_patch_size(other.m_patch_size) {
@@ -121,17 +181,20 @@ namespace hw3 {
 
     ShaderProgram::~ShaderProgram() {
         if (this->m_id) {
+            gl_state::forget_program(this->m_id);
             glDeleteProgram(this->m_id);
         }
     }
 
     ShaderProgram& ShaderProgram::operator =(ShaderProgram&& other) {
         if (this->m_id) {
+            gl_state::forget_program(this->m_id);
             glDeleteProgram(this->m_id);
         }
 
         this->m_id = other.m_id;
         this->m_shaders = std::move(other.m_shaders);
+        this->m_uniform_locations = std::move(other.m_uniform_locations);
         this->m_next_texture = other.m_next_texture;
         this->m_texture_bindings = std::move(other.m_texture_bindings);
         this->m_patch_size = other.m_patch_size;
@@ -143,8 +206,8 @@ namespace hw3 {
         return *this;
     }
 
-    void ShaderProgram::set_uniform(std::string name, float value) {
-        GLint loc = glGetUniformLocation(this->m_id, name.c_str());
+    void ShaderProgram::set_uniform(UniformName name, float value) {
+        GLint loc = this->uniform_location(name);
 
         if (loc != -1) {
            glProgramUniform1f(this->m_id, loc, value);
@@ -153,8 +216,8 @@ namespace hw3 {
         handle_errors();
     }
 
-    void ShaderProgram::set_uniform(std::string name, int value) {
-        GLint loc = glGetUniformLocation(this->m_id, name.c_str());
+    void ShaderProgram::set_uniform(UniformName name, int value) {
+        GLint loc = this->uniform_location(name);
 
         if (loc != -1) {
            glProgramUniform1i(this->m_id, loc, value);
@@ -163,8 +226,8 @@ namespace hw3 {
         handle_errors();
     }
 
-    void ShaderProgram::set_uniform(std::string name, glm::vec2 value) {
-        GLint loc = glGetUniformLocation(this->m_id, name.c_str());
+    void ShaderProgram::set_uniform(UniformName name, glm::vec2 value) {
+        GLint loc = this->uniform_location(name);
 
         if (loc != -1) {
            glProgramUniform2f(this->m_id, loc, value.x, value.y);
@@ -173,8 +236,8 @@ namespace hw3 {
         handle_errors();
     }
 
-    void ShaderProgram::set_uniform(std::string name, glm::vec3 value) {
-        GLint loc = glGetUniformLocation(this->m_id, name.c_str());
+    void ShaderProgram::set_uniform(UniformName name, glm::vec3 value) {
+        GLint loc = this->uniform_location(name);
 
         if (loc != -1) {
            glProgramUniform3f(this->m_id, loc, value.x, value.y, value.z);
@@ -183,8 +246,8 @@ namespace hw3 {
         handle_errors();
     }
 
-    void ShaderProgram::set_uniform(std::string name, glm::vec4 value) {
-        GLint loc = glGetUniformLocation(this->m_id, name.c_str());
+    void ShaderProgram::set_uniform(UniformName name, glm::vec4 value) {
+        GLint loc = this->uniform_location(name);
 
         if (loc != -1) {
            glProgramUniform4f(this->m_id, loc, value.x, value.y, value.z, value.w);
@@ -193,8 +256,8 @@ namespace hw3 {
         handle_errors();
     }
 
-    void ShaderProgram::set_uniform(std::string name, const glm::mat3& value) {
-        GLint loc = glGetUniformLocation(this->m_id, name.c_str());
+    void ShaderProgram::set_uniform(UniformName name, const glm::mat3& value) {
+        GLint loc = this->uniform_location(name);
 
         if (loc != -1) {
            glProgramUniformMatrix3fv(this->m_id, loc, 1, GL_TRUE, glm::value_ptr(value));
@@ -203,8 +266,8 @@ namespace hw3 {
         handle_errors();
     }
 
-    void ShaderProgram::set_uniform(std::string name, const glm::mat4& value) {
-        GLint loc = glGetUniformLocation(this->m_id, name.c_str());
+    void ShaderProgram::set_uniform(UniformName name, const glm::mat4& value) {
+        GLint loc = this->uniform_location(name);
 
         if (loc != -1) {
            glProgramUniformMatrix4fv(this->m_id, loc, 1, GL_TRUE, glm::value_ptr(value));
@@ -213,8 +276,12 @@ namespace hw3 {
         handle_errors();
     }
 
-    void ShaderProgram::set_uniform(std::string name, const Sampler2D* value) {
-        GLint loc = glGetUniformLocation(this->m_id, name.c_str());
+    void ShaderProgram::set_texture_uniform(
+        UniformName name,
+        const Sampler2D* sampler,
+        const Sampler2DArray* array_sampler
+    ) {
+        GLint loc = this->uniform_location(name);
 
         if (loc != -1) {
             auto it = this->m_texture_bindings.find(loc);
@@ -224,25 +291,46 @@ namespace hw3 {
 
                 this->m_texture_bindings.emplace(loc, TextureBinding {
                     .unit = unit,
-                    .sampler = value
+                    .sampler = sampler,
+                    .array_sampler = array_sampler
                 });
 
                 glProgramUniform1i(this->m_id, loc, unit);
             } else {
-                it->second.sampler = value;
+                it->second.sampler = sampler;
+                it->second.array_sampler = array_sampler;
             }
         }
 
         handle_errors();
     }
 
-    void ShaderProgram::use() const {
-        glUseProgram(this->m_id);
+    void ShaderProgram::set_uniform(UniformName name, const Sampler2D* value) {
+        this->set_texture_uniform(name, value, nullptr);
+    }
+
+    void ShaderProgram::set_uniform(UniformName name, const Sampler2DArray* value) {
+        this->set_texture_uniform(name, nullptr, value);
+    }
+
+    void ShaderProgram::bind_uniform_block(const char* name, GLuint binding) {
+        GLuint index = glGetUniformBlockIndex(this->m_id, name);
+
+        if (index != GL_INVALID_INDEX) {
+            glUniformBlockBinding(this->m_id, index, binding);
+        }
+
         handle_errors();
+    }
+
+    void ShaderProgram::use() const {
+        gl_state::use_program(this->m_id);
 
         for (const auto& tex_binding : this->m_texture_bindings) {
             if (tex_binding.second.sampler != nullptr)
                 tex_binding.second.sampler->bind(tex_binding.second.unit);
+            else if (tex_binding.second.array_sampler != nullptr)
+                tex_binding.second.array_sampler->bind(tex_binding.second.unit);
         }
 
         if (this->m_patch_size != 0) {
@@ -26,6 +26,12 @@ namespace hw3 {
             phong_program = ShaderProgram({ vertex_textured_normal, fragment_phong });
             point_program = ShaderProgram({ vertex_simple, geometry_point, fragment_fixed });
             textured_program = ShaderProgram({ vertex_textured, fragment_textured });
+
+            for (auto program : { &normal_program, &phong_program }) {
+                program->bind_uniform_block("Frame", blocks::frame);
+                program->bind_uniform_block("Object", blocks::object);
+                program->bind_uniform_block("Materials", blocks::materials);
+            }
         }
     }
 }
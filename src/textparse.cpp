@@ -0,0 +1,249 @@
+#include <cerrno>
+#include <cfloat>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "textparse.hpp"
+
+namespace hw3 {
+    static const float float_pow10[] = {
+        1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+    };
+
+    static const double double_pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    bool TextToken::operator ==(const char* str) const {
+        size_t len = std::strlen(str);
+
+        return this->size() == len && std::memcmp(this->begin, str, len) == 0;
+    }
+
+    size_t split_tokens(const char* begin, const char* end, TextToken* tokens, size_t max_tokens) {
+        size_t n = 0;
+
+        while (true) {
+            while (begin != end && is_text_space(*begin)) begin++;
+
+            if (begin == end) {
+                return n;
+            }
+
+            const char* token_begin = begin;
+
+            while (begin != end && !is_text_space(*begin)) begin++;
+
+            if (n < max_tokens) {
+                tokens[n] = TextToken { .begin = token_begin, .end = begin };
+            }
+
+            n++;
+        }
+    }
+
+    void split_tokens(const char* begin, const char* end, std::vector<std::string>& tokens) {
+        while (true) {
+            while (begin != end && is_text_space(*begin)) begin++;
+
+            if (begin == end) {
+                return;
+            }
+
+            const char* token_begin = begin;
+
+            while (begin != end && !is_text_space(*begin)) begin++;
+
+            tokens.emplace_back(token_begin, begin);
+        }
+    }
+
+    // Handles everything the fast path below gives up on (hex floats, infinities, NaNs, very long
+    // mantissas and values near the edges of the float range) by deferring to the C library.
+    static float parse_float_slow(const char* begin, const char* end) {
+        char buf[64];
+        std::string long_buf;
+        const char* str;
+
+        size_t len = static_cast<size_t>(end - begin);
+
+        if (len < sizeof(buf)) {
+            std::memcpy(buf, begin, len);
+            buf[len] = '\0';
+            str = buf;
+        } else {
+            long_buf.assign(begin, end);
+            str = long_buf.c_str();
+        }
+
+        char* str_end;
+
+        errno = 0;
+        float value = std::strtof(str, &str_end);
+
+        if (str_end == str || static_cast<size_t>(str_end - str) != len) {
+            throw std::invalid_argument("parse_float");
+        } else if (errno == ERANGE) {
+            throw std::out_of_range("parse_float");
+        }
+
+        return value;
+    }
+
+    float parse_float(const char* begin, const char* end) {
+        const char* p = begin;
+        bool negative = false;
+
+        if (p != end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            p++;
+        }
+
+        if (end - p >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+            return parse_float_slow(begin, end);
+        }
+
+        uint64_t mantissa = 0;
+        int num_digits = 0;
+        int exponent = 0;
+        bool any_digits = false;
+
+        // Up to 19 significant digits always fit in a uint64_t. If there are more, the value can't
+        // be represented exactly, so we fall back to the slow path.
+        while (p != end && *p >= '0' && *p <= '9') {
+            if (num_digits == 19) return parse_float_slow(begin, end);
+
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa != 0) num_digits++;
+
+            any_digits = true;
+            p++;
+        }
+
+        if (p != end && *p == '.') {
+            p++;
+
+            while (p != end && *p >= '0' && *p <= '9') {
+                if (num_digits == 19) return parse_float_slow(begin, end);
+
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa != 0) num_digits++;
+                exponent--;
+
+                any_digits = true;
+                p++;
+            }
+        }
+
+        if (!any_digits) {
+            return parse_float_slow(begin, end);
+        }
+
+        if (p != end && (*p == 'e' || *p == 'E')) {
+            p++;
+
+            bool exponent_negative = false;
+            int explicit_exponent = 0;
+
+            if (p != end && (*p == '-' || *p == '+')) {
+                exponent_negative = *p == '-';
+                p++;
+            }
+
+            if (p == end) {
+                throw std::invalid_argument("parse_float");
+            }
+
+            while (p != end && *p >= '0' && *p <= '9') {
+                if (explicit_exponent < 10000) {
+                    explicit_exponent = explicit_exponent * 10 + (*p - '0');
+                }
+
+                p++;
+            }
+
+            exponent += exponent_negative ? -explicit_exponent : explicit_exponent;
+        }
+
+        if (p != end) {
+            throw std::invalid_argument("parse_float");
+        }
+
+        if (mantissa == 0) {
+            return negative ? -0.0f : 0.0f;
+        }
+
+        // When both the mantissa and the power of 10 are exactly representable as floats, a single
+        // IEEE multiplication or division gives the correctly rounded result.
+        if (mantissa <= (UINT64_C(1) << 24) && exponent >= -10 && exponent <= 10) {
+            float value = static_cast<float>(mantissa);
+
+            value = exponent < 0 ? value / float_pow10[-exponent] : value * float_pow10[exponent];
+
+            return negative ? -value : value;
+        }
+
+        // The same holds for doubles with a wider range. Rounding the double result to a float is
+        // only wrong when the double lands exactly halfway between two floats, so those cases (and
+        // anything that isn't a normal float) are handed off to the slow path.
+        if (mantissa <= (UINT64_C(1) << 53) && exponent >= -22 && exponent <= 22) {
+            double value = static_cast<double>(mantissa);
+
+            value = exponent < 0 ? value / double_pow10[-exponent] : value * double_pow10[exponent];
+
+            uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+
+            if ((bits & UINT64_C(0x1fffffff)) != UINT64_C(0x10000000)
+                && value >= FLT_MIN && value <= FLT_MAX) {
+                float f = static_cast<float>(value);
+
+                return negative ? -f : f;
+            }
+        }
+
+        return parse_float_slow(begin, end);
+    }
+
+    int parse_int(const char* begin, const char* end) {
+        const char* p = begin;
+        bool negative = false;
+
+        if (p != end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            p++;
+        }
+
+        if (p == end) {
+            throw std::invalid_argument("parse_int");
+        }
+
+        int64_t value = 0;
+
+        while (p != end) {
+            if (*p < '0' || *p > '9') {
+                throw std::invalid_argument("parse_int");
+            }
+
+            value = value * 10 + (*p - '0');
+
+            if (value > static_cast<int64_t>(std::numeric_limits<int>::max()) + 1) {
+                throw std::out_of_range("parse_int");
+            }
+
+            p++;
+        }
+
+        if (negative) {
+            value = -value;
+        } else if (value > std::numeric_limits<int>::max()) {
+            throw std::out_of_range("parse_int");
+        }
+
+        return static_cast<int>(value);
+    }
+}
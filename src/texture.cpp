@@ -1,26 +1,109 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <set>
 #include <stb_image.h>
 #include <stdexcept>
 #include <vector>
 
+#include "glstate.hpp"
 #include "opengl.hpp"
+#include "mipmap.hpp"
 #include "texture.hpp"
+#include "texturecompress.hpp"
+
+// The sRGB variants of the S3TC formats come from EXT_texture_sRGB, which isn't part of the core
+// profile headers
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// Likewise for EXT_texture_filter_anisotropic, which only became core in OpenGL 4.6
+#ifndef GL_TEXTURE_MAX_ANISOTROPY_EXT
+#define GL_TEXTURE_MAX_ANISOTROPY_EXT 0x84FE
+#endif
+
+#ifndef GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT
+#define GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT 0x84FF
+#endif
 
 namespace hw3 {
     static std::shared_ptr<Texture2D> single_pixel_texture;
     static std::shared_ptr<Sampler2D> single_pixel_sampler;
+    static std::shared_ptr<Texture2DArray> single_pixel_array;
+    static std::shared_ptr<Sampler2DArray> single_pixel_array_sampler;
+
+    std::vector<TextureLevel> texture_levels(TextureDataFormat format, int width, int height, int num_levels) {
+        std::vector<TextureLevel> levels;
+        size_t offset = 0;
+
+        for (int i = 0; i < num_levels; i++) {
+            TextureLevel level;
+
+            level.width = std::max(width >> i, 1);
+            level.height = std::max(height >> i, 1);
+            level.size = texture_data_size(format, level.width, level.height);
+            level.offset = offset;
+
+            offset = (offset + level.size + 7) & ~static_cast<size_t>(7);
+            levels.push_back(level);
+        }
+
+        return levels;
+    }
+
+
+    // The internal format of textures in the given format, and the format of their pixels if
+    // they're uncompressed
+    static GLenum texture_internal_format(TextureDataFormat data_format, GLenum* format) {
+        switch (data_format) {
+        case TextureDataFormat::GRAYSCALE:
+            *format = GL_RED;
+            return GL_RED;
+        case TextureDataFormat::RGBA:
+            *format = GL_RGBA;
+            return GL_RGBA;
+        case TextureDataFormat::SRGBA:
+            *format = GL_RGBA;
+            return GL_SRGB_ALPHA;
+        case TextureDataFormat::BC1:
+            return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case TextureDataFormat::BC1_SRGB:
+            return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+        case TextureDataFormat::BC3:
+            return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case TextureDataFormat::BC3_SRGB:
+            return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+        case TextureDataFormat::BC4:
+            return GL_COMPRESSED_RED_RGTC1;
+        case TextureDataFormat::BC7:
+            return GL_COMPRESSED_RGBA_BPTC_UNORM;
+        case TextureDataFormat::BC7_SRGB:
+            return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+        default:
+            throw std::runtime_error("Unknown texture format");
+        }
+    }
 
     Texture2D::Texture2D(Texture2D&& other)
-        : m_id(other.m_id), m_width(other.m_width), m_height(other.m_height) {
+        : m_id(other.m_id), m_format(other.m_format), m_width(other.m_width), m_height(other.m_height),
+          m_levels(other.m_levels) {
         other.m_id = 0;
     }
 
-    Texture2D::Texture2D(TextureDataFormat format, int width, int height) : m_id(0), m_width(width), m_height(height) {
+    Texture2D::Texture2D(TextureDataFormat format, int width, int height)
+        : m_id(0), m_format(format), m_width(width), m_height(height), m_levels(0) {
         this->load_data(nullptr, format, width, height);
     }
 
     Texture2D::~Texture2D() {
         if (this->m_id != 0) {
             glDeleteTextures(1, &this->m_id);
+            gl_state::forget_texture(this->m_id);
             clear_errors();
         }
     }
@@ -28,19 +111,48 @@ namespace hw3 {
     Texture2D& Texture2D::operator =(Texture2D&& other) {
         if (this->m_id != 0) {
             glDeleteTextures(1, &this->m_id);
+            gl_state::forget_texture(this->m_id);
             clear_errors();
         }
 
         this->m_id = other.m_id;
+        this->m_format = other.m_format;
         this->m_width = other.m_width;
         this->m_height = other.m_height;
+        this->m_levels = other.m_levels;
 
         other.m_id = 0;
 
         return *this;
     }
 
-    Texture2D& Texture2D::load_data(const char* data, TextureDataFormat data_format, int width, int height) {
+    void Texture2D::tex_image(int level, const void* pixels, TextureDataFormat data_format, int width, int height) {
+        GLenum format = GL_NONE;
+        GLenum internal_format = texture_internal_format(data_format, &format);
+
+        if (texture_format_compressed(data_format)) {
+            glCompressedTexImage2D(
+                GL_TEXTURE_2D,
+                level,
+                internal_format,
+                width,
+                height,
+                0,
+                texture_data_size(data_format, width, height),
+                pixels
+            );
+        } else {
+            // Image rows are tightly packed, which matters for grayscale images with odd widths
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage2D(GL_TEXTURE_2D, level, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+        }
+
+        handle_errors();
+    }
+
+    void Texture2D::tex_levels(const char* data, TextureDataFormat data_format, const std::vector<TextureLevel>& levels) {
+        assert(!levels.empty());
+
         if (this->m_id == 0) {
             glGenTextures(1, &this->m_id);
 
@@ -54,44 +166,43 @@ namespace hw3 {
         glBindTexture(GL_TEXTURE_2D, this->m_id);
         handle_errors();
 
-        GLenum format;
-        GLenum internal_format;
+        for (size_t i = 0; i < levels.size(); i++) {
+            this->tex_image(static_cast<int>(i), data + levels[i].offset, data_format, levels[i].width, levels[i].height);
+        }
 
-        switch (data_format) {
-        case TextureDataFormat::GRAYSCALE:
-            format = GL_RED;
-            internal_format = GL_RED;
-            break;
-        case TextureDataFormat::RGBA:
-            format = GL_RGBA;
-            internal_format = GL_RGBA;
-            break;
-        case TextureDataFormat::SRGBA:
-            format = GL_RGBA;
-            internal_format = GL_SRGB_ALPHA;
-            break;
-        default:
-            throw std::runtime_error("Unknown texture format");
+        // Compressed textures can't have their mipmaps generated, so they only ever have the levels
+        // they were loaded with. Other textures may still get the rest of their levels generated.
+        if (texture_format_compressed(data_format) || levels.size() > 1) {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(levels.size() - 1));
+            handle_errors();
         }
 
+        this->m_format = data_format;
+        this->m_width = levels[0].width;
+        this->m_height = levels[0].height;
+        this->m_levels = static_cast<int>(levels.size());
+    }
+
+    Texture2D& Texture2D::load_data(const char* data, TextureDataFormat data_format, int width, int height) {
+        assert(!texture_format_compressed(data_format));
+
+        auto levels = texture_levels(data_format, width, height, 1);
+
         if (data == nullptr) {
             std::vector<glm::vec4> clear_data(width * height, glm::vec4(0));
 
-            glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, clear_data.data());
+            this->tex_levels(reinterpret_cast<const char*>(clear_data.data()), data_format, levels);
         } else {
-            glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+            this->tex_levels(data, data_format, levels);
         }
 
-        handle_errors();
-
-        this->m_width = width;
-        this->m_height = height;
-
         return *this;
     }
 
     Texture2D& Texture2D::load_subimage_data(const char* data, TextureDataFormat data_format, int x, int y, int width, int height) {
         assert(this->m_id != 0);
+        assert(!texture_format_compressed(data_format));
         assert((x + width) <= this->m_width);
         assert((y + height) <= this->m_height);
 
@@ -122,21 +233,420 @@ namespace hw3 {
     Texture2D& Texture2D::generate_mipmap() {
         assert(this->m_id != 0);
 
+        // Textures that were loaded with their mipmaps (which includes all compressed textures)
+        // already have every level they're going to get
+        if (this->m_levels > 1 || texture_format_compressed(this->m_format)) {
+            return *this;
+        }
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, this->m_id);
         glGenerateMipmap(GL_TEXTURE_2D);
         handle_errors();
 
+        this->m_levels = texture_mipmap_levels(this->m_width, this->m_height);
+
         return *this;
     }
 
-    Texture2D Texture2D::load_from_file(std::string path, TextureDataFormat data_format) {
+    size_t Texture2D::data_size() const {
+        size_t size = 0;
+
+        for (int i = 0; i < this->m_levels; i++) {
+            size += texture_data_size(
+                this->m_format,
+                std::max(this->m_width >> i, 1),
+                std::max(this->m_height >> i, 1)
+            );
+        }
+
+        return size;
+    }
+
+    Texture2D& Texture2D::load_data(const TextureImage& image) {
+        this->tex_levels(image.data(), image.format(), image.levels());
+
+        return *this;
+    }
+
+    Texture2DArray::Texture2DArray(Texture2DArray&& other)
+        : m_id(other.m_id), m_format(other.m_format), m_width(other.m_width), m_height(other.m_height),
+          m_levels(other.m_levels), m_layers(other.m_layers), m_base_level(other.m_base_level) {
+        other.m_id = 0;
+    }
+
+    Texture2DArray::~Texture2DArray() {
+        if (this->m_id != 0) {
+            glDeleteTextures(1, &this->m_id);
+            gl_state::forget_texture(this->m_id);
+            clear_errors();
+        }
+    }
+
+    Texture2DArray& Texture2DArray::operator =(Texture2DArray&& other) {
+        if (this->m_id != 0) {
+            glDeleteTextures(1, &this->m_id);
+            gl_state::forget_texture(this->m_id);
+            clear_errors();
+        }
+
+        this->m_id = other.m_id;
+        this->m_format = other.m_format;
+        this->m_width = other.m_width;
+        this->m_height = other.m_height;
+        this->m_levels = other.m_levels;
+        this->m_layers = other.m_layers;
+        this->m_base_level = other.m_base_level;
+
+        other.m_id = 0;
+
+        return *this;
+    }
+
+    void Texture2DArray::tex_image(int level, const void* pixels) {
+        int width = std::max(this->m_width >> level, 1);
+        int height = std::max(this->m_height >> level, 1);
+
+        GLenum format = GL_NONE;
+        GLenum internal_format = texture_internal_format(this->m_format, &format);
+
+        if (texture_format_compressed(this->m_format)) {
+            glCompressedTexImage3D(
+                GL_TEXTURE_2D_ARRAY,
+                level,
+                internal_format,
+                width,
+                height,
+                this->m_layers,
+                0,
+                this->level_size(level),
+                pixels
+            );
+        } else {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage3D(
+                GL_TEXTURE_2D_ARRAY,
+                level,
+                internal_format,
+                width,
+                height,
+                this->m_layers,
+                0,
+                format,
+                GL_UNSIGNED_BYTE,
+                pixels
+            );
+        }
+
+        handle_errors();
+    }
+
+    void Texture2DArray::tex_subimage(int level, int layer, const void* pixels) {
+        int width = std::max(this->m_width >> level, 1);
+        int height = std::max(this->m_height >> level, 1);
+
+        GLenum format = GL_NONE;
+        GLenum internal_format = texture_internal_format(this->m_format, &format);
+
+        if (texture_format_compressed(this->m_format)) {
+            glCompressedTexSubImage3D(
+                GL_TEXTURE_2D_ARRAY,
+                level,
+                0,
+                0,
+                layer,
+                width,
+                height,
+                1,
+                internal_format,
+                texture_data_size(this->m_format, width, height),
+                pixels
+            );
+        } else {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, format, GL_UNSIGNED_BYTE, pixels);
+        }
+
+        handle_errors();
+    }
+
+    void Texture2DArray::set_base_level(int base_level) {
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, base_level);
+        handle_errors();
+
+        this->m_base_level = base_level;
+    }
+
+    void Texture2DArray::allocate(
+        TextureDataFormat data_format,
+        int width,
+        int height,
+        int levels,
+        int layers,
+        int base_level
+    ) {
+        assert(base_level >= 0 && base_level < levels && layers > 0);
+
+        if (this->m_id == 0) {
+            glGenTextures(1, &this->m_id);
+
+            if (this->m_id == 0) {
+                clear_errors();
+                throw std::runtime_error("Failed to allocate Texture2DArray");
+            }
+        }
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, this->m_id);
+        handle_errors();
+
+        // A reused array may still have larger levels left over from before, which would go on
+        // using memory below the new base level
+        for (int i = this->m_base_level; i < std::min(base_level, this->m_levels); i++) {
+            this->tex_image(i, nullptr);
+        }
+
+        this->m_format = data_format;
+        this->m_width = width;
+        this->m_height = height;
+        this->m_levels = levels;
+        this->m_layers = layers;
+
+        for (int i = base_level; i < levels; i++) {
+            this->tex_image(i, nullptr);
+        }
+
+        // Levels below the base level are never sampled, so they don't need to exist
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        this->set_base_level(base_level);
+    }
+
+    Texture2DArray& Texture2DArray::load_data(const std::vector<std::shared_ptr<const TextureImage>>& images, int base_level) {
+        assert(!images.empty());
+
+        const TextureImage& first = *images[0];
+
+        this->allocate(
+            first.format(),
+            first.width(),
+            first.height(),
+            static_cast<int>(first.levels().size()),
+            static_cast<int>(images.size()),
+            base_level
+        );
+
+        for (size_t layer = 0; layer < images.size(); layer++) {
+            assert(images[layer]->format() == first.format() && images[layer]->levels().size() == first.levels().size());
+
+            for (int i = base_level; i < this->m_levels; i++) {
+                this->tex_subimage(i, static_cast<int>(layer), images[layer]->level_data(i));
+            }
+        }
+
+        return *this;
+    }
+
+    Texture2DArray& Texture2DArray::load_levels(const std::vector<std::shared_ptr<const TextureImage>>& images, int base_level) {
+        assert(this->m_id != 0 && static_cast<int>(images.size()) == this->m_layers);
+        assert(base_level >= 0 && base_level <= this->m_base_level);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, this->m_id);
+        handle_errors();
+
+        for (int i = base_level; i < this->m_base_level; i++) {
+            this->tex_image(i, nullptr);
+
+            for (size_t layer = 0; layer < images.size(); layer++) {
+                this->tex_subimage(i, static_cast<int>(layer), images[layer]->level_data(i));
+            }
+        }
+
+        this->set_base_level(base_level);
+
+        return *this;
+    }
+
+    Texture2DArray& Texture2DArray::load_levels(const TextureUpload& upload) {
+        assert(upload.id() != 0 && !upload.mapped());
+        assert(this->m_id != 0 && upload.format() == this->m_format && upload.layers() == this->m_layers);
+        assert(upload.end_level() == this->m_base_level);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, this->m_id);
+
+        // With a pixel unpack buffer bound, the pixel pointers are offsets into that buffer. Each
+        // level has all of its layers back to back, so it can be defined in one go.
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.id());
+        handle_errors();
+
+        for (int i = upload.first_level(); i < upload.end_level(); i++) {
+            this->tex_image(i, reinterpret_cast<const void*>(upload.offset(i)));
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        handle_errors();
+
+        this->set_base_level(upload.first_level());
+
+        return *this;
+    }
+
+    Texture2DArray& Texture2DArray::evict_levels(int base_level) {
+        assert(this->m_id != 0);
+        assert(base_level >= this->m_base_level && base_level < this->m_levels);
+
+        if (base_level == this->m_base_level) {
+            return *this;
+        }
+
+        int old_base_level = this->m_base_level;
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, this->m_id);
+        this->set_base_level(base_level);
+
+        // Redefining a level as empty is what actually lets the driver free its memory
+        GLenum format = GL_NONE;
+        GLenum internal_format = texture_internal_format(this->m_format, &format);
+
+        for (int i = old_base_level; i < base_level; i++) {
+            if (texture_format_compressed(this->m_format)) {
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, i, internal_format, 0, 0, 0, 0, 0, nullptr);
+            } else {
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, i, internal_format, 0, 0, 0, 0, format, GL_UNSIGNED_BYTE, nullptr);
+            }
+        }
+
+        handle_errors();
+
+        return *this;
+    }
+
+    size_t Texture2DArray::data_size() const {
+        size_t size = 0;
+
+        for (int i = this->m_base_level; i < this->m_levels; i++) {
+            size += this->level_size(i);
+        }
+
+        return size;
+    }
+
+    int Texture2DArray::max_layers() {
+        GLint max_layers = 0;
+
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+        handle_errors();
+
+        return max_layers;
+    }
+
+    TextureUpload::TextureUpload(const TextureImage& image, int first_level, int end_level, int layers)
+        : m_format(image.format()), m_levels(image.levels()), m_first_level(first_level), m_end_level(end_level),
+          m_layers(layers) {
+        assert(first_level >= 0 && first_level < end_level && end_level <= static_cast<int>(this->m_levels.size()));
+        assert(layers > 0);
+
+        size_t offset = 0;
+
+        for (int i = first_level; i < end_level; i++) {
+            this->m_offsets.push_back(offset);
+            offset = (offset + this->m_levels[i].size * layers + 7) & ~static_cast<size_t>(7);
+        }
+
+        this->m_offsets.push_back(offset);
+
+        glGenBuffers(1, &this->m_id);
+
+        if (this->m_id == 0) {
+            clear_errors();
+            throw std::runtime_error("Failed to allocate TextureUpload");
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->m_id);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, this->size(), nullptr, GL_STREAM_DRAW);
+
+        // The buffer stays mapped after it's unbound, which is fine as long as nothing tries to
+        // use it before it's unmapped again
+        this->m_data = static_cast<char*>(glMapBufferRange(
+            GL_PIXEL_UNPACK_BUFFER,
+            0,
+            this->size(),
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT
+        ));
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        if (this->m_data == nullptr) {
+            clear_errors();
+            glDeleteBuffers(1, &this->m_id);
+
+            throw std::runtime_error("Failed to map TextureUpload");
+        }
+
+        handle_errors();
+    }
+
+    TextureUpload::~TextureUpload() {
+        // Deleting a buffer unmaps it implicitly
+        glDeleteBuffers(1, &this->m_id);
+        clear_errors();
+    }
+
+    void TextureUpload::copy_layer(int layer, const TextureImage& image) const {
+        assert(this->m_data != nullptr && layer >= 0 && layer < this->m_layers);
+        assert(image.format() == this->m_format && image.levels().size() == this->m_levels.size());
+
+        for (int i = this->m_first_level; i < this->m_end_level; i++) {
+            size_t size = this->m_levels[i].size;
+
+            std::memcpy(this->m_data + this->offset(i) + size * layer, image.level_data(i), size);
+        }
+    }
+
+    bool TextureUpload::finish() {
+        assert(this->m_data != nullptr);
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->m_id);
+        GLboolean intact = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        handle_errors();
+
+        this->m_data = nullptr;
+
+        return intact == GL_TRUE;
+    }
+
+    void TextureImage::Deleter::operator ()(char* data) const {
+        stbi_image_free(data);
+    }
+
+    TextureImage TextureImage::load_from_file(
+        const std::string& path,
+        TextureDataFormat data_format,
+        MipmapFilter mipmap_filter
+    ) {
+        TextureImage image;
+
+        if (TextureImage::load_container(path, data_format, image)) {
+            return image;
+        }
+
+        if (TextureImage::load_cache(path, data_format, mipmap_filter, image)) {
+            return image;
+        }
+
+        TextureDataFormat decoded_format = texture_decoded_format(data_format);
         int width, height, channels;
 
-        switch (data_format) {
+        switch (decoded_format) {
         case TextureDataFormat::GRAYSCALE:
             channels = 1;
             break;
         case TextureDataFormat::RGBA:
         case TextureDataFormat::SRGBA:
+        default:
             channels = 4;
             break;
         }
@@ -152,15 +662,63 @@ namespace hw3 {
             })());
         }
 
-        Texture2D tex = std::move(
+        image.m_pixels.reset(data);
+
+        // BC1 can't store alpha beyond a 1-bit cutout, so images that have any use BC3 instead
+        TextureDataFormat format = data_format;
+
+        if (format == TextureDataFormat::BC1 && texture_has_alpha(data, width, height)) {
+            format = TextureDataFormat::BC3;
+        } else if (format == TextureDataFormat::BC1_SRGB && texture_has_alpha(data, width, height)) {
+            format = TextureDataFormat::BC3_SRGB;
+        }
+
+        // The whole mipmap chain is built here rather than by OpenGL, which can't generate mipmaps
+        // for compressed textures anyway, so that it can be cached along with the base level. This
+        // also keeps the main thread from stalling in glGenerateMipmap, and filters in linear
+        // space regardless of how the driver would have.
+        auto levels = texture_levels(format, width, height, texture_mipmap_levels(width, height));
+        auto mipmaps = build_mipmaps(data, width, height, decoded_format, mipmap_filter);
+
+        image.m_buffer.resize(levels.back().offset + levels.back().size);
+
+        for (size_t i = 0; i < levels.size(); i++) {
+            const char* pixels = i == 0 ? data : mipmaps[i - 1].data();
+            char* out = image.m_buffer.data() + levels[i].offset;
+
+            if (texture_format_compressed(format)) {
+                compress_texture(pixels, levels[i].width, levels[i].height, format, out);
+            } else {
+                std::memcpy(out, pixels, levels[i].size);
+            }
+        }
+
+        image.m_pixels.reset();
+        image.m_data = image.m_buffer.data();
+        image.m_format = format;
+        image.m_levels = std::move(levels);
+
+        image.write_cache(path, data_format, mipmap_filter);
+
+        // Switch over to the cache that was just written, which is still in the page cache, so
+        // that the built image's buffer can be freed
+        TextureImage cached;
+
+        if (TextureImage::load_cache(path, data_format, mipmap_filter, cached)) {
+            return cached;
+        }
+
+        return image;
+    }
+
+    Texture2D Texture2D::load_from_file(std::string path, TextureDataFormat data_format) {
+        auto image = TextureImage::load_from_file(path, data_format, MipmapFilter::KAISER);
+
+        return std::move(
             Texture2D()
-                .load_data(data, data_format, width, height)
+                .load_data(image)
                 .generate_mipmap()
         );
-
-        stbi_image_free(data);
-
-        return std::move(tex);
     }
 
     std::shared_ptr<Texture2D> Texture2D::single_pixel() {
@@ -184,6 +742,23 @@ namespace hw3 {
         return single_pixel_texture;
     }
 
+    std::shared_ptr<Texture2DArray> Texture2DArray::single_pixel() {
+        if (!single_pixel_array) {
+            char data[4] = {
+                static_cast<char>(0xff),
+                static_cast<char>(0xff),
+                static_cast<char>(0xff),
+                static_cast<char>(0xff)
+            };
+
+            single_pixel_array = std::make_shared<Texture2DArray>();
+            single_pixel_array->allocate(TextureDataFormat::RGBA, 1, 1, 1, 1, 0);
+            single_pixel_array->tex_subimage(0, 0, data);
+        }
+
+        return single_pixel_array;
+    }
+
     Sampler2D::Sampler2D(Sampler2D&& other)
         : m_id(other.m_id), m_texture(std::move(other.m_texture)) {
         other.m_id = 0;
@@ -195,14 +770,16 @@ namespace hw3 {
 
     Sampler2D::~Sampler2D() {
         if (this->m_id != 0) {
-            glDeleteTextures(1, &this->m_id);
+            glDeleteSamplers(1, &this->m_id);
+            gl_state::forget_sampler(this->m_id);
             clear_errors();
         }
     }
 
     Sampler2D& Sampler2D::operator =(Sampler2D&& other) {
         if (this->m_id != 0) {
-            glDeleteTextures(1, &this->m_id);
+            glDeleteSamplers(1, &this->m_id);
+            gl_state::forget_sampler(this->m_id);
             clear_errors();
         }
 
@@ -252,10 +829,11 @@ namespace hw3 {
     void Sampler2D::bind(GLuint unit) const {
         assert(this->m_id != 0);
 
-        glActiveTexture(GL_TEXTURE0 + unit);
-        glBindTexture(GL_TEXTURE_2D, this->m_texture->id());
-        glBindSampler(unit, this->m_id);
-        handle_errors();
+        // Textures that haven't been loaded yet are drawn as a single white pixel
+        GLuint texture_id = *this->m_texture ? this->m_texture->id() : Texture2D::single_pixel()->id();
+
+        gl_state::bind_texture(unit, GL_TEXTURE_2D, texture_id);
+        gl_state::bind_sampler(unit, this->m_id);
     }
 
     std::shared_ptr<Sampler2D> Sampler2D::single_pixel() {
@@ -265,4 +843,183 @@ namespace hw3 {
 
         return single_pixel_sampler;
     }
+
+    Sampler::Sampler(Sampler&& other) : m_id(other.m_id), m_state(other.m_state) {
+        other.m_id = 0;
+    }
+
+    Sampler::Sampler(const SamplerState& state) : m_id(0), m_state(state) {
+        this->m_state.anisotropy = std::min(std::max(state.anisotropy, 1.0f), Sampler::max_anisotropy());
+
+        glGenSamplers(1, &this->m_id);
+
+        if (this->m_id == 0) {
+            clear_errors();
+            throw std::runtime_error("Failed to allocate Sampler");
+        }
+
+        glSamplerParameteri(this->m_id, GL_TEXTURE_MAG_FILTER, (GLint)this->m_state.upsample);
+        glSamplerParameteri(this->m_id, GL_TEXTURE_MIN_FILTER, (GLint)this->m_state.downsample);
+        glSamplerParameteri(this->m_id, GL_TEXTURE_WRAP_S, (GLint)this->m_state.wrap_x);
+        glSamplerParameteri(this->m_id, GL_TEXTURE_WRAP_T, (GLint)this->m_state.wrap_y);
+
+        // Drivers without anisotropic filtering don't know the parameter at all
+        if (this->m_state.anisotropy > 1) {
+            glSamplerParameterf(this->m_id, GL_TEXTURE_MAX_ANISOTROPY_EXT, this->m_state.anisotropy);
+        }
+
+        handle_errors();
+    }
+
+    Sampler::~Sampler() {
+        if (this->m_id != 0) {
+            glDeleteSamplers(1, &this->m_id);
+            gl_state::forget_sampler(this->m_id);
+            clear_errors();
+        }
+    }
+
+    Sampler& Sampler::operator =(Sampler&& other) {
+        if (this->m_id != 0) {
+            glDeleteSamplers(1, &this->m_id);
+            gl_state::forget_sampler(this->m_id);
+            clear_errors();
+        }
+
+        this->m_id = other.m_id;
+        this->m_state = other.m_state;
+
+        other.m_id = 0;
+
+        return *this;
+    }
+
+    float Sampler::max_anisotropy() {
+        static float max_anisotropy = 0;
+
+        if (max_anisotropy == 0) {
+            GLfloat value = 1;
+
+            // Anisotropic filtering is only core since OpenGL 4.6, but almost every driver supports
+            // it as an extension. Those that don't reject the query.
+            glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &value);
+
+            if (glGetError() != GL_NO_ERROR) {
+                clear_errors();
+                value = 1;
+            }
+
+            max_anisotropy = std::max(value, 1.0f);
+        }
+
+        return max_anisotropy;
+    }
+
+    std::shared_ptr<const Sampler> SamplerCache::get(SamplerState state) {
+        // States that only differ in anisotropy the driver doesn't support end up the same
+        state.anisotropy = std::min(std::max(state.anisotropy, 1.0f), Sampler::max_anisotropy());
+
+        auto it = this->m_samplers.find(state);
+
+        if (it != this->m_samplers.end()) {
+            return it->second;
+        }
+
+        auto sampler = std::make_shared<const Sampler>(state);
+
+        this->m_samplers.emplace(state, sampler);
+
+        return sampler;
+    }
+
+    void Sampler2DArray::bind(GLuint unit) const {
+        assert(this->m_sampler && *this->m_sampler);
+
+        // Layers that haven't been loaded yet are drawn as a single white pixel, which is layer 0
+        // of its own array
+        const auto& texture = this->m_layer->texture;
+        GLuint texture_id = texture ? texture->id() : Texture2DArray::single_pixel()->id();
+
+        gl_state::bind_texture(unit, GL_TEXTURE_2D_ARRAY, texture_id);
+        gl_state::bind_sampler(unit, this->m_sampler->id());
+    }
+
+    std::shared_ptr<Sampler2DArray> Sampler2DArray::single_pixel() {
+        if (!single_pixel_array_sampler) {
+            auto layer = std::make_shared<TextureLayer>();
+
+            layer->texture = Texture2DArray::single_pixel();
+            single_pixel_array_sampler = std::make_shared<Sampler2DArray>(
+                layer,
+                std::make_shared<const Sampler>(SamplerState())
+            );
+        }
+
+        return single_pixel_array_sampler;
+    }
+
+    std::shared_ptr<TextureLayer> TextureCache::get(
+        const boost::filesystem::path& path,
+        TextureDataFormat format,
+        MipmapFilter mipmap_filter,
+        const std::function<void (const std::shared_ptr<TextureLayer>&, const std::string&)>& load
+    ) {
+        boost::system::error_code ec;
+        auto canonical = boost::filesystem::canonical(path, ec);
+
+        // Files that can't be resolved are keyed by their path as given, and will fail to load
+        if (ec) {
+            canonical = path;
+        }
+
+        auto key = std::make_tuple(canonical.string(), format, mipmap_filter);
+        auto it = this->m_layers.find(key);
+
+        if (it != this->m_layers.end()) {
+            this->m_hits++;
+            return it->second;
+        }
+
+        auto layer = std::make_shared<TextureLayer>();
+
+        this->m_misses++;
+        this->m_layers.emplace(key, layer);
+
+        load(layer, std::get<0>(key));
+
+        return layer;
+    }
+
+    TextureCacheStats TextureCache::stats() const {
+        TextureCacheStats stats;
+        std::set<const Texture2DArray*> arrays;
+
+        stats.hits = this->m_hits;
+        stats.misses = this->m_misses;
+
+        for (const auto& entry : this->m_layers) {
+            const Texture2DArray* texture = entry.second->texture.get();
+
+            // Layers of the same array are counted together
+            if (!texture || !*texture || !arrays.insert(texture).second) {
+                continue;
+            }
+
+            TextureDataFormat uncompressed_format = texture_decoded_format(texture->format());
+
+            stats.bytes += texture->data_size();
+
+            for (int i = texture->base_level(); i < texture->levels(); i++) {
+                stats.uncompressed_bytes += texture_data_size(
+                    uncompressed_format,
+                    std::max(texture->size().x >> i, 1),
+                    std::max(texture->size().y >> i, 1)
+                ) * texture->layers();
+            }
+        }
+
+        stats.arrays = arrays.size();
+
+        return stats;
+    }
 }
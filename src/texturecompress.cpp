@@ -0,0 +1,658 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "assetloader.hpp"
+#include "texturecompress.hpp"
+
+namespace hw3 {
+    // Images with fewer rows of blocks than this per thread are compressed on the calling thread
+    static constexpr int min_block_rows_per_thread = 16;
+
+    static const int bc7_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    /*
+     * The texels of a 4x4 block, one array per channel so that the index search can handle four
+     * texels at a time. Unused channels are left at zero.
+     */
+    struct BlockTexels {
+        alignas(16) float c[4][16];
+    };
+
+    static BlockTexels load_block(const uint8_t* texels, int channels) {
+        BlockTexels block;
+
+        std::memset(&block, 0, sizeof(block));
+
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < channels; c++) {
+                block.c[c][i] = texels[i * channels + c];
+            }
+        }
+
+        return block;
+    }
+
+    /*
+     * Picks the closest palette entry for every texel of the block and returns the total squared
+     * error. Palette entries must have all four channels filled in, using zero for unused ones.
+     */
+    static float select_indices(const BlockTexels& block, const float (*palette)[4], int palette_size, uint8_t* indices) {
+        float total_error = 0;
+
+#ifdef __SSE2__
+        for (int i = 0; i < 16; i += 4) {
+            __m128 r = _mm_load_ps(block.c[0] + i);
+            __m128 g = _mm_load_ps(block.c[1] + i);
+            __m128 b = _mm_load_ps(block.c[2] + i);
+            __m128 a = _mm_load_ps(block.c[3] + i);
+
+            __m128 best_error = _mm_set1_ps(FLT_MAX);
+            __m128i best_index = _mm_setzero_si128();
+
+            for (int j = 0; j < palette_size; j++) {
+                __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[j][0]));
+                __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[j][1]));
+                __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[j][2]));
+                __m128 da = _mm_sub_ps(a, _mm_set1_ps(palette[j][3]));
+
+                __m128 error = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)),
+                    _mm_add_ps(_mm_mul_ps(db, db), _mm_mul_ps(da, da))
+                );
+                __m128i closer = _mm_castps_si128(_mm_cmplt_ps(error, best_error));
+
+                best_error = _mm_min_ps(error, best_error);
+                best_index = _mm_or_si128(
+                    _mm_andnot_si128(closer, best_index),
+                    _mm_and_si128(closer, _mm_set1_epi32(j))
+                );
+            }
+
+            alignas(16) int32_t lane_index[4];
+            alignas(16) float lane_error[4];
+
+            _mm_store_si128(reinterpret_cast<__m128i*>(lane_index), best_index);
+            _mm_store_ps(lane_error, best_error);
+
+            for (int k = 0; k < 4; k++) {
+                indices[i + k] = static_cast<uint8_t>(lane_index[k]);
+                total_error += lane_error[k];
+            }
+        }
+#else
+        for (int i = 0; i < 16; i++) {
+            float best_error = FLT_MAX;
+            int best_index = 0;
+
+            for (int j = 0; j < palette_size; j++) {
+                float error = 0;
+
+                for (int c = 0; c < 4; c++) {
+                    float d = block.c[c][i] - palette[j][c];
+                    error += d * d;
+                }
+
+                if (error < best_error) {
+                    best_error = error;
+                    best_index = j;
+                }
+            }
+
+            indices[i] = static_cast<uint8_t>(best_index);
+            total_error += best_error;
+        }
+#endif
+
+        return total_error;
+    }
+
+    /*
+     * Fits a line through the texels of the block along their principal axis, found by power
+     * iteration on the covariance matrix, and returns the points on it that bound the texels.
+     */
+    static void fit_endpoints(const BlockTexels& block, int channels, float* e0, float* e1) {
+        float mean[4] = { 0, 0, 0, 0 };
+        float min[4] = { 255, 255, 255, 255 };
+        float max[4] = { 0, 0, 0, 0 };
+
+        for (int c = 0; c < channels; c++) {
+            for (int i = 0; i < 16; i++) {
+                mean[c] += block.c[c][i];
+                min[c] = std::min(min[c], block.c[c][i]);
+                max[c] = std::max(max[c], block.c[c][i]);
+            }
+
+            mean[c] /= 16;
+        }
+
+        float cov[4][4] = {};
+
+        for (int i = 0; i < 16; i++) {
+            for (int c0 = 0; c0 < channels; c0++) {
+                for (int c1 = c0; c1 < channels; c1++) {
+                    cov[c0][c1] += (block.c[c0][i] - mean[c0]) * (block.c[c1][i] - mean[c1]);
+                }
+            }
+        }
+
+        for (int c0 = 0; c0 < channels; c0++) {
+            for (int c1 = 0; c1 < c0; c1++) {
+                cov[c0][c1] = cov[c1][c0];
+            }
+        }
+
+        // Start from the diagonal of the bounding box, which is already close for most blocks
+        float axis[4] = { 0, 0, 0, 0 };
+
+        for (int c = 0; c < channels; c++) {
+            axis[c] = max[c] - min[c];
+        }
+
+        for (int iteration = 0; iteration < 8; iteration++) {
+            float next[4] = { 0, 0, 0, 0 };
+            float length = 0;
+
+            for (int c0 = 0; c0 < channels; c0++) {
+                for (int c1 = 0; c1 < channels; c1++) {
+                    next[c0] += cov[c0][c1] * axis[c1];
+                }
+
+                length = std::max(length, std::abs(next[c0]));
+            }
+
+            if (length < 1e-6f) {
+                break;
+            }
+
+            for (int c = 0; c < channels; c++) {
+                axis[c] = next[c] / length;
+            }
+        }
+
+        float length_sq = 0;
+
+        for (int c = 0; c < channels; c++) {
+            length_sq += axis[c] * axis[c];
+        }
+
+        float t_min = 0;
+        float t_max = 0;
+
+        if (length_sq > 1e-12f) {
+            t_min = FLT_MAX;
+            t_max = -FLT_MAX;
+
+            for (int i = 0; i < 16; i++) {
+                float t = 0;
+
+                for (int c = 0; c < channels; c++) {
+                    t += (block.c[c][i] - mean[c]) * axis[c];
+                }
+
+                t_min = std::min(t_min, t);
+                t_max = std::max(t_max, t);
+            }
+
+            t_min /= length_sq;
+            t_max /= length_sq;
+        }
+
+        for (int c = 0; c < channels; c++) {
+            e0[c] = std::min(std::max(mean[c] + axis[c] * t_min, 0.0f), 255.0f);
+            e1[c] = std::min(std::max(mean[c] + axis[c] * t_max, 0.0f), 255.0f);
+        }
+    }
+
+    /*
+     * Given the index chosen for each texel and the fraction of the way from e0 to e1 that each
+     * index stands for, solves for the endpoints that minimize the squared error. Returns false if
+     * the system is degenerate, e.g. because every texel uses the same index.
+     */
+    static bool refine_endpoints(
+        const BlockTexels& block,
+        int channels,
+        const uint8_t* indices,
+        const float* fractions,
+        float* e0,
+        float* e1
+    ) {
+        float aa = 0, ab = 0, bb = 0;
+        float ax[4] = { 0, 0, 0, 0 };
+        float bx[4] = { 0, 0, 0, 0 };
+
+        for (int i = 0; i < 16; i++) {
+            float b = fractions[indices[i]];
+            float a = 1 - b;
+
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+
+            for (int c = 0; c < channels; c++) {
+                ax[c] += a * block.c[c][i];
+                bx[c] += b * block.c[c][i];
+            }
+        }
+
+        float det = aa * bb - ab * ab;
+
+        if (std::abs(det) < 1e-6f) {
+            return false;
+        }
+
+        for (int c = 0; c < channels; c++) {
+            e0[c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / det, 0.0f), 255.0f);
+            e1[c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / det, 0.0f), 255.0f);
+        }
+
+        return true;
+    }
+
+    class BitWriter {
+        uint8_t* m_out;
+        int m_pos = 0;
+    public:
+        BitWriter(uint8_t* out, size_t size) : m_out(out) {
+            std::memset(out, 0, size);
+        }
+
+        void write(uint32_t value, int bits) {
+            for (int i = 0; i < bits; i++, this->m_pos++) {
+                if ((value >> i) & 1) {
+                    this->m_out[this->m_pos / 8] |= static_cast<uint8_t>(1 << (this->m_pos % 8));
+                }
+            }
+        }
+    };
+
+    static uint16_t pack_565(const float* color) {
+        int r = static_cast<int>(std::round(color[0] * 31 / 255));
+        int g = static_cast<int>(std::round(color[1] * 63 / 255));
+        int b = static_cast<int>(std::round(color[2] * 31 / 255));
+
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    static void unpack_565(uint16_t value, float* color) {
+        int r = (value >> 11) & 31;
+        int g = (value >> 5) & 63;
+        int b = value & 31;
+
+        color[0] = static_cast<float>((r << 3) | (r >> 2));
+        color[1] = static_cast<float>((g << 2) | (g >> 4));
+        color[2] = static_cast<float>((b << 3) | (b >> 2));
+        color[3] = 0;
+    }
+
+    // Quantizes the endpoints and chooses indices, returning the total squared error
+    static float encode_bc1_endpoints(
+        const BlockTexels& block,
+        const float* e0,
+        const float* e1,
+        uint16_t& c0,
+        uint16_t& c1,
+        uint8_t* indices
+    ) {
+        c0 = pack_565(e1);
+        c1 = pack_565(e0);
+
+        // The palette only has four colours when the first endpoint is the larger one
+        if (c0 < c1) {
+            std::swap(c0, c1);
+        }
+
+        float palette[4][4];
+
+        unpack_565(c0, palette[0]);
+        unpack_565(c1, palette[1]);
+
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        palette[2][3] = palette[3][3] = 0;
+
+        // With equal endpoints the block is in three-colour mode, where index 3 means black
+        if (c0 == c1) {
+            std::memset(indices, 0, 16);
+
+            float error = 0;
+
+            for (int i = 0; i < 16; i++) {
+                for (int c = 0; c < 3; c++) {
+                    float d = block.c[c][i] - palette[0][c];
+                    error += d * d;
+                }
+            }
+
+            return error;
+        }
+
+        return select_indices(block, palette, 4, indices);
+    }
+
+    static void write_bc1(const BlockTexels& block, uint8_t* out) {
+        // The fraction of the way from the colour of index 0 to the colour of index 1
+        static const float fractions[4] = { 0.0f, 1.0f, 1.0f / 3, 2.0f / 3 };
+
+        float e0[4], e1[4];
+
+        fit_endpoints(block, 3, e0, e1);
+
+        // Pull the endpoints in slightly, since the extremes of a block are usually outliers
+        for (int c = 0; c < 3; c++) {
+            float inset = (e1[c] - e0[c]) / 16;
+
+            e0[c] += inset;
+            e1[c] -= inset;
+        }
+
+        uint16_t c0, c1;
+        uint8_t indices[16];
+        float error = encode_bc1_endpoints(block, e0, e1, c0, c1, indices);
+
+        if (c0 != c1 && refine_endpoints(block, 3, indices, fractions, e0, e1)) {
+            uint16_t refined_c0, refined_c1;
+            uint8_t refined_indices[16];
+
+            // encode_bc1_endpoints puts its second endpoint first, which is where e0 now belongs
+            float refined_error = encode_bc1_endpoints(block, e1, e0, refined_c0, refined_c1, refined_indices);
+
+            if (refined_error < error) {
+                c0 = refined_c0;
+                c1 = refined_c1;
+                std::memcpy(indices, refined_indices, sizeof(indices));
+            }
+        }
+
+        BitWriter bits(out, 8);
+
+        bits.write(c0, 16);
+        bits.write(c1, 16);
+
+        for (int i = 0; i < 16; i++) {
+            bits.write(indices[i], 2);
+        }
+    }
+
+    // Encodes an 8-byte BC4 block from the first channel of the block's texels
+    static void write_bc4(const BlockTexels& block, uint8_t* out) {
+        float min = 255, max = 0;
+
+        for (int i = 0; i < 16; i++) {
+            min = std::min(min, block.c[0][i]);
+            max = std::max(max, block.c[0][i]);
+        }
+
+        uint8_t a0 = static_cast<uint8_t>(max);
+        uint8_t a1 = static_cast<uint8_t>(min);
+        uint8_t indices[16];
+
+        if (a0 == a1) {
+            std::memset(indices, 0, sizeof(indices));
+        } else {
+            // Indices 0 and 1 are the endpoints, and 2-7 are evenly spaced between them
+            float palette[8][4] = {};
+
+            palette[0][0] = a0;
+            palette[1][0] = a1;
+
+            for (int i = 2; i < 8; i++) {
+                palette[i][0] = static_cast<float>(((8 - i) * a0 + (i - 1) * a1) / 7);
+            }
+
+            BlockTexels values;
+
+            std::memset(&values, 0, sizeof(values));
+            std::memcpy(values.c[0], block.c[0], sizeof(values.c[0]));
+
+            select_indices(values, palette, 8, indices);
+        }
+
+        BitWriter bits(out, 8);
+
+        bits.write(a0, 8);
+        bits.write(a1, 8);
+
+        for (int i = 0; i < 16; i++) {
+            bits.write(indices[i], 3);
+        }
+    }
+
+    // Quantizes an endpoint to 7 bits per channel plus a shared lowest bit (the p-bit)
+    static void quantize_bc7_endpoint(const float* e, int* q, int& p) {
+        float best_error = FLT_MAX;
+
+        for (int pbit = 0; pbit < 2; pbit++) {
+            int candidate[4];
+            float error = 0;
+
+            for (int c = 0; c < 4; c++) {
+                candidate[c] = std::min(std::max(static_cast<int>(std::round((e[c] - pbit) / 2)), 0), 127);
+
+                float d = static_cast<float>((candidate[c] << 1) | pbit) - e[c];
+                error += d * d;
+            }
+
+            if (error < best_error) {
+                best_error = error;
+                p = pbit;
+                std::copy(candidate, candidate + 4, q);
+            }
+        }
+    }
+
+    static float encode_bc7_endpoints(
+        const BlockTexels& block,
+        const float* e0,
+        const float* e1,
+        int* q0,
+        int* q1,
+        int& p0,
+        int& p1,
+        uint8_t* indices
+    ) {
+        quantize_bc7_endpoint(e0, q0, p0);
+        quantize_bc7_endpoint(e1, q1, p1);
+
+        float palette[16][4];
+
+        for (int c = 0; c < 4; c++) {
+            int v0 = (q0[c] << 1) | p0;
+            int v1 = (q1[c] << 1) | p1;
+
+            for (int i = 0; i < 16; i++) {
+                palette[i][c] = static_cast<float>(((64 - bc7_weights[i]) * v0 + bc7_weights[i] * v1 + 32) >> 6);
+            }
+        }
+
+        return select_indices(block, palette, 16, indices);
+    }
+
+    static void write_bc7(const BlockTexels& block, uint8_t* out) {
+        static const float fractions[16] = {
+            0 / 64.0f, 4 / 64.0f, 9 / 64.0f, 13 / 64.0f, 17 / 64.0f, 21 / 64.0f, 26 / 64.0f, 30 / 64.0f,
+            34 / 64.0f, 38 / 64.0f, 43 / 64.0f, 47 / 64.0f, 51 / 64.0f, 55 / 64.0f, 60 / 64.0f, 64 / 64.0f
+        };
+
+        float e0[4], e1[4];
+
+        fit_endpoints(block, 4, e0, e1);
+
+        int q0[4], q1[4], p0, p1;
+        uint8_t indices[16];
+        float error = encode_bc7_endpoints(block, e0, e1, q0, q1, p0, p1, indices);
+
+        if (refine_endpoints(block, 4, indices, fractions, e0, e1)) {
+            int refined_q0[4], refined_q1[4], refined_p0, refined_p1;
+            uint8_t refined_indices[16];
+            float refined_error = encode_bc7_endpoints(
+                block, e0, e1, refined_q0, refined_q1, refined_p0, refined_p1, refined_indices
+            );
+
+            if (refined_error < error) {
+                std::copy(refined_q0, refined_q0 + 4, q0);
+                std::copy(refined_q1, refined_q1 + 4, q1);
+                p0 = refined_p0;
+                p1 = refined_p1;
+                std::memcpy(indices, refined_indices, sizeof(indices));
+            }
+        }
+
+        // The first texel's index is stored without its top bit, so it must be below 8
+        if (indices[0] >= 8) {
+            std::swap_ranges(q0, q0 + 4, q1);
+            std::swap(p0, p1);
+
+            for (int i = 0; i < 16; i++) {
+                indices[i] = 15 - indices[i];
+            }
+        }
+
+        BitWriter bits(out, 16);
+
+        // Mode 6 is signalled by six zero bits followed by a one
+        bits.write(1 << 6, 7);
+
+        for (int c = 0; c < 4; c++) {
+            bits.write(q0[c], 7);
+            bits.write(q1[c], 7);
+        }
+
+        bits.write(p0, 1);
+        bits.write(p1, 1);
+        bits.write(indices[0], 3);
+
+        for (int i = 1; i < 16; i++) {
+            bits.write(indices[i], 4);
+        }
+    }
+
+    void compress_bc1_block(const uint8_t* rgba, uint8_t* out) {
+        BlockTexels block = load_block(rgba, 4);
+
+        std::memset(block.c[3], 0, sizeof(block.c[3]));
+        write_bc1(block, out);
+    }
+
+    void compress_bc3_block(const uint8_t* rgba, uint8_t* out) {
+        BlockTexels block = load_block(rgba, 4);
+        BlockTexels alpha;
+
+        std::memset(&alpha, 0, sizeof(alpha));
+        std::memcpy(alpha.c[0], block.c[3], sizeof(alpha.c[0]));
+        std::memset(block.c[3], 0, sizeof(block.c[3]));
+
+        write_bc4(alpha, out);
+        write_bc1(block, out + 8);
+    }
+
+    void compress_bc4_block(const uint8_t* values, uint8_t* out) {
+        write_bc4(load_block(values, 1), out);
+    }
+
+    void compress_bc7_block(const uint8_t* rgba, uint8_t* out) {
+        write_bc7(load_block(rgba, 4), out);
+    }
+
+    void compress_texture(
+        const char* pixels,
+        int width,
+        int height,
+        TextureDataFormat dst_format,
+        char* out
+    ) {
+        void (*compress_block)(const uint8_t*, uint8_t*);
+
+        switch (dst_format) {
+        case TextureDataFormat::BC1:
+        case TextureDataFormat::BC1_SRGB:
+            compress_block = compress_bc1_block;
+            break;
+        case TextureDataFormat::BC3:
+        case TextureDataFormat::BC3_SRGB:
+            compress_block = compress_bc3_block;
+            break;
+        case TextureDataFormat::BC4:
+            compress_block = compress_bc4_block;
+            break;
+        case TextureDataFormat::BC7:
+        case TextureDataFormat::BC7_SRGB:
+            compress_block = compress_bc7_block;
+            break;
+        default:
+            throw std::runtime_error("Unknown compressed texture format");
+        }
+
+        size_t pixel_size = texture_pixel_size(texture_decoded_format(dst_format));
+        size_t block_size = texture_block_size(dst_format);
+        int blocks_x = (width + 3) / 4;
+        int blocks_y = (height + 3) / 4;
+
+        auto compress_rows = [&](int begin, int end) {
+            uint8_t texels[16 * 4];
+
+            for (int by = begin; by < end; by++) {
+                for (int bx = 0; bx < blocks_x; bx++) {
+                    // Blocks that hang over the edge of the image repeat its last row or column
+                    for (int y = 0; y < 4; y++) {
+                        int sy = std::min(by * 4 + y, height - 1);
+
+                        for (int x = 0; x < 4; x++) {
+                            int sx = std::min(bx * 4 + x, width - 1);
+
+                            std::memcpy(
+                                texels + (y * 4 + x) * pixel_size,
+                                pixels + (static_cast<size_t>(sy) * width + sx) * pixel_size,
+                                pixel_size
+                            );
+                        }
+                    }
+
+                    compress_block(
+                        texels,
+                        reinterpret_cast<uint8_t*>(out) + (static_cast<size_t>(by) * blocks_x + bx) * block_size
+                    );
+                }
+            }
+        };
+
+        int num_threads = std::max(1, std::min(
+            static_cast<int>(AssetLoader::worker_threads()),
+            blocks_y / min_block_rows_per_thread
+        ));
+        std::vector<std::thread> threads;
+
+        for (int i = 1; i < num_threads; i++) {
+            threads.emplace_back(compress_rows, blocks_y * i / num_threads, blocks_y * (i + 1) / num_threads);
+        }
+
+        compress_rows(0, blocks_y / num_threads);
+
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+    bool texture_has_alpha(const char* pixels, int width, int height) {
+        const uint8_t* texels = reinterpret_cast<const uint8_t*>(pixels);
+        size_t num_texels = static_cast<size_t>(width) * height;
+
+        for (size_t i = 0; i < num_texels; i++) {
+            if (texels[i * 4 + 3] != 255) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+}
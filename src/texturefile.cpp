@@ -0,0 +1,388 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "cachefile.hpp"
+#include "mipmap.hpp"
+#include "texture.hpp"
+
+namespace hw3 {
+    // Bump this whenever the layout of the cache file or the way mipmaps are built or compressed
+    // changes.
+    static constexpr uint32_t texture_cache_version = 3;
+    static const char texture_cache_magic[8] = { 'H', 'W', '3', 'T', 'E', 'X', '\0', '\0' };
+
+    /*
+     * A texture cache file consists of this header, followed by the canonical path of the source
+     * image, padded to a multiple of 8 bytes, and then the mipmap levels of the texture, laid out
+     * as by texture_levels.
+     */
+    struct TextureCacheHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t requested_format;
+        uint32_t mipmap_filter;
+        uint32_t reserved;
+
+        uint64_t source_size;
+        int64_t source_mtime_sec;
+        int64_t source_mtime_nsec;
+
+        uint64_t path_length;
+
+        uint32_t format;
+        uint32_t num_levels;
+        int32_t width;
+        int32_t height;
+    };
+
+    static_assert(sizeof(TextureCacheHeader) % 8 == 0, "Texture cache header must be 8-byte aligned");
+
+    static const char* format_extension(TextureDataFormat format) {
+        switch (format) {
+        case TextureDataFormat::GRAYSCALE: return ".gray";
+        case TextureDataFormat::RGBA: return ".rgba";
+        case TextureDataFormat::SRGBA: return ".srgba";
+        case TextureDataFormat::BC1: return ".bc1";
+        case TextureDataFormat::BC1_SRGB: return ".bc1srgb";
+        case TextureDataFormat::BC3: return ".bc3";
+        case TextureDataFormat::BC3_SRGB: return ".bc3srgb";
+        case TextureDataFormat::BC4: return ".bc4";
+        case TextureDataFormat::BC7: return ".bc7";
+        case TextureDataFormat::BC7_SRGB: return ".bc7srgb";
+        }
+
+        return "";
+    }
+
+    // The same image may be used as several kinds of map (e.g. as a colour map and as an ambient
+    // occlusion map), so each format gets its own cache file rather than replacing the others.
+    static boost::filesystem::path cache_path(const boost::filesystem::path& path, TextureDataFormat format) {
+        return boost::filesystem::path(path.native() + format_extension(format) + ".hw3tex");
+    }
+
+    static std::runtime_error texture_file_error(const boost::filesystem::path& path, const char* what) {
+        std::ostringstream ss;
+
+        ss << "Failed to read texture from file " << path.string() << ": " << what;
+
+        return std::runtime_error(ss.str());
+    }
+
+    static uint32_t read_u32(const char* data) {
+        uint32_t value;
+
+        std::memcpy(&value, data, sizeof(value));
+
+        return value;
+    }
+
+    static bool is_compressed_color(TextureDataFormat format) {
+        return texture_format_compressed(format) && format != TextureDataFormat::BC4;
+    }
+
+    static TextureDataFormat dds_format(uint32_t fourcc, bool srgb) {
+        if (fourcc == read_u32("DXT1")) {
+            return srgb ? TextureDataFormat::BC1_SRGB : TextureDataFormat::BC1;
+        } else if (fourcc == read_u32("DXT5")) {
+            return srgb ? TextureDataFormat::BC3_SRGB : TextureDataFormat::BC3;
+        } else if (fourcc == read_u32("ATI1") || fourcc == read_u32("BC4U")) {
+            return TextureDataFormat::BC4;
+        }
+
+        return TextureDataFormat::RGBA;
+    }
+
+    static TextureDataFormat dxgi_format(uint32_t format) {
+        switch (format) {
+        case 71: return TextureDataFormat::BC1;       // DXGI_FORMAT_BC1_UNORM
+        case 72: return TextureDataFormat::BC1_SRGB;  // DXGI_FORMAT_BC1_UNORM_SRGB
+        case 77: return TextureDataFormat::BC3;       // DXGI_FORMAT_BC3_UNORM
+        case 78: return TextureDataFormat::BC3_SRGB;  // DXGI_FORMAT_BC3_UNORM_SRGB
+        case 80: return TextureDataFormat::BC4;       // DXGI_FORMAT_BC4_UNORM
+        case 98: return TextureDataFormat::BC7;       // DXGI_FORMAT_BC7_UNORM
+        case 99: return TextureDataFormat::BC7_SRGB;  // DXGI_FORMAT_BC7_UNORM_SRGB
+        default: return TextureDataFormat::RGBA;
+        }
+    }
+
+    static TextureDataFormat ktx_format(uint32_t internal_format) {
+        switch (internal_format) {
+        case 0x83F0: // GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+        case 0x83F1: // GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+            return TextureDataFormat::BC1;
+        case 0x8C4C: // GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+        case 0x8C4D: // GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT
+            return TextureDataFormat::BC1_SRGB;
+        case 0x83F3: // GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+            return TextureDataFormat::BC3;
+        case 0x8C4F: // GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+            return TextureDataFormat::BC3_SRGB;
+        case 0x8DBB: // GL_COMPRESSED_RED_RGTC1
+            return TextureDataFormat::BC4;
+        case 0x8E8C: // GL_COMPRESSED_RGBA_BPTC_UNORM
+            return TextureDataFormat::BC7;
+        case 0x8E8D: // GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+            return TextureDataFormat::BC7_SRGB;
+        default:
+            return TextureDataFormat::RGBA;
+        }
+    }
+
+    bool TextureImage::load_container(
+        const boost::filesystem::path& path,
+        TextureDataFormat data_format,
+        TextureImage& image
+    ) {
+        std::string extension = path.extension().string();
+
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) {
+            return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        });
+
+        bool dds = extension == ".dds";
+        bool ktx = extension == ".ktx";
+
+        if (!dds && !ktx) {
+            return false;
+        }
+
+        MappedFile f(path);
+        TextureDataFormat format;
+        int width, height;
+        uint32_t num_levels;
+        size_t offset;
+
+        if (dds) {
+            // A DDS file is the magic number, a 124-byte header and, if the pixel format's FourCC
+            // is DX10, a 20-byte extended header. The levels follow back to back.
+            if (f.size() < 128 || std::memcmp(f.data(), "DDS ", 4) != 0) {
+                throw texture_file_error(path, "not a DDS file");
+            }
+
+            height = static_cast<int>(read_u32(f.data() + 12));
+            width = static_cast<int>(read_u32(f.data() + 16));
+            num_levels = std::max<uint32_t>(read_u32(f.data() + 28), 1);
+
+            uint32_t pixel_format_flags = read_u32(f.data() + 80);
+            uint32_t fourcc = read_u32(f.data() + 84);
+
+            if (!(pixel_format_flags & 0x4)) {
+                throw texture_file_error(path, "DDS file is not block-compressed");
+            }
+
+            if (fourcc == read_u32("DX10")) {
+                if (f.size() < 148) {
+                    throw texture_file_error(path, "truncated DDS file");
+                }
+
+                format = dxgi_format(read_u32(f.data() + 128));
+                offset = 148;
+            } else {
+                // Older DDS files don't say which colour space they're in
+                format = dds_format(fourcc, texture_decoded_format(data_format) == TextureDataFormat::SRGBA);
+                offset = 128;
+            }
+        } else {
+            static const char ktx_magic[12] = {
+                '\xAB', 'K', 'T', 'X', ' ', '1', '1', '\xBB', '\r', '\n', '\x1A', '\n'
+            };
+
+            if (f.size() < 64 || std::memcmp(f.data(), ktx_magic, sizeof(ktx_magic)) != 0) {
+                throw texture_file_error(path, "not a KTX file");
+            }
+
+            if (read_u32(f.data() + 12) != 0x04030201) {
+                throw texture_file_error(path, "KTX file has the wrong endianness");
+            }
+
+            if (read_u32(f.data() + 44) > 1 || read_u32(f.data() + 48) != 0 || read_u32(f.data() + 52) != 1) {
+                throw texture_file_error(path, "KTX file is not a single 2D texture");
+            }
+
+            format = ktx_format(read_u32(f.data() + 28));
+            width = static_cast<int>(read_u32(f.data() + 36));
+            height = static_cast<int>(read_u32(f.data() + 40));
+            num_levels = std::max<uint32_t>(read_u32(f.data() + 56), 1);
+            offset = 64 + static_cast<size_t>(read_u32(f.data() + 60));
+        }
+
+        if (!texture_format_compressed(format)) {
+            throw texture_file_error(path, "unsupported texture format");
+        }
+
+        if (width <= 0 || height <= 0 || num_levels > static_cast<uint32_t>(texture_mipmap_levels(width, height))) {
+            throw texture_file_error(path, "invalid texture size");
+        }
+
+        // Colour maps and grayscale maps can't be swapped for each other, since shaders read them
+        // differently
+        if (is_compressed_color(format) != (texture_decoded_format(data_format) != TextureDataFormat::GRAYSCALE)) {
+            throw texture_file_error(path, "wrong number of channels");
+        }
+
+        std::vector<TextureLevel> levels;
+
+        for (uint32_t i = 0; i < num_levels; i++) {
+            TextureLevel level;
+
+            level.width = std::max(width >> i, 1);
+            level.height = std::max(height >> i, 1);
+            level.size = texture_data_size(format, level.width, level.height);
+
+            // KTX files store the size of each level before it, padded to 4 bytes
+            if (ktx) {
+                if (offset + 4 > f.size() || read_u32(f.data() + offset) != level.size) {
+                    throw texture_file_error(path, "invalid KTX level");
+                }
+
+                offset += 4;
+            }
+
+            level.offset = offset;
+            offset += ktx ? (level.size + 3) & ~static_cast<size_t>(3) : level.size;
+
+            if (level.offset + level.size > f.size()) {
+                throw texture_file_error(path, "truncated texture data");
+            }
+
+            levels.push_back(level);
+        }
+
+        image.m_data = f.data();
+        image.m_file = std::move(f);
+        image.m_format = format;
+        image.m_levels = std::move(levels);
+
+        return true;
+    }
+
+    // Fills in the fields of the header that identify the source image and how it was converted.
+    // Returns false if there's nothing to cache the texture against.
+    static bool fill_source_info(
+        const boost::filesystem::path& path,
+        TextureDataFormat requested_format,
+        MipmapFilter mipmap_filter,
+        TextureCacheHeader& header,
+        std::string& canonical
+    ) {
+        CacheSource source;
+
+        if (!cache_source_info(path, source)) {
+            return false;
+        }
+
+        canonical = std::move(source.canonical_path);
+
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, texture_cache_magic, sizeof(header.magic));
+
+        header.version = texture_cache_version;
+        header.requested_format = static_cast<uint32_t>(requested_format);
+        header.mipmap_filter = static_cast<uint32_t>(mipmap_filter);
+
+        header.source_size = source.size;
+        header.source_mtime_sec = source.mtime_sec;
+        header.source_mtime_nsec = source.mtime_nsec;
+
+        header.path_length = canonical.size();
+
+        return true;
+    }
+
+    bool TextureImage::load_cache(
+        const boost::filesystem::path& path,
+        TextureDataFormat data_format,
+        MipmapFilter mipmap_filter,
+        TextureImage& image
+    ) {
+        TextureCacheHeader expected;
+        std::string canonical;
+
+        if (!fill_source_info(path, data_format, mipmap_filter, expected, canonical)) {
+            return false;
+        }
+
+        MappedFile f;
+
+        try {
+            f = MappedFile(cache_path(path, data_format));
+        } catch (std::runtime_error& e) {
+            return false;
+        }
+
+        if (f.size() < sizeof(TextureCacheHeader)) {
+            return false;
+        }
+
+        TextureCacheHeader header;
+        std::memcpy(&header, f.data(), sizeof(header));
+
+        if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+            || header.version != expected.version
+            || header.requested_format != expected.requested_format
+            || header.mipmap_filter != expected.mipmap_filter
+            || header.source_size != expected.source_size
+            || header.source_mtime_sec != expected.source_mtime_sec
+            || header.source_mtime_nsec != expected.source_mtime_nsec
+            || header.path_length != expected.path_length) {
+            return false;
+        }
+
+        auto format = static_cast<TextureDataFormat>(header.format);
+
+        if (header.format > static_cast<uint32_t>(TextureDataFormat::BC7_SRGB)
+            || header.width <= 0 || header.height <= 0 || header.num_levels == 0
+            || header.num_levels > static_cast<uint32_t>(texture_mipmap_levels(header.width, header.height))) {
+            return false;
+        }
+
+        size_t path_offset = sizeof(TextureCacheHeader);
+        size_t data_offset = path_offset + cache_padded_path_length(header.path_length);
+
+        auto levels = texture_levels(format, header.width, header.height, header.num_levels);
+
+        if (f.size() != data_offset + levels.back().offset + levels.back().size
+            || std::memcmp(f.data() + path_offset, canonical.data(), canonical.size()) != 0) {
+            return false;
+        }
+
+        image.m_data = f.data() + data_offset;
+        image.m_file = std::move(f);
+        image.m_format = format;
+        image.m_levels = std::move(levels);
+
+        return true;
+    }
+
+    void TextureImage::write_cache(
+        const boost::filesystem::path& path,
+        TextureDataFormat data_format,
+        MipmapFilter mipmap_filter
+    ) const {
+        TextureCacheHeader header;
+        std::string canonical;
+
+        if (!fill_source_info(path, data_format, mipmap_filter, header, canonical)) {
+            return;
+        }
+
+        header.format = static_cast<uint32_t>(this->m_format);
+        header.num_levels = static_cast<uint32_t>(this->m_levels.size());
+        header.width = this->width();
+        header.height = this->height();
+
+        std::string padded_path = canonical;
+
+        padded_path.resize(cache_padded_path_length(canonical.size()), '\0');
+
+        write_cache_file(cache_path(path, data_format), "texture", [&](std::ostream& f) {
+            f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            f.write(padded_path.data(), padded_path.size());
+            f.write(this->m_data, this->size());
+        });
+    }
+}
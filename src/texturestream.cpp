@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <cmath>
+
+#include "texturestream.hpp"
+
+namespace hw3 {
+    int TextureStreamer::first_resident_level(const TextureImage& image) {
+        const auto& levels = image.levels();
+
+        for (size_t i = 0; i < levels.size(); i++) {
+            if (std::max(levels[i].width, levels[i].height) <= TextureStreamer::resident_size) {
+                return static_cast<int>(i);
+            }
+        }
+
+        return static_cast<int>(levels.size()) - 1;
+    }
+
+    void TextureStreamer::add(
+        const std::shared_ptr<Texture2DArray>& texture,
+        std::vector<std::shared_ptr<const TextureImage>> images
+    ) {
+        Entry entry;
+
+        entry.texture = texture;
+        entry.images = std::move(images);
+        entry.first_resident_level = texture->base_level();
+        entry.requested_level = texture->base_level();
+
+        // Arrays are keyed by address, so a new array may take over the entry of one that has since
+        // been destroyed
+        this->m_entries[texture.get()] = std::move(entry);
+    }
+
+    void TextureStreamer::request(const Texture2DArray& texture, float screen_size) {
+        auto it = this->m_entries.find(&texture);
+
+        if (it == this->m_entries.end()) {
+            return;
+        }
+
+        Entry& entry = it->second;
+        float size = static_cast<float>(std::max(texture.size().x, texture.size().y));
+        int level = 0;
+
+        // Each level is half the size of the one before, so the level needed is the number of times
+        // the texture can be halved while still being at least as large as it is on screen
+        if (screen_size < size) {
+            level = static_cast<int>(std::log2(size / std::max(screen_size, 1.0f)));
+        }
+
+        entry.requested_level = std::min(entry.requested_level, level);
+        entry.last_requested = this->m_updates;
+    }
+
+    bool TextureStreamer::make_room(size_t size, size_t& resident_bytes) {
+        while (resident_bytes + this->m_pending_bytes + size > this->m_budget) {
+            Entry* victim = nullptr;
+            std::shared_ptr<Texture2DArray> victim_texture;
+
+            // Only levels larger than what an array needs right now can be evicted, starting with
+            // the arrays that were needed least recently and then the largest levels
+            for (auto& entry : this->m_entries) {
+                auto texture = entry.second.texture.lock();
+
+                if (!texture || entry.second.pending || texture->base_level() >= entry.second.requested_level) {
+                    continue;
+                }
+
+                if (
+                    !victim
+                    || entry.second.last_requested < victim->last_requested
+                    || (
+                        entry.second.last_requested == victim->last_requested
+                        && texture->level_size(texture->base_level())
+                            > victim_texture->level_size(victim_texture->base_level())
+                    )
+                ) {
+                    victim = &entry.second;
+                    victim_texture = std::move(texture);
+                }
+            }
+
+            if (!victim) {
+                return false;
+            }
+
+            int base_level = victim_texture->base_level();
+
+            resident_bytes -= victim_texture->level_size(base_level);
+            victim_texture->evict_levels(base_level + 1);
+
+            this->m_evicted_levels++;
+        }
+
+        return true;
+    }
+
+    void TextureStreamer::stream_in(Entry& entry, const std::shared_ptr<Texture2DArray>& texture) {
+        if (!this->m_loader) {
+            this->m_loader = std::make_unique<AssetLoader>(1);
+        }
+
+        AssetLoader* loader = this->m_loader.get();
+        int level = texture->base_level() - 1;
+
+        std::weak_ptr<Texture2DArray> weak_texture = entry.texture;
+        auto images = std::make_shared<const std::vector<std::shared_ptr<const TextureImage>>>(entry.images);
+        auto upload = std::make_shared<TextureUpload>(*entry.images[0], level, level + 1, texture->layers());
+
+        entry.pending = true;
+        this->m_pending_bytes += upload->size();
+
+        // The upload buffer is a GL object, so the job hands its only reference over to the
+        // completion rather than keeping a copy that the loader thread might end up dropping last.
+        // Copying out of mapped texture caches also faults the level in here rather than on the
+        // main thread.
+        loader->queue([this, loader, weak_texture, images, upload]() mutable {
+            for (size_t i = 0; i < images->size(); i++) {
+                upload->copy_layer(static_cast<int>(i), *(*images)[i]);
+            }
+
+            loader->complete([this, weak_texture, images, upload = std::move(upload)]() {
+                this->finish_stream_in(weak_texture, *images, *upload);
+            });
+        });
+    }
+
+    void TextureStreamer::finish_stream_in(
+        const std::weak_ptr<Texture2DArray>& weak_texture,
+        const std::vector<std::shared_ptr<const TextureImage>>& images,
+        TextureUpload& upload
+    ) {
+        this->m_pending_bytes -= upload.size();
+
+        auto texture = weak_texture.lock();
+
+        if (!texture) {
+            return;
+        }
+
+        auto it = this->m_entries.find(texture.get());
+
+        if (it != this->m_entries.end()) {
+            it->second.pending = false;
+        }
+
+        // Pending arrays are never evicted, but the array may have been reloaded since
+        if (texture->base_level() != upload.end_level()) {
+            return;
+        }
+
+        if (upload.finish()) {
+            texture->load_levels(upload);
+        } else {
+            texture->load_levels(images, upload.first_level());
+        }
+
+        this->m_streamed_levels++;
+    }
+
+    size_t TextureStreamer::update(std::chrono::steady_clock::duration budget) {
+        size_t num_uploaded = this->m_loader ? this->m_loader->run_completions(budget) : 0;
+
+        size_t resident_bytes = 0;
+        size_t num_pending = 0;
+        std::vector<std::pair<Entry*, std::shared_ptr<Texture2DArray>>> wanted;
+
+        for (auto it = this->m_entries.begin(); it != this->m_entries.end();) {
+            Entry& entry = it->second;
+            auto texture = entry.texture.lock();
+
+            if (!texture) {
+                it = this->m_entries.erase(it);
+                continue;
+            }
+
+            resident_bytes += texture->data_size();
+
+            if (entry.pending) {
+                num_pending++;
+            } else if (entry.requested_level < texture->base_level()) {
+                wanted.emplace_back(&entry, std::move(texture));
+            }
+
+            ++it;
+        }
+
+        // The arrays that are furthest from the level they need get to go first
+        std::sort(wanted.begin(), wanted.end(), [](const auto& a, const auto& b) {
+            return a.second->base_level() - a.first->requested_level
+                > b.second->base_level() - b.first->requested_level;
+        });
+
+        for (const auto& w : wanted) {
+            if (num_pending >= TextureStreamer::max_pending) {
+                break;
+            }
+
+            if (this->make_room(w.second->level_size(w.second->base_level() - 1), resident_bytes)) {
+                this->stream_in(*w.first, w.second);
+                num_pending++;
+            }
+        }
+
+        for (auto& entry : this->m_entries) {
+            entry.second.requested_level = entry.second.first_resident_level;
+        }
+
+        this->m_updates++;
+
+        return num_uploaded;
+    }
+
+    void TextureStreamer::clear() {
+        // Stopping the loader first drops the completions of any levels still being streamed in
+        this->m_loader.reset();
+        this->m_entries.clear();
+
+        this->m_pending_bytes = 0;
+        this->m_updates = 0;
+        this->m_streamed_levels = 0;
+        this->m_evicted_levels = 0;
+    }
+
+    TextureStreamingStats TextureStreamer::stats() const {
+        TextureStreamingStats stats;
+
+        stats.budget = this->m_budget;
+        stats.streamed_levels = this->m_streamed_levels;
+        stats.evicted_levels = this->m_evicted_levels;
+
+        for (const auto& entry : this->m_entries) {
+            if (auto texture = entry.second.texture.lock()) {
+                stats.textures++;
+                stats.bytes += texture->data_size();
+            }
+        }
+
+        return stats;
+    }
+}
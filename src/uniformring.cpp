@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+#include "opengl.hpp"
+#include "uniformring.hpp"
+
+namespace hw3 {
+    // How long to wait on a fence before checking it again
+    static constexpr GLuint64 fence_timeout = 1000000000;
+
+    static bool has_buffer_storage() {
+        static const bool supported = glfwExtensionSupported("GL_ARB_buffer_storage") == GLFW_TRUE;
+
+        return supported;
+    }
+
+    size_t UniformRing::offset_alignment() {
+        static const size_t alignment = ([]() {
+            GLint alignment = 0;
+
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            clear_errors();
+
+            // 256 is the largest alignment any implementation asks for
+            return alignment > 0 ? static_cast<size_t>(alignment) : static_cast<size_t>(256);
+        })();
+
+        return alignment;
+    }
+
+    UniformRing::~UniformRing() {
+        this->release();
+    }
+
+    void UniformRing::allocate(size_t region_size) {
+        size_t size = region_size * UniformRing::frames;
+
+        glGenBuffers(1, &this->m_id);
+
+        if (this->m_id == 0) {
+            clear_errors();
+            throw std::runtime_error("Failed to allocate UniformRing");
+        }
+
+        glBindBuffer(GL_UNIFORM_BUFFER, this->m_id);
+
+        if (has_buffer_storage()) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+            glBufferStorage(GL_UNIFORM_BUFFER, size, nullptr, flags);
+            this->m_data = static_cast<char*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags));
+        } else {
+            glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+        }
+
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        handle_errors();
+
+        this->m_region_size = region_size;
+        this->m_region = 0;
+    }
+
+    void UniformRing::release() {
+        for (auto& fence : this->m_fences) {
+            if (fence) {
+                glDeleteSync(fence);
+                fence = nullptr;
+            }
+        }
+
+        // Deleting a buffer unmaps it implicitly, and the GL keeps its storage around until any
+        // draws still reading from it have finished
+        if (this->m_id) {
+            glDeleteBuffers(1, &this->m_id);
+            this->m_id = 0;
+        }
+
+        this->m_data = nullptr;
+        this->m_region_size = 0;
+    }
+
+    void UniformRing::begin_frame(size_t size) {
+        assert(!this->m_in_frame);
+
+        if (size > this->m_region_size || this->m_id == 0) {
+            size_t region_size = std::max(UniformRing::block_size(std::max(size, static_cast<size_t>(1))), this->m_region_size * 2);
+
+            this->release();
+            this->allocate(region_size);
+        }
+
+        this->m_region = (this->m_region + 1) % UniformRing::frames;
+
+        GLsync& fence = this->m_fences[this->m_region];
+
+        if (fence) {
+            GLenum result;
+
+            do {
+                result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, fence_timeout);
+            } while (result == GL_TIMEOUT_EXPIRED);
+
+            glDeleteSync(fence);
+            fence = nullptr;
+
+            if (result == GL_WAIT_FAILED) {
+                handle_errors();
+                throw std::runtime_error("Failed to wait for UniformRing fence");
+            }
+        }
+
+        this->m_offset = 0;
+        this->m_in_frame = true;
+    }
+
+    void UniformRing::end_frame() {
+        assert(this->m_in_frame);
+
+        this->m_fences[this->m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        this->m_in_frame = false;
+    }
+
+    void UniformRing::bind(GLuint binding, const void* data, size_t size) {
+        assert(this->m_in_frame);
+
+        if (this->m_offset + size > this->m_region_size) {
+            throw std::runtime_error("Too many uniform blocks written in one frame");
+        }
+
+        size_t offset = this->m_region * this->m_region_size + this->m_offset;
+
+        if (this->m_data) {
+            std::memcpy(this->m_data + offset, data, size);
+        } else {
+            glBindBuffer(GL_UNIFORM_BUFFER, this->m_id);
+            glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+        }
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, this->m_id, offset, size);
+
+        this->m_offset += UniformRing::block_size(size);
+    }
+}
@@ -1,12 +1,73 @@
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 
+#include "glstate.hpp"
 #include "opengl.hpp"
 #include "vertex.hpp"
 
 namespace hw3 {
+    uint16_t pack_half(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+
+        uint16_t sign = (bits >> 16) & 0x8000;
+        int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+        uint32_t mantissa = bits & 0x7fffff;
+
+        if (((bits >> 23) & 0xff) == 0xff) {
+            // Infinity stays infinity and NaN stays NaN
+            return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+        } else if (exponent >= 31) {
+            return sign | 0x7c00;
+        } else if (exponent <= 0) {
+            if (exponent < -10) {
+                return sign;
+            }
+
+            // Denormal result: shift the implicit leading 1 into the mantissa
+            mantissa |= 0x800000;
+
+            uint32_t shift = 14 - exponent;
+            uint32_t half_mantissa = mantissa >> shift;
+            uint32_t remainder = mantissa & ((1u << shift) - 1);
+            uint32_t halfway = 1u << (shift - 1);
+
+            if (remainder > halfway || (remainder == halfway && (half_mantissa & 1))) {
+                half_mantissa++;
+            }
+
+            return sign | half_mantissa;
+        }
+
+        uint32_t half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+        uint32_t remainder = mantissa & 0x1fff;
+
+        // A carry out of the mantissa correctly rolls over into the exponent, all the way up to
+        // infinity.
+        if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+            half++;
+        }
+
+        return sign | half;
+    }
+
+    uint32_t pack_snorm_2_10_10_10(float x, float y, float z) {
+        // OpenGL 3.3 decodes a signed normalized c as (2c + 1) / 1023, unlike 4.2 and later, which
+        // use max(c / 511, -1). Encoding for the older rule is off by at most half a step under the
+        // newer one, which renormalizing the normal in the shader hides.
+        auto pack = [](float v) {
+            float c = std::round((std::min(std::max(v, -1.0f), 1.0f) * 1023.0f - 1.0f) / 2.0f);
+            int i = static_cast<int>(std::min(std::max(c, -512.0f), 511.0f));
+            return static_cast<uint32_t>(i) & 0x3ff;
+        };
+
+        return pack(x) | (pack(y) << 10) | (pack(z) << 20);
+    }
+
     GlBuffer::GlBuffer(GlBuffer&& other) : m_id(other.m_id), m_size(other.m_size) {
         other.m_id = 0;
         other.m_size = 0;
@@ -14,12 +75,14 @@ namespace hw3 {
 
     GlBuffer::~GlBuffer() {
         if (this->m_id) {
+            gl_state::forget_buffer(this->m_id);
             glDeleteBuffers(1, &this->m_id);
         }
     }
 
     GlBuffer& GlBuffer::operator =(GlBuffer&& other) {
         if (this->m_id) {
+            gl_state::forget_buffer(this->m_id);
             glDeleteBuffers(1, &this->m_id);
         }
 
@@ -49,9 +112,10 @@ namespace hw3 {
         this->m_size = length;
     }
 
-    GlVertexArray::GlVertexArray(GlVertexArray&& other): m_id(other.m_id), m_size(other.m_size), m_buffers(std::move(other.m_buffers)) {
+    GlVertexArray::GlVertexArray(GlVertexArray&& other): m_id(other.m_id), m_size(other.m_size), m_buffers(std::move(other.m_buffers)), m_index_buffer(other.m_index_buffer) {
         other.m_id = 0;
         other.m_size = 0;
+        other.m_index_buffer = -1;
     }
 
     GlVertexArray::GlVertexArray(int num_buffers, int size) : m_size(size), m_buffers(num_buffers) {
@@ -64,21 +128,25 @@ namespace hw3 {
 
     GlVertexArray::~GlVertexArray() {
         if (this->m_id) {
+            gl_state::forget_vertex_array(this->m_id);
             glDeleteVertexArrays(1, &this->m_id);
         }
     }
 
     GlVertexArray& GlVertexArray::operator =(GlVertexArray&& other) {
         if (this->m_id) {
+            gl_state::forget_vertex_array(this->m_id);
             glDeleteVertexArrays(1, &this->m_id);
         }
 
         this->m_id = other.m_id;
         this->m_size = other.m_size;
         this->m_buffers = std::move(other.m_buffers);
+        this->m_index_buffer = other.m_index_buffer;
 
         other.m_id = 0;
         other.m_size = 0;
+        other.m_index_buffer = -1;
 
         return *this;
     }
@@ -89,30 +157,60 @@ namespace hw3 {
         DataType data_type,
         size_t stride,
         size_t start,
-        int buffer_index
+        int buffer_index,
+        AttributeConversion conversion
     ) {
         assert(*this);
         assert(buffer_index >= 0 && static_cast<size_t>(buffer_index) < this->m_buffers.size());
 
-        glBindVertexArray(this->m_id);
+        gl_state::bind_vertex_array(this->m_id);
         glBindBuffer(GL_ARRAY_BUFFER, this->m_buffers[buffer_index].id());
 
-        switch (data_type) {
-        case DataType::FLOAT:
+        switch (conversion) {
+        case AttributeConversion::FLOAT:
+        case AttributeConversion::NORMALIZED:
             glVertexAttribPointer(
                 attribute_index,
                 num_components,
                 (GLenum)data_type,
-                GL_FALSE,
+                conversion == AttributeConversion::NORMALIZED ? GL_TRUE : GL_FALSE,
                 stride,
                 (void*)start
             );
+            break;
+        case AttributeConversion::INTEGER:
+            assert(
+                data_type != DataType::FLOAT
+                && data_type != DataType::HALF_FLOAT
+                && data_type != DataType::INT_2_10_10_10_REV
+                && data_type != DataType::UNSIGNED_INT_2_10_10_10_REV
+            );
+
+            glVertexAttribIPointer(
+                attribute_index,
+                num_components,
+                (GLenum)data_type,
+                stride,
+                (void*)start
+            );
+            break;
         }
 
         glEnableVertexAttribArray(attribute_index);
         handle_errors();
     }
 
+    void GlVertexArray::bind_index_buffer(int buffer_index) {
+        assert(*this);
+        assert(buffer_index >= 0 && static_cast<size_t>(buffer_index) < this->m_buffers.size());
+        assert(this->m_buffers[buffer_index]);
+
+        gl_state::bind_vertex_array(this->m_id);
+        gl_state::bind_element_buffer(this->m_buffers[buffer_index].id());
+
+        this->m_index_buffer = buffer_index;
+    }
+
     void GlVertexArray::draw(PrimitiveType type) const {
         this->draw(0, this->size(), type);
     }
@@ -120,18 +218,53 @@ namespace hw3 {
     void GlVertexArray::draw(int first, size_t n, PrimitiveType type) const {
         assert(*this);
 
-        glBindVertexArray(this->m_id);
+        gl_state::bind_vertex_array(this->m_id);
         glDrawArrays((GLenum)type, first, n);
         handle_errors();
     }
 
-    void GlVertexArray::draw_indexed(const GlBuffer& buffer, int first, size_t n, PrimitiveType type) const {
+    void GlVertexArray::draw_indexed(
+        const GlBuffer& buffer,
+        int first,
+        size_t n,
+        PrimitiveType type,
+        IndexType index_type,
+        int base_vertex
+    ) const {
         assert(*this);
         assert(buffer);
 
-        glBindVertexArray(this->m_id);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.id());
-        glDrawElements((GLenum)type, n, GL_UNSIGNED_INT, (void*)(intptr_t)first);
+        void* offset = (void*)(intptr_t)(first * index_type_size(index_type));
+
+        gl_state::bind_vertex_array(this->m_id);
+        gl_state::bind_element_buffer(buffer.id());
+
+        if (base_vertex != 0) {
+            glDrawElementsBaseVertex((GLenum)type, n, (GLenum)index_type, offset, base_vertex);
+        } else {
+            glDrawElements((GLenum)type, n, (GLenum)index_type, offset);
+        }
+
+        handle_errors();
+    }
+
+    void GlVertexArray::draw_indexed(const IndexedDrawList& draws, PrimitiveType type) const {
+        assert(*this);
+        assert(this->m_index_buffer >= 0);
+
+        if (draws.empty()) {
+            return;
+        }
+
+        gl_state::bind_vertex_array(this->m_id);
+        glMultiDrawElementsBaseVertex(
+            (GLenum)type,
+            draws.counts(),
+            (GLenum)draws.index_type(),
+            draws.offsets(),
+            draws.size(),
+            draws.base_vertices()
+        );
         handle_errors();
     }
 }
@@ -1,5 +1,6 @@
 #include <stdexcept>
 
+#include "opengl.hpp"
 #include "window.hpp"
 
 namespace hw3 {
@@ -155,6 +156,7 @@ namespace hw3 {
         glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
         glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
         glfwWindowHint(GLFW_SAMPLES, 4);
+        request_debug_context();
 
         Cursor::standard_arrow = Cursor(glfwCreateStandardCursor(GLFW_ARROW_CURSOR));
         Cursor::standard_ibeam = Cursor(glfwCreateStandardCursor(GLFW_IBEAM_CURSOR));
@@ -1,8 +1,16 @@
-#include <boost/algorithm/string.hpp>
-#include <boost/filesystem/fstream.hpp>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "mappedfile.hpp"
+#include "mipmap.hpp"
 #include "shaderimpl.hpp"
+#include "textparse.hpp"
 #include "world.hpp"
 
 namespace hw3 {
@@ -30,34 +38,113 @@ namespace hw3 {
         return this->m_model->bounding_box() * this->transform_matrix();
     }
 
-    void Object::draw(
+    size_t Object::select_lod(const glm::vec3& camera_pos, float pixels_per_unit, float threshold) {
+        size_t num_lods = this->m_model->num_lods();
+
+        if (num_lods <= 1) {
+            return this->m_lod = 0;
+        }
+
+        // Measure at the point of the object's bounding sphere closest to the camera. Anything
+        // closer than that (or a camera inside the sphere) gets full detail.
+        AABB bounds = this->bounding_box();
+        float distance = glm::distance(camera_pos, bounds.center()) - glm::length(bounds.size()) / 2;
+
+        if (distance <= 0) {
+            return this->m_lod = 0;
+        }
+
+        float error_scale = pixels_per_unit * this->m_scale / distance;
+
+        // Refine as soon as the current LOD's error becomes visible, but only coarsen once the
+        // coarser LOD's error is comfortably below the threshold.
+        constexpr float hysteresis = 0.75f;
+        size_t lod = std::min(this->m_lod, num_lods - 1);
+
+        while (lod > 0 && this->m_model->lod(lod).error * error_scale > threshold) {
+            lod--;
+        }
+
+        while (lod + 1 < num_lods
+               && this->m_model->lod(lod + 1).error * error_scale <= threshold * hysteresis) {
+            lod++;
+        }
+
+        return this->m_lod = lod;
+    }
+
+    float Object::screen_size(const glm::vec3& camera_pos, float pixels_per_unit) const {
+        AABB bounds = this->bounding_box();
+        float diameter = glm::length(bounds.size());
+        float distance = glm::distance(camera_pos, bounds.center()) - diameter / 2;
+
+        if (distance <= 0) {
+            return std::numeric_limits<float>::infinity();
+        }
+
+        return pixels_per_unit * diameter / distance;
+    }
+
+    Model3DDrawStats Object::draw(
         ShaderProgram& program,
+        UniformRing& uniform_ring,
+        const Material& material,
         const RenderSettings& render_settings,
-        const glm::mat4& view_projection_matrix
+        const glm::mat4& view_projection_matrix,
+        const glm::vec3& camera_pos
     ) const {
         auto model_matrix = this->transform_matrix();
 
-        program.set_uniform("vertex_transform", view_projection_matrix * model_matrix);
-        program.set_uniform("vertex_world_transform", model_matrix);
-        program.set_uniform("normal_transform", glm::transpose(glm::inverse(glm::mat3(model_matrix))));
+        if (!this->m_model->ready()) {
+            // Show where the model will be until it has loaded, once its size is known
+            if (this->m_model->bounding_box().size() != glm::vec3(0)) {
+                this->m_model->bounding_box().draw(
+                    view_projection_matrix * model_matrix,
+                    glm::vec4(0.5, 0.5, 0.5, 1)
+                );
+            }
+
+            return Model3DDrawStats();
+        }
 
         {
-            Material m = this->m_material;
+            shaders::ObjectBlock block;
+            glm::mat3 normal_transform = glm::transpose(glm::inverse(glm::mat3(model_matrix)));
 
-            if (!render_settings.draw_textures) {
-                m = m.without_maps();
-            } else {
-                if (!render_settings.use_ambient_occlusion) {
-                    m = m.without_ao();
-                }
+            block.vertex_transform = view_projection_matrix * model_matrix;
+            block.vertex_world_transform = model_matrix;
+
+            for (int i = 0; i < 3; i++) {
+                block.normal_transform[i] = glm::vec4(normal_transform[i], 0);
             }
 
-            program.set_uniform("material", m);
+            block.position_offset = this->m_model->position_offset();
+            block.material_index = static_cast<int>(this->m_material);
+            block.position_scale = this->m_model->position_scale();
+
+            uniform_ring.bind(shaders::blocks::object, block);
         }
 
+        // Everything else about the material is already in the material table
+        program.set_uniform(shaders::uniforms::ambient_occlusion_map, material.ambient_occlusion_map.get());
+        program.set_uniform(shaders::uniforms::diffuse_map, material.diffuse_map.get());
+        program.set_uniform(shaders::uniforms::specular_map, material.specular_map.get());
+
         program.use();
 
-        this->m_model->draw();
+        Model3DDrawStats stats;
+
+        if (render_settings.cull_meshlets) {
+            stats = this->m_model->draw_culled(
+                this->m_lod,
+                view_projection_matrix * model_matrix,
+                glm::vec3(glm::inverse(model_matrix) * glm::vec4(camera_pos, 1))
+            );
+        } else {
+            this->m_model->draw(this->m_lod);
+
+            stats.triangles = this->m_model->lod(this->m_lod).num_triangles;
+        }
 
         if (render_settings.draw_bounding_boxes) {
             this->m_model->bounding_box().draw(
@@ -70,22 +157,8 @@ namespace hw3 {
                 glm::vec4(0, 0, 1, 1)
             );
         }
-    }
-
-    void ShaderProgram::uniform_setter<PointLight>::operator ()(
-        ShaderProgram& program,
-        std::string name,
-        const PointLight& value
-    ) {
-        program.set_uniform(name + ".pos", value.pos);
-
-        program.set_uniform(name + ".ambient", value.ambient);
-        program.set_uniform(name + ".diffuse", value.diffuse);
-        program.set_uniform(name + ".specular", value.specular);
 
-        program.set_uniform(name + ".a0", value.a0);
-        program.set_uniform(name + ".a1", value.a1);
-        program.set_uniform(name + ".a2", value.a2);
+        return stats;
     }
 
     void OrbitControls::begin_rotate(glm::vec2 pos) {
@@ -195,6 +268,71 @@ namespace hw3 {
         }
     }
 
+    size_t World::add_material(Material material) {
+        if (this->m_materials.size() >= static_cast<size_t>(shaders::max_materials)) {
+            throw std::runtime_error("Too many materials");
+        }
+
+        this->m_materials.push_back(std::move(material));
+        this->m_materials_changed = true;
+
+        return this->m_materials.size() - 1;
+    }
+
+    void World::upload_materials() {
+        std::vector<shaders::MaterialBlock> blocks(this->m_materials.size());
+
+        for (size_t i = 0; i < this->m_materials.size(); i++) {
+            const Material& material = this->m_materials[i];
+            shaders::MaterialBlock& block = blocks[i];
+
+            block.ambient = material.ambient;
+            block.ambient_occlusion_layer = material.ambient_occlusion_map->layer();
+
+            block.diffuse = material.diffuse;
+            block.diffuse_layer = material.diffuse_map->layer();
+
+            block.specular = material.specular;
+            block.specular_layer = material.specular_map->layer();
+
+            block.shininess = material.shininess;
+        }
+
+        this->m_material_buffer.load_data(blocks, GL_STATIC_DRAW);
+        this->m_materials_changed = false;
+    }
+
+    void World::request_texture_levels(const Object& obj, const glm::vec3& camera_pos, float pixels_per_unit) {
+        if (!this->m_render_settings.draw_textures || this->m_render_settings.mode == RenderMode::NORMALS) {
+            return;
+        }
+
+        // Objects entirely behind the camera don't need any more detail than they already have
+        AABB bounds = obj.bounding_box();
+        glm::vec4 view_pos = this->m_camera.view_matrix() * glm::vec4(bounds.center(), 1);
+
+        if (view_pos.z > glm::length(bounds.size()) / 2) {
+            return;
+        }
+
+        // There's no telling how the maps are laid out over the model, so assume each covers it once
+        float screen_size = obj.screen_size(camera_pos, pixels_per_unit);
+        const Material& material = this->m_materials[obj.material()];
+
+        auto request = [&](const Sampler2DArray& map) {
+            if (auto texture = map.texture()) {
+                this->m_texture_streamer.request(*texture, screen_size);
+            }
+        };
+
+        request(*material.diffuse_map);
+        request(*material.specular_map);
+
+        if (this->m_render_settings.use_ambient_occlusion) {
+            request(*material.ambient_occlusion_map);
+        }
+    }
+
     AABB World::bounding_box() const {
         glm::vec3 min(std::numeric_limits<float>::infinity());
         glm::vec3 max(-std::numeric_limits<float>::infinity());
@@ -215,13 +353,126 @@ namespace hw3 {
         return AABB(min, max);
     }
 
+    /*
+     * Packs a scene's texture maps into texture arrays once all of their images have been loaded:
+     * images with the same format, size and number of mipmap levels become layers of the same
+     * array, so that objects whose materials use different images can be drawn without binding any
+     * different textures. Until then, each image is in an array of its own.
+     *
+     * Only holds weak references to the layers, since the loader jobs that load the images hold
+     * the packer.
+     */
+    class TexturePacker {
+        struct LoadedImage {
+            std::weak_ptr<TextureLayer> layer;
+            std::shared_ptr<const TextureImage> image;
+        };
+
+        TextureStreamer* m_streamer;
+
+        size_t m_pending = 0;
+        std::vector<LoadedImage> m_images;
+
+        void pack();
+    public:
+        TexturePacker(TextureStreamer* streamer) : m_streamer(streamer) {}
+
+        // Counts an image that has started loading. Images only finish loading once the whole
+        // scene has been read, so packing can't happen before every image has been counted.
+        void expect() { this->m_pending++; }
+
+        // Notes that an image has been loaded into the given layer, and packs all of the images
+        // once it's the last one
+        void loaded(const std::shared_ptr<TextureLayer>& layer, std::shared_ptr<const TextureImage> image);
+    };
+
+    void TexturePacker::loaded(const std::shared_ptr<TextureLayer>& layer, std::shared_ptr<const TextureImage> image) {
+        assert(this->m_pending > 0);
+
+        this->m_images.push_back(LoadedImage {
+            .layer = layer,
+            .image = std::move(image)
+        });
+
+        if (--this->m_pending == 0) {
+            this->pack();
+        }
+    }
+
+    void TexturePacker::pack() {
+        std::map<
+            std::tuple<TextureDataFormat, int, int, size_t>,
+            std::vector<std::pair<std::shared_ptr<TextureLayer>, std::shared_ptr<const TextureImage>>>
+        > groups;
+
+        for (auto& loaded : this->m_images) {
+            if (auto layer = loaded.layer.lock()) {
+                const TextureImage& image = *loaded.image;
+
+                groups[std::make_tuple(image.format(), image.width(), image.height(), image.levels().size())]
+                    .emplace_back(std::move(layer), std::move(loaded.image));
+            }
+        }
+
+        this->m_images.clear();
+
+        size_t max_layers = static_cast<size_t>(Texture2DArray::max_layers());
+
+        for (const auto& group : groups) {
+            const auto& members = group.second;
+
+            for (size_t first = 0; first < members.size(); first += max_layers) {
+                size_t end = std::min(first + max_layers, members.size());
+
+                // Images that don't share their shape with any others stay in their own arrays
+                if (end - first < 2) {
+                    continue;
+                }
+
+                std::vector<std::shared_ptr<const TextureImage>> images;
+
+                for (size_t i = first; i < end; i++) {
+                    images.push_back(members[i].second);
+                }
+
+                // The new array starts out with just the small levels again, and the streamer
+                // streams the larger ones back in as they're needed. The old arrays are destroyed
+                // once none of their layers are left in them.
+                int base_level = TextureStreamer::first_resident_level(*images[0]);
+                auto texture = std::make_shared<Texture2DArray>();
+
+                texture->load_data(images, base_level);
+
+                for (size_t i = first; i < end; i++) {
+                    members[i].first->texture = texture;
+                    members[i].first->layer = static_cast<int>(i - first);
+                }
+
+                if (base_level > 0) {
+                    this->m_streamer->add(texture, std::move(images));
+                }
+            }
+        }
+    }
+
+    // Texture maps are filtered this anisotropically unless the scene asks otherwise, as long as the
+    // driver supports it
+    static constexpr float default_anisotropy = 8;
+
     class SceneLoader {
         World* m_world;
-        std::istream* m_stream;
+        AssetLoader* m_asset_loader;
+        std::shared_ptr<TexturePacker> m_texture_packer;
+        LineReader m_lines;
         boost::filesystem::path m_dir;
 
         std::map<std::string, std::shared_ptr<Model3D>> m_models;
-        std::map<std::string, Material> m_materials;
+        std::map<std::string, size_t> m_materials;
+        size_t m_default_material = std::numeric_limits<size_t>::max();
+
+        TextureCompression m_texture_compression = TextureCompression::BC7;
+        MipmapFilter m_mipmap_filter = MipmapFilter::KAISER;
+        SamplerState m_sampler_state;
 
         size_t m_current_line_number = 0;
         std::vector<std::string> m_current_line;
@@ -232,7 +483,13 @@ namespace hw3 {
         boost::filesystem::path resolve_path(std::string path);
 
         glm::vec3 read_vec3(size_t offset);
+        std::shared_ptr<Sampler2DArray> load_texture_map(const std::string& path, TextureDataFormat format);
+        size_t add_material(Material material);
 
+        // The plain white material of objects that don't name one
+        size_t default_material();
+
+        void parse_textures();
         void parse_mdl();
         void parse_mtl();
         void parse_alight();
@@ -241,20 +498,25 @@ namespace hw3 {
     public:
         SceneLoader(
             World* world,
-            std::istream* stream,
+            AssetLoader* asset_loader,
+            const MappedFile& file,
             boost::filesystem::path dir
-        ) : m_world(world), m_stream(stream), m_dir(dir) {}
+        ) : m_world(world), m_asset_loader(asset_loader),
+            m_texture_packer(std::make_shared<TexturePacker>(&world->texture_streamer())),
+            m_lines(file.begin(), file.end()), m_dir(dir) {
+            this->m_sampler_state.anisotropy = default_anisotropy;
+        }
 
         void load();
     };
 
-    static size_t count_indentation(const std::string& line) {
+    static size_t count_indentation(const TextToken& line) {
         size_t indentation = 0;
 
-        for (char c : line) {
-            if (c == ' ') {
+        for (const char* c = line.begin; c != line.end; c++) {
+            if (*c == ' ') {
                 indentation += 1;
-            } else if (c == '\t') {
+            } else if (*c == '\t') {
                 indentation += 4;
             } else {
                 break;
@@ -265,30 +527,22 @@ namespace hw3 {
     }
 
     bool SceneLoader::read_next_line() {
-        std::string line;
+        TextToken line;
 
-        while (std::getline(*this->m_stream, line)) {
-            size_t comment_pos = line.find("#");
+        while (this->m_lines.next(line)) {
+            const char* comment = static_cast<const char*>(std::memchr(line.begin, '#', line.size()));
 
-            if (comment_pos != std::string::npos) {
-                line = line.substr(0, comment_pos);
+            if (comment != nullptr) {
+                line.end = comment;
             }
 
-            size_t indent = count_indentation(line);
-            boost::trim(line);
-
             this->m_current_line_number++;
+            this->m_current_line.clear();
 
-            if (line.size() > 0) {
-                this->m_current_line.clear();
-                boost::split(
-                    this->m_current_line,
-                    line,
-                    boost::is_any_of(" \t"),
-                    boost::token_compress_on
-                );
+            split_tokens(line.begin, line.end, this->m_current_line);
 
-                this->m_current_indent = indent;
+            if (this->m_current_line.size() > 0) {
+                this->m_current_indent = count_indentation(line);
                 return true;
             }
         }
@@ -327,6 +581,230 @@ namespace hw3 {
         );
     }
 
+    std::shared_ptr<Sampler2DArray> SceneLoader::load_texture_map(const std::string& path, TextureDataFormat format) {
+        AssetLoader* asset_loader = this->m_asset_loader;
+        TextureStreamer* streamer = &this->m_world->texture_streamer();
+        std::shared_ptr<TexturePacker> packer = this->m_texture_packer;
+        MipmapFilter mipmap_filter = this->m_mipmap_filter;
+
+        format = texture_compressed_format(format, this->m_texture_compression);
+
+        // Maps using the same image share its layer, so each image is only loaded once. Until it
+        // has loaded, the layer is empty and samplers draw it as a single white pixel, which
+        // leaves just the material's flat colour.
+        auto layer = this->m_world->texture_cache().get(
+            this->resolve_path(path),
+            format,
+            mipmap_filter,
+            [asset_loader, streamer, packer, format, mipmap_filter](
+                const std::shared_ptr<TextureLayer>& layer,
+                const std::string& path
+            ) {
+                // The jobs only hold weak references, so that the last reference to the layer (and
+                // with it the texture array) is never dropped on a loader thread.
+                std::weak_ptr<TextureLayer> weak_layer = layer;
+
+                packer->expect();
+
+                // Every image is decoded as a separate job, so the loader decodes as many images at
+                // once as it has threads. The decoding job also builds (and compresses) the image's
+                // mipmaps and caches them, so images found in the cache are just mapped.
+                //
+                // Only the small levels of each image are uploaded here, which is cheap enough to
+                // do straight from the image once they've been faulted in on the loader thread. The
+                // streamer then keeps the image and streams in its larger levels once something
+                // that's drawn large enough on screen needs them.
+                asset_loader->queue([asset_loader, streamer, packer, weak_layer, path, format, mipmap_filter]() {
+                    if (weak_layer.expired()) {
+                        return;
+                    }
+
+                    auto image = std::make_shared<const TextureImage>(
+                        TextureImage::load_from_file(path, format, mipmap_filter)
+                    );
+                    int base_level = TextureStreamer::first_resident_level(*image);
+
+                    image->prefetch(base_level);
+
+                    asset_loader->complete([streamer, packer, weak_layer, image, base_level]() {
+                        auto layer = weak_layer.lock();
+
+                        if (!layer) {
+                            return;
+                        }
+
+                        std::vector<std::shared_ptr<const TextureImage>> images = { image };
+
+                        layer->texture = std::make_shared<Texture2DArray>();
+                        layer->texture->load_data(images, base_level);
+                        layer->layer = 0;
+
+                        if (base_level > 0) {
+                            streamer->add(layer->texture, std::move(images));
+                        }
+
+                        packer->loaded(layer, image);
+                    });
+                });
+            }
+        );
+
+        return std::make_shared<Sampler2DArray>(layer, this->m_world->sampler_cache().get(this->m_sampler_state));
+    }
+
+    size_t SceneLoader::add_material(Material material) {
+        if (this->m_world->materials().size() >= static_cast<size_t>(shaders::max_materials)) {
+            throw this->syntax_error([&](auto& ss) {
+                ss << "Too many materials (at most " << shaders::max_materials << " per scene)";
+            });
+        }
+
+        return this->m_world->add_material(std::move(material));
+    }
+
+    size_t SceneLoader::default_material() {
+        if (this->m_default_material == std::numeric_limits<size_t>::max()) {
+            this->m_default_material = this->add_material(Material {
+                .ambient = glm::vec3(1, 1, 1),
+                .ambient_occlusion_map = Sampler2DArray::single_pixel(),
+
+                .diffuse = glm::vec3(1, 1, 1),
+                .diffuse_map = Sampler2DArray::single_pixel(),
+
+                .specular = glm::vec3(1, 1, 1),
+                .specular_map = Sampler2DArray::single_pixel(),
+
+                .shininess = 1
+            });
+        }
+
+        return this->m_default_material;
+    }
+
+    void SceneLoader::parse_textures() {
+        if (this->m_current_line.size() != 1) {
+            throw this->syntax_error([&](auto& ss) {
+                ss << "Wrong number of arguments for textures command";
+            });
+        }
+
+        size_t indent = this->m_current_indent;
+
+        if (this->read_next_line() && this->m_current_indent > indent) {
+            indent = this->m_current_indent;
+
+            do {
+                const auto& cmd = this->m_current_line[0];
+
+                if (cmd == "compress") {
+                    if (this->m_current_line.size() != 2) {
+                        throw this->syntax_error([&](auto& ss) {
+                            ss << "Wrong number of arguments for textures::compress attribute";
+                        });
+                    }
+
+                    const auto& compression = this->m_current_line[1];
+
+                    if (compression == "none") {
+                        this->m_texture_compression = TextureCompression::NONE;
+                    } else if (compression == "bc1") {
+                        this->m_texture_compression = TextureCompression::BC1;
+                    } else if (compression == "bc7") {
+                        this->m_texture_compression = TextureCompression::BC7;
+                    } else {
+                        throw this->syntax_error([&](auto& ss) {
+                            ss << "Invalid argument for textures::compress attribute";
+                        });
+                    }
+                } else if (cmd == "mipmap_filter") {
+                    if (this->m_current_line.size() != 2) {
+                        throw this->syntax_error([&](auto& ss) {
+                            ss << "Wrong number of arguments for textures::mipmap_filter attribute";
+                        });
+                    }
+
+                    const auto& filter = this->m_current_line[1];
+
+                    if (filter == "box") {
+                        this->m_mipmap_filter = MipmapFilter::BOX;
+                    } else if (filter == "kaiser") {
+                        this->m_mipmap_filter = MipmapFilter::KAISER;
+                    } else {
+                        throw this->syntax_error([&](auto& ss) {
+                            ss << "Invalid argument for textures::mipmap_filter attribute";
+                        });
+                    }
+                } else if (cmd == "filter") {
+                    if (this->m_current_line.size() != 2) {
+                        throw this->syntax_error([&](auto& ss) {
+                            ss << "Wrong number of arguments for textures::filter attribute";
+                        });
+                    }
+
+                    const auto& filter = this->m_current_line[1];
+
+                    if (filter == "bilinear") {
+                        this->m_sampler_state.downsample = TextureSampleMode::LINEAR_MIPMAP_NEAREST;
+                    } else if (filter == "trilinear") {
+                        this->m_sampler_state.downsample = TextureSampleMode::LINEAR_MIPMAP_LINEAR;
+                    } else {
+                        throw this->syntax_error([&](auto& ss) {
+                            ss << "Invalid argument for textures::filter attribute";
+                        });
+                    }
+                } else if (cmd == "anisotropy") {
+                    if (this->m_current_line.size() != 2) {
+                        throw this->syntax_error([&](auto& ss) {
+                            ss << "Wrong number of arguments for textures::anisotropy attribute";
+                        });
+                    }
+
+                    int anisotropy;
+
+                    try {
+                        anisotropy = std::stoi(this->m_current_line[1]);
+                    } catch (std::exception& e) {
+                        anisotropy = 0;
+                    }
+
+                    if (anisotropy < 1 || anisotropy > 16) {
+                        throw this->syntax_error([&](auto& ss) {
+                            ss << "Invalid argument for textures::anisotropy attribute";
+                        });
+                    }
+
+                    this->m_sampler_state.anisotropy = static_cast<float>(anisotropy);
+                } else if (cmd == "budget") {
+                    if (this->m_current_line.size() != 2) {
+                        throw this->syntax_error([&](auto& ss) {
+                            ss << "Wrong number of arguments for textures::budget attribute";
+                        });
+                    }
+
+                    int budget;
+
+                    try {
+                        budget = std::stoi(this->m_current_line[1]);
+                    } catch (std::exception& e) {
+                        budget = -1;
+                    }
+
+                    if (budget < 0) {
+                        throw this->syntax_error([&](auto& ss) {
+                            ss << "Invalid argument for textures::budget attribute";
+                        });
+                    }
+
+                    this->m_world->texture_streamer().budget(static_cast<size_t>(budget) * 1024 * 1024);
+                } else {
+                    throw this->syntax_error([&](auto& ss) {
+                        ss << "Invalid textures attribute \"" << cmd << "\"";
+                    });
+                }
+            } while (this->read_next_line() && this->m_current_indent == indent);
+        }
+    }
+
     void SceneLoader::parse_mdl() {
         if (this->m_current_line.size() != 3) {
             throw this->syntax_error([&](auto& ss) {
@@ -340,12 +818,117 @@ namespace hw3 {
             });
         }
 
-        std::shared_ptr<Model3D> m = std::make_shared<Model3D>();
-        m->load_geometry(this->resolve_path(this->m_current_line[2]));
+        auto name = this->m_current_line[1];
+        auto path = this->resolve_path(this->m_current_line[2]);
+        size_t indent = this->m_current_indent;
 
-        this->m_models[this->m_current_line[1]] = std::move(m);
+        Model3DLoadOptions options;
 
-        this->read_next_line();
+        if (this->read_next_line() && this->m_current_indent > indent) {
+            indent = this->m_current_indent;
+
+            do {
+                const auto& cmd = this->m_current_line[0];
+
+                if (cmd == "optimize") {
+                    if (this->m_current_line.size() != 2) {
+                        throw this->syntax_error([&](auto& ss) {
+                            ss << "Wrong number of arguments for mdl::optimize attribute";
+                        });
+                    }
+
+                    const auto& level = this->m_current_line[1];
+
+                    if (level == "none") {
+                        options.optimize = MeshOptimizeLevel::NONE;
+                    } else if (level == "cache") {
+                        options.optimize = MeshOptimizeLevel::VERTEX_CACHE;
+                    } else if (level == "overdraw") {
+                        options.optimize = MeshOptimizeLevel::OVERDRAW;
+                    } else {
+                        throw this->syntax_error([&](auto& ss) {
+                            ss << "Invalid argument for mdl::optimize attribute";
+                        });
+                    }
+                } else if (cmd == "lods") {
+                    if (this->m_current_line.size() != 2) {
+                        throw this->syntax_error([&](auto& ss) {
+                            ss << "Wrong number of arguments for mdl::lods attribute";
+                        });
+                    }
+
+                    int lods;
+
+                    try {
+                        lods = std::stoi(this->m_current_line[1]);
+                    } catch (std::exception& e) {
+                        lods = 0;
+                    }
+
+                    if (lods < 1 || lods > 16) {
+                        throw this->syntax_error([&](auto& ss) {
+                            ss << "Invalid argument for mdl::lods attribute";
+                        });
+                    }
+
+                    options.max_lods = static_cast<size_t>(lods);
+                } else if (cmd == "vertex_format") {
+                    if (this->m_current_line.size() != 2) {
+                        throw this->syntax_error([&](auto& ss) {
+                            ss << "Wrong number of arguments for mdl::vertex_format attribute";
+                        });
+                    }
+
+                    const auto& format = this->m_current_line[1];
+
+                    if (format == "float") {
+                        options.vertex_format = Model3DVertexFormat::FLOAT;
+                    } else if (format == "packed") {
+                        options.vertex_format = Model3DVertexFormat::PACKED;
+                    } else {
+                        throw this->syntax_error([&](auto& ss) {
+                            ss << "Invalid argument for mdl::vertex_format attribute";
+                        });
+                    }
+                } else {
+                    throw this->syntax_error([&](auto& ss) {
+                        ss << "Invalid mdl attribute \"" << cmd << "\"";
+                    });
+                }
+            } while (this->read_next_line() && this->m_current_indent == indent);
+        }
+
+        // The model stays empty until its geometry has been loaded in the background. As with
+        // texture maps, the jobs only hold weak references to it.
+        auto model = std::make_shared<Model3D>();
+        std::weak_ptr<Model3D> weak_model = model;
+        AssetLoader* asset_loader = this->m_asset_loader;
+
+        asset_loader->queue([asset_loader, weak_model, path, options]() {
+            if (weak_model.expired()) {
+                return;
+            }
+
+            auto data = std::make_shared<Model3DData>(Model3DData::load(path, options, [&](const AABB& bounds) {
+                asset_loader->complete([weak_model, bounds]() {
+                    if (auto m = weak_model.lock()) {
+                        m->bounding_box(bounds);
+                    }
+                });
+            }));
+
+            asset_loader->complete([weak_model, options, data]() {
+                auto m = weak_model.lock();
+
+                if (!m) {
+                    return;
+                }
+
+                m->load_data(*data, options.vertex_format);
+            });
+        });
+
+        this->m_models[name] = std::move(model);
     }
 
     void SceneLoader::parse_mtl() {
@@ -366,13 +949,13 @@ namespace hw3 {
 
         auto material = Material {
             .ambient = glm::vec3(1, 1, 1),
-            .ambient_occlusion_map = Sampler2D::single_pixel(),
+            .ambient_occlusion_map = Sampler2DArray::single_pixel(),
 
             .diffuse = glm::vec3(1, 1, 1),
-            .diffuse_map = Sampler2D::single_pixel(),
+            .diffuse_map = Sampler2DArray::single_pixel(),
 
             .specular = glm::vec3(1, 1, 1),
-            .specular_map = Sampler2D::single_pixel(),
+            .specular_map = Sampler2DArray::single_pixel(),
 
             .shininess = 1
         };
@@ -426,15 +1009,9 @@ namespace hw3 {
                         });
                     }
 
-                    material.ambient_occlusion_map = std::make_shared<Sampler2D>(
-                        std::make_shared<Texture2D>(Texture2D::load_from_file(
-                            this->resolve_path(this->m_current_line[1]).native(),
-                            TextureDataFormat::SRGBA
-                        ))
-                    );
-                    material.ambient_occlusion_map->set_sample_mode(
-                        TextureSampleMode::LINEAR,
-                        TextureSampleMode::LINEAR
+                    material.ambient_occlusion_map = this->load_texture_map(
+                        this->m_current_line[1],
+                        TextureDataFormat::GRAYSCALE
                     );
                 } else if (cmd == "diffuse_map") {
                     if (this->m_current_line.size() != 2) {
@@ -443,15 +1020,9 @@ namespace hw3 {
                         });
                     }
 
-                    material.diffuse_map = std::make_shared<Sampler2D>(
-                        std::make_shared<Texture2D>(Texture2D::load_from_file(
-                            this->resolve_path(this->m_current_line[1]).native(),
-                            TextureDataFormat::SRGBA
-                        ))
-                    );
-                    material.diffuse_map->set_sample_mode(
-                        TextureSampleMode::LINEAR,
-                        TextureSampleMode::LINEAR
+                    material.diffuse_map = this->load_texture_map(
+                        this->m_current_line[1],
+                        TextureDataFormat::SRGBA
                     );
                 } else if (cmd == "specular_map") {
                     if (this->m_current_line.size() != 2) {
@@ -460,15 +1031,9 @@ namespace hw3 {
                         });
                     }
 
-                    material.specular_map = std::make_shared<Sampler2D>(
-                        std::make_shared<Texture2D>(Texture2D::load_from_file(
-                            this->resolve_path(this->m_current_line[1]).native(),
-                            TextureDataFormat::SRGBA
-                        ))
-                    );
-                    material.specular_map->set_sample_mode(
-                        TextureSampleMode::LINEAR,
-                        TextureSampleMode::LINEAR
+                    material.specular_map = this->load_texture_map(
+                        this->m_current_line[1],
+                        TextureDataFormat::SRGBA
                     );
                 } else {
                     throw this->syntax_error([&](auto& ss) {
@@ -478,7 +1043,7 @@ namespace hw3 {
             } while(this->read_next_line() && this->m_current_indent == indent);
         }
 
-        this->m_materials[name] = std::move(material);
+        this->m_materials[name] = this->add_material(std::move(material));
     }
 
     void SceneLoader::parse_alight() {
@@ -506,6 +1071,12 @@ namespace hw3 {
             });
         }
 
+        if (this->m_world->point_lights().size() >= static_cast<size_t>(shaders::max_point_lights)) {
+            throw this->syntax_error([&](auto& ss) {
+                ss << "Too many point lights (at most " << shaders::max_point_lights << " per scene)";
+            });
+        }
+
         size_t indent = this->m_current_indent;
 
         auto plight = PointLight {
@@ -577,18 +1148,7 @@ namespace hw3 {
         size_t indent = this->m_current_indent;
 
         std::shared_ptr<Model3D> mdl;
-        auto mtl = Material {
-            .ambient = glm::vec3(1, 1, 1),
-            .ambient_occlusion_map = Sampler2D::single_pixel(),
-
-            .diffuse = glm::vec3(1, 1, 1),
-            .diffuse_map = Sampler2D::single_pixel(),
-
-            .specular = glm::vec3(1, 1, 1),
-            .specular_map = Sampler2D::single_pixel(),
-
-            .shininess = 1
-        };
+        size_t mtl = std::numeric_limits<size_t>::max();
 
         glm::vec3 pos;
         glm::vec3 rot;
@@ -680,6 +1240,10 @@ namespace hw3 {
             });
         }
 
+        if (mtl == std::numeric_limits<size_t>::max()) {
+            mtl = this->default_material();
+        }
+
         this->m_world->objects().push_back(std::make_unique<Object>(([&]() {
             Object obj(mdl, mtl);
 
@@ -705,7 +1269,9 @@ namespace hw3 {
                 });
             }
 
-            if (cmd == "mdl") {
+            if (cmd == "textures") {
+                this->parse_textures();
+            } else if (cmd == "mdl") {
                 this->parse_mdl();
             } else if (cmd == "mtl") {
                 this->parse_mtl();
@@ -724,70 +1290,148 @@ namespace hw3 {
     }
 
     World& World::load_scene(boost::filesystem::path path) {
-        boost::filesystem::ifstream f(path);
-
-        if (!f) {
-            throw std::runtime_error(([&]() {
-                std::ostringstream ss;
+        MappedFile f(path);
 
-                ss << "Failed to open object file \"" << path.string() << "\"";
-
-                return ss.str();
-            })());
-        }
+        // Stop loading the previous scene's assets before dropping them
+        this->m_asset_loader.reset();
 
         this->m_objects.clear();
         this->m_point_lights.clear();
+        this->m_materials.clear();
+        this->m_materials_changed = true;
         this->m_ambient_light = glm::vec3(0, 0, 0);
+        this->m_texture_streamer.clear();
+        this->m_texture_cache = TextureCache();
+
+        this->m_asset_loader = std::make_unique<AssetLoader>();
 
-        SceneLoader loader(this, &f, path.parent_path());
+        SceneLoader loader(this, this->m_asset_loader.get(), f, path.parent_path());
 
         loader.load();
 
-        if (f.bad()) {
-            throw std::runtime_error(([&]() {
-                std::ostringstream ss;
+        return *this;
+    }
+
+    size_t World::update_assets(std::chrono::steady_clock::duration budget) {
+        auto start_time = std::chrono::steady_clock::now();
+        size_t num_updates = 0;
 
-                ss << "Error reading scene file \"" << path.string() << "\"";
+        if (this->m_asset_loader) {
+            size_t num_loaded = this->m_asset_loader->run_completions(budget);
 
-                return ss.str();
-            })());
+            // Loaded and packed images may have moved the maps of materials to other layers
+            if (num_loaded > 0) {
+                this->m_materials_changed = true;
+            }
+
+            num_updates += num_loaded;
+
+            // The loader threads aren't needed anymore once everything has been loaded
+            if (this->m_asset_loader->idle()) {
+                this->m_asset_loader.reset();
+            }
         }
 
-        return *this;
+        num_updates += this->m_texture_streamer.update(budget - (std::chrono::steady_clock::now() - start_time));
+
+        return num_updates;
     }
 
-    void World::draw() const {
+    void World::draw() {
         auto& program = this->select_program();
         auto view_projection_matrix = this->camera().view_projection_matrix();
 
-        program.set_uniform("camera_position", this->camera().pos());
+        // SceneLoader rejects scenes with more lights than the frame block has room for
+        assert(this->m_point_lights.size() <= static_cast<size_t>(shaders::max_point_lights));
 
-        if (this->m_point_lights.size() > 16) {
-            throw std::runtime_error("Too many point lights");
-        }
+        // Every object may write its block this frame, after the frame block
+        this->m_uniform_ring.begin_frame(
+            UniformRing::block_size(sizeof(shaders::FrameBlock))
+                + this->m_objects.size() * UniformRing::block_size(sizeof(shaders::ObjectBlock))
+        );
 
-        if (this->m_render_settings.mode == RenderMode::STANDARD) {
-            program.set_uniform("scene_ambient", this->m_ambient_light);
-            program.set_uniform("num_point_lights", static_cast<int>(this->m_point_lights.size()));
-            for (size_t i = 0; i < this->m_point_lights.size(); i++) {
-                program.set_uniform(([&]() {
-                    std::ostringstream ss;
+        {
+            shaders::FrameBlock block = {};
+
+            block.camera_position = this->camera().pos();
+            block.use_maps = this->m_render_settings.draw_textures;
+            block.use_ambient_occlusion = this->m_render_settings.use_ambient_occlusion;
+
+            if (this->m_render_settings.mode == RenderMode::STANDARD) {
+                block.scene_ambient = this->m_ambient_light;
+                block.num_point_lights = static_cast<int>(this->m_point_lights.size());
+
+                for (size_t i = 0; i < this->m_point_lights.size(); i++) {
+                    const PointLight& pl = *this->m_point_lights[i];
+                    shaders::PointLightBlock& pl_block = block.point_lights[i];
+
+                    pl_block.pos = pl.pos;
+                    pl_block.ambient = pl.ambient;
+                    pl_block.diffuse = pl.diffuse;
+                    pl_block.specular = pl.specular;
+                    pl_block.a0 = pl.a0;
+                    pl_block.a1 = pl.a1;
+                    pl_block.a2 = pl.a2;
+                }
+            } else {
+                block.scene_ambient = glm::vec3(1);
+                block.num_point_lights = 0;
+            }
 
-                    ss << "point_lights[" << i << "]";
+            this->m_uniform_ring.bind(shaders::blocks::frame, block);
+        }
 
-                    return ss.str();
-                })(), *this->m_point_lights[i]);
-            }
-        } else {
-            program.set_uniform("scene_ambient", glm::vec3(1));
-            program.set_uniform("num_point_lights", 0);
+        if (this->m_materials_changed && !this->m_materials.empty()) {
+            this->upload_materials();
         }
 
+        if (this->m_material_buffer) {
+            glBindBufferBase(GL_UNIFORM_BUFFER, shaders::blocks::materials, this->m_material_buffer.id());
+        }
+
+        // The projection matrix scales y by cot(fov / 2), which maps onto half of the viewport
+        auto camera_pos = this->camera().pos();
+        float pixels_per_unit = this->camera().projection_matrix()[1][1] * this->camera().viewport_size().y / 2;
+        float lod_threshold = this->m_render_settings.lod_threshold
+            * std::exp2(this->m_render_settings.lod_bias);
+
+        this->m_frame_stats = FrameStats();
+
+        GlStateStats start_binds = gl_state::stats();
+
         for (const auto& obj : this->m_objects) {
-            obj->draw(program, this->m_render_settings, view_projection_matrix);
+            size_t lod = obj->select_lod(camera_pos, pixels_per_unit, lod_threshold);
+            auto stats = obj->draw(
+                program,
+                this->m_uniform_ring,
+                this->m_materials[obj->material()],
+                this->m_render_settings,
+                view_projection_matrix,
+                camera_pos
+            );
+
+            if (!obj->model()->ready()) {
+                this->m_frame_stats.pending_objects++;
+                continue;
+            }
+
+            this->request_texture_levels(*obj, camera_pos, pixels_per_unit);
+
+            if (this->m_frame_stats.objects_per_lod.size() <= lod) {
+                this->m_frame_stats.objects_per_lod.resize(lod + 1, 0);
+            }
+
+            this->m_frame_stats.objects++;
+            this->m_frame_stats.objects_per_lod[lod]++;
+            this->m_frame_stats.triangles += stats.triangles;
+            this->m_frame_stats.full_detail_triangles += obj->model()->lod(0).num_triangles;
+            this->m_frame_stats.transformed_vertices += obj->model()->lod(lod).acmr * stats.triangles;
+            this->m_frame_stats.meshlets += stats.meshlets;
+            this->m_frame_stats.culled_meshlets += stats.culled_meshlets;
         }
 
+        this->m_uniform_ring.end_frame();
+
         if (this->m_render_settings.draw_bounding_boxes && this->m_objects.size() > 1) {
             this->bounding_box().draw(view_projection_matrix, glm::vec4(0, 1, 0, 1));
         }
@@ -802,14 +1446,16 @@ namespace hw3 {
             }
 
             for (const auto& pl : this->m_point_lights) {
-                shaders::point_program.set_uniform("fixed_color", glm::vec4(pl->diffuse, 1));
+                shaders::point_program.set_uniform(shaders::uniforms::fixed_color, glm::vec4(pl->diffuse, 1));
                 shaders::point_program.set_uniform(
-                    "vertex_transform",
+                    shaders::uniforms::vertex_transform,
                     glm::translate(view_projection_matrix, pl->pos)
                 );
                 shaders::point_program.use();
                 single_point_array.draw(PrimitiveType::POINTS);
             }
         }
+
+        this->m_frame_stats.binds = gl_state::stats() - start_binds;
     }
 }